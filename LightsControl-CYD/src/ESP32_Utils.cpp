@@ -1,20 +1,8 @@
 #include "ESP32_Utils.hpp"
 
-extern lv_obj_t *label;
-
+// Start connecting and return, the connection manager waits for the WiFi events
 void ConnectWiFi_STA()
 {
+    Serial.println("Connecting to WiFi...");
     WiFi.begin(WIFI_SSID, WIFI_PASSWORD, WIFI_CHANNEL);
-    String message = "Connecting to WiFi..."; // Create message with IP
-    LV_LOG_USER(message.c_str());
-    lv_label_set_text(label, message.c_str());
-    lv_task_handler(); // let the GUI do its work
-
-    // Wait for connection
-    while (WiFi.status() != WL_CONNECTED)
-    {
-        Serial.print(".");
-        vTaskDelay(500 / portTICK_PERIOD_MS); // Délai pour éviter un CPU à 100%
-    }
-    LV_LOG_USER("Connected to WiFi");
-}
\ No newline at end of file
+}
@@ -0,0 +1,129 @@
+#include "clocksync.hpp"
+#include <Arduino.h>
+#include <esp_timer.h>
+
+struct ClockSample
+{
+    int64_t offsetUs; // Master time minus local time
+    uint32_t rttUs;
+    uint64_t timeUs;  // Local time of the exchange
+};
+
+static portMUX_TYPE clockMux = portMUX_INITIALIZER_UNLOCKED;
+static char clockBoardId[16];
+static ClockSample clockSamples[CLOCK_SYNC_SAMPLES];
+static uint8_t clockSampleCount = 0;
+static uint8_t clockSampleNext = 0;
+static uint64_t clockRequestUs = 0; // t1 of the request awaiting an answer
+static unsigned long lastClockRequestMs = 0;
+
+// Sample with the lowest round trip among those younger than CLOCK_SYNC_MAX_AGE_MS,
+// false when none is. Called with clockMux held.
+static bool bestRecentSample(uint64_t nowUs, ClockSample &best)
+{
+    bool found = false;
+    for (uint8_t i = 0; i < clockSampleCount; i++)
+    {
+        const ClockSample &sample = clockSamples[i];
+        if (nowUs - sample.timeUs <= (uint64_t)CLOCK_SYNC_MAX_AGE_MS * 1000 && (!found || sample.rttUs < best.rttUs))
+        {
+            best = sample;
+            found = true;
+        }
+    }
+    return found;
+}
+
+void initClockSync(const char *boardId)
+{
+    strncpy(clockBoardId, boardId, sizeof(clockBoardId) - 1);
+    clockBoardId[sizeof(clockBoardId) - 1] = '\0';
+}
+
+bool clockSyncRequest(char *payload, size_t size)
+{
+    unsigned long nowMs = millis();
+    portENTER_CRITICAL(&clockMux);
+    unsigned long intervalMs = clockSampleCount < CLOCK_SYNC_SAMPLES ? CLOCK_SYNC_FAST_INTERVAL_MS : CLOCK_SYNC_INTERVAL_MS;
+    bool due = nowMs - lastClockRequestMs >= intervalMs;
+    if (due)
+    {
+        lastClockRequestMs = nowMs;
+        clockRequestUs = esp_timer_get_time();
+    }
+    uint64_t t1 = clockRequestUs;
+    portEXIT_CRITICAL(&clockMux);
+
+    if (due)
+    {
+        snprintf(payload, size, "%s,%llu", clockBoardId, (unsigned long long)t1);
+    }
+    return due;
+}
+
+void handleClockSyncResponse(const char *payload, size_t len)
+{
+    uint64_t t4 = esp_timer_get_time();
+
+    // "<board id>,<t1>,<t2>", the answers to the other boards are not ours
+    size_t idLength = strlen(clockBoardId);
+    if (len <= idLength || strncmp(payload, clockBoardId, idLength) != 0 || payload[idLength] != ',')
+    {
+        return;
+    }
+    char *end;
+    uint64_t t1 = strtoull(payload + idLength + 1, &end, 10);
+    if (*end != ',')
+    {
+        return;
+    }
+    uint64_t t2 = strtoull(end + 1, NULL, 10);
+
+    portENTER_CRITICAL(&clockMux);
+    // Only the answer to the last request counts, late answers would skew the offset
+    if (t1 == clockRequestUs && t4 >= t1)
+    {
+        ClockSample sample;
+        sample.rttUs = (uint32_t)(t4 - t1);
+        sample.offsetUs = (int64_t)t2 - (int64_t)(t1 + (t4 - t1) / 2);
+        sample.timeUs = t4;
+
+        // Two offsets differ by half their round trips at most, unless the master
+        // restarted: its old samples no longer count
+        ClockSample best;
+        if (bestRecentSample(t4, best))
+        {
+            int64_t differenceUs = sample.offsetUs - best.offsetUs;
+            uint64_t toleranceUs = ((uint64_t)sample.rttUs + best.rttUs) / 2 + CLOCK_SYNC_JUMP_US;
+            if ((uint64_t)(differenceUs < 0 ? -differenceUs : differenceUs) > toleranceUs)
+            {
+                clockSampleCount = 0;
+                clockSampleNext = 0;
+            }
+        }
+
+        clockSamples[clockSampleNext] = sample;
+        clockSampleNext = (clockSampleNext + 1) % CLOCK_SYNC_SAMPLES;
+        if (clockSampleCount < CLOCK_SYNC_SAMPLES)
+        {
+            clockSampleCount++;
+        }
+        clockRequestUs = 0;
+    }
+    portEXIT_CRITICAL(&clockMux);
+}
+
+uint64_t effectStartMs()
+{
+    uint64_t nowUs = esp_timer_get_time();
+    ClockSample best;
+    portENTER_CRITICAL(&clockMux);
+    bool synced = bestRecentSample(nowUs, best);
+    portEXIT_CRITICAL(&clockMux);
+
+    if (!synced)
+    {
+        return 0;
+    }
+    return (nowUs + best.offsetUs) / 1000 + EFFECT_START_LEAD_MS;
+}
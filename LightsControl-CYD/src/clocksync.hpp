@@ -0,0 +1,28 @@
+#ifndef CLOCKSYNC_HPP
+#define CLOCKSYNC_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Clock of the master RelaysBoard (SYNC_MASTER in its config), so the effects
+// started here carry a start time every board plays at once. Same exchange as
+// between the relay boards: light/sync/req "<id>,<t1>" is answered on
+// light/sync/resp with "<id>,<t1>,<t2>", the offset comes from the answer with
+// the lowest round trip among the answers of the last CLOCK_SYNC_MAX_AGE_MS.
+// Without a recent answer effects start on arrival.
+#define CLOCK_SYNC_INTERVAL_MS 10000     // Request period once synchronised
+#define CLOCK_SYNC_FAST_INTERVAL_MS 1000 // Request period until CLOCK_SYNC_SAMPLES answers are in
+#define CLOCK_SYNC_SAMPLES 8             // Exchanges considered for the offset
+#define CLOCK_SYNC_MAX_AGE_MS 60000      // An older answer no longer counts
+#define CLOCK_SYNC_JUMP_US 5000          // Offset change beyond the round trips, the master restarted
+#define EFFECT_START_LEAD_MS 150         // Effects start this far ahead, time to reach every board
+
+void initClockSync(const char *boardId);
+// Payload of the next light/sync/req when one is due. Call from loop().
+bool clockSyncRequest(char *payload, size_t size);
+// Answer of the master, payload is terminated
+void handleClockSyncResponse(const char *payload, size_t len);
+// Shared time, in ms, for the first step of an effect sent now. 0 to start on arrival.
+uint64_t effectStartMs();
+
+#endif // CLOCKSYNC_HPP
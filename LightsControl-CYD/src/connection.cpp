@@ -0,0 +1,142 @@
+#include "connection.hpp"
+#include <Arduino.h>
+#include <WiFi.h>
+#include "ESP32_Utils.hpp"
+#include "mqtt.hpp"
+#include "ui.hpp"
+
+extern AsyncMqttClient mqttClient;
+
+TimerHandle_t connectionTimer = NULL;
+
+// Only touched in the timer task
+ConnectionState connectionState = CONNECTION_IDLE;
+uint16_t connectionFailures = 0;
+
+static void setConnectionState(ConnectionState state, uint32_t retryMs = 0)
+{
+    connectionState = state;
+    UiMessage message = {UI_CONNECTION};
+    message.connection = {state, state >= CONNECTION_MQTT_CONNECTING ? (uint32_t)WiFi.localIP() : 0, connectionFailures, retryMs};
+    postUi(message);
+}
+
+// (Re)arm the one-shot timer, from the timer task itself so it never blocks
+static void armConnectionTimer(uint32_t delayMs)
+{
+    xTimerChangePeriod(connectionTimer, pdMS_TO_TICKS(delayMs > 0 ? delayMs : 1), 0);
+}
+
+// Wait before the next attempt: doubled on each failure, with up to a quarter of
+// jitter so several displays do not hammer the broker in step
+static void backOff(ConnectionState state)
+{
+    uint8_t shift = connectionFailures < 16 ? connectionFailures : 16;
+    uint32_t delayMs = (uint32_t)CONNECTION_BACKOFF_MIN_MS << shift;
+    if (delayMs > CONNECTION_BACKOFF_MAX_MS)
+    {
+        delayMs = CONNECTION_BACKOFF_MAX_MS;
+    }
+    delayMs += esp_random() % (delayMs / 4 + 1);
+    if (connectionFailures < UINT16_MAX)
+    {
+        connectionFailures++;
+    }
+    setConnectionState(state, delayMs);
+    armConnectionTimer(delayMs);
+}
+
+static void connectWiFi()
+{
+    setConnectionState(CONNECTION_WIFI_CONNECTING);
+    ConnectWiFi_STA();
+    armConnectionTimer(CONNECTION_WIFI_TIMEOUT_MS);
+}
+
+static void connectMqtt()
+{
+    setConnectionState(CONNECTION_MQTT_CONNECTING);
+    ConnectToMqtt();
+    armConnectionTimer(CONNECTION_MQTT_TIMEOUT_MS);
+}
+
+// Every transition happens here, in the timer task, one event at a time
+static void handleConnectionEvent(void *, uint32_t event)
+{
+    switch (event)
+    {
+    case CONNECTION_EVENT_START:
+        if (connectionState == CONNECTION_IDLE)
+        {
+            connectWiFi();
+        }
+        break;
+    case CONNECTION_EVENT_TIMER:
+        switch (connectionState)
+        {
+        case CONNECTION_WIFI_CONNECTING:
+            Serial.println("WiFi connection timed out");
+            WiFi.disconnect(); // Its disconnection event finds us already backing off
+            backOff(CONNECTION_WIFI_BACKOFF);
+            break;
+        case CONNECTION_WIFI_BACKOFF:
+            connectWiFi();
+            break;
+        case CONNECTION_MQTT_CONNECTING:
+            Serial.println("MQTT connection timed out");
+            backOff(CONNECTION_MQTT_BACKOFF);
+            mqttClient.disconnect(true);
+            break;
+        case CONNECTION_MQTT_BACKOFF:
+            connectMqtt();
+            break;
+        default:
+            break;
+        }
+        break;
+    case CONNECTION_EVENT_WIFI_UP:
+        connectionFailures = 0;
+        connectMqtt();
+        break;
+    case CONNECTION_EVENT_WIFI_DOWN:
+        // Also ends the broker session, its own event is ignored below
+        if (connectionState != CONNECTION_WIFI_BACKOFF && connectionState != CONNECTION_IDLE)
+        {
+            backOff(CONNECTION_WIFI_BACKOFF);
+        }
+        break;
+    case CONNECTION_EVENT_MQTT_UP:
+        connectionFailures = 0;
+        xTimerStop(connectionTimer, 0);
+        setConnectionState(CONNECTION_ONLINE);
+        break;
+    case CONNECTION_EVENT_MQTT_DOWN:
+        if (connectionState == CONNECTION_ONLINE || connectionState == CONNECTION_MQTT_CONNECTING)
+        {
+            backOff(CONNECTION_MQTT_BACKOFF);
+        }
+        break;
+    }
+}
+
+static void onConnectionTimer(TimerHandle_t)
+{
+    handleConnectionEvent(NULL, CONNECTION_EVENT_TIMER);
+}
+
+void initConnection()
+{
+    connectionTimer = xTimerCreate("connection", pdMS_TO_TICKS(CONNECTION_BACKOFF_MIN_MS), pdFALSE, NULL, onConnectionTimer);
+}
+
+void startConnection()
+{
+    WiFi.setAutoReconnect(false); // The state machine retries, with its backoff
+    connectionEvent(CONNECTION_EVENT_START);
+}
+
+void connectionEvent(ConnectionEvent event)
+{
+    // Runs in the WiFi event or the async TCP task, hand it to the timer task
+    xTimerPendFunctionCall(handleConnectionEvent, NULL, event, pdMS_TO_TICKS(100));
+}
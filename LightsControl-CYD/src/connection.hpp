@@ -0,0 +1,49 @@
+#ifndef CONNECTION_HPP
+#define CONNECTION_HPP
+
+#include <stdint.h>
+
+// WiFi and broker connection of the CYD. A state machine fed by the WiFi and MQTT
+// events and run by the FreeRTOS timer task: nothing in it waits, failed attempts
+// are retried with an exponential backoff, and each step is posted to the UI task.
+#define CONNECTION_BACKOFF_MIN_MS 500    // First retry delay...
+#define CONNECTION_BACKOFF_MAX_MS 30000  // ...doubled on each failure up to this
+#define CONNECTION_WIFI_TIMEOUT_MS 15000 // An attempt without an address has failed
+#define CONNECTION_MQTT_TIMEOUT_MS 10000 // An attempt the broker did not answer has failed
+
+enum ConnectionState
+{
+    CONNECTION_IDLE,
+    CONNECTION_WIFI_CONNECTING,
+    CONNECTION_WIFI_BACKOFF, // Waiting to retry the access point
+    CONNECTION_MQTT_CONNECTING,
+    CONNECTION_MQTT_BACKOFF, // Waiting to retry the broker
+    CONNECTION_ONLINE
+};
+
+enum ConnectionEvent
+{
+    CONNECTION_EVENT_START,
+    CONNECTION_EVENT_TIMER,
+    CONNECTION_EVENT_WIFI_UP,
+    CONNECTION_EVENT_WIFI_DOWN,
+    CONNECTION_EVENT_MQTT_UP,
+    CONNECTION_EVENT_MQTT_DOWN
+};
+
+struct ConnectionStatus
+{
+    ConnectionState state;
+    uint32_t ip;       // 0 without WiFi
+    uint16_t failures; // Failed attempts in a row
+    uint32_t retryMs;  // Delay before the next attempt, in the backoff states
+};
+
+// Create the timer, before the WiFi and MQTT callbacks can fire
+void initConnection();
+// Connect, returns at once
+void startConnection();
+// From the WiFi and MQTT callbacks, handled later in the timer task
+void connectionEvent(ConnectionEvent event);
+
+#endif // CONNECTION_HPP
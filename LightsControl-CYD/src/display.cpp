@@ -0,0 +1,127 @@
+#include "display.hpp"
+#include <Arduino.h>
+#include <TFT_eSPI.h>
+
+#define DISPLAY_WIDTH SCREEN_HEIGHT // Landscape, as LVGL sees it
+#define DISPLAY_HEIGHT SCREEN_WIDTH
+#define DISPLAY_BUFFER_PIXELS (DISPLAY_WIDTH * DISPLAY_BUFFER_LINES)
+
+lv_display_t *display = NULL;
+
+#if DISPLAY_DMA
+TFT_eSPI tft;
+
+// Internal RAM, reachable by the SPI DMA, aligned as LVGL requires of draw buffers
+alignas(LV_DRAW_BUF_ALIGN) static uint16_t renderBuffers[2][DISPLAY_BUFFER_PIXELS];
+static_assert(sizeof(renderBuffers[0]) % LV_DRAW_BUF_ALIGN == 0, "the second render buffer must stay aligned");
+
+// Start sending an area and hand the buffer back at once: LVGL renders the next
+// area into the other buffer, and the next flush waits for this transfer first
+static void flushDma(lv_display_t *disp, const lv_area_t *area, uint8_t *pixels)
+{
+    uint32_t width = lv_area_get_width(area);
+    uint32_t height = lv_area_get_height(area);
+
+    // The panel takes RGB565 big endian, swapped while the previous transfer runs
+    lv_draw_sw_rgb565_swap(pixels, width * height);
+    tft.dmaWait();
+    tft.pushImageDMA(area->x1, area->y1, width, height, (uint16_t *)pixels);
+    lv_display_flush_ready(disp);
+}
+#else
+#define DRAW_BUF_SIZE (SCREEN_WIDTH * SCREEN_HEIGHT / 10 * (LV_COLOR_DEPTH / 8))
+static uint32_t draw_buf[DRAW_BUF_SIZE / 4];
+#endif
+
+lv_display_t *initDisplay()
+{
+#if DISPLAY_DMA
+    tft.begin();
+    tft.setRotation(DISPLAY_ROTATION);
+    tft.initDMA();
+    tft.startWrite(); // The panel has the HSPI bus to itself, CS stays low for the DMA
+
+    display = lv_display_create(DISPLAY_WIDTH, DISPLAY_HEIGHT);
+    lv_display_set_color_format(display, LV_COLOR_FORMAT_RGB565);
+    lv_display_set_flush_cb(display, flushDma);
+    lv_display_set_buffers(display, renderBuffers[0], renderBuffers[1], sizeof(renderBuffers[0]),
+                           LV_DISPLAY_RENDER_MODE_PARTIAL);
+#else
+    // Initialize the TFT display using the TFT_eSPI library
+    display = lv_tft_espi_create(SCREEN_WIDTH, SCREEN_HEIGHT, draw_buf, sizeof(draw_buf));
+    lv_display_set_rotation(display, LV_DISPLAY_ROTATION_90);
+#endif
+    return display;
+}
+
+void displayTouchPoint(int x, int y, lv_point_t &point)
+{
+#if DISPLAY_DMA
+    // What LVGL does for LV_DISPLAY_ROTATION_90, it no longer knows about the rotation
+    point.x = SCREEN_HEIGHT - 1 - y;
+    point.y = x;
+#else
+    point.x = x;
+    point.y = y;
+#endif
+}
+
+void displayCalibrationPoint(const lv_point_t &point, int &x, int &y)
+{
+    // Both drivers end up in landscape, rotated as LV_DISPLAY_ROTATION_90
+    x = point.y;
+    y = SCREEN_HEIGHT - 1 - point.x;
+}
+
+static DisplayStats *benchmarkStats = NULL;
+static uint32_t flushStartUs = 0;
+
+static void onBenchmarkEvent(lv_event_t *event)
+{
+    switch (lv_event_get_code(event))
+    {
+    case LV_EVENT_FLUSH_START:
+        flushStartUs = micros();
+        break;
+    case LV_EVENT_FLUSH_FINISH:
+    {
+        uint32_t flushUs = micros() - flushStartUs;
+        benchmarkStats->flushes++;
+        benchmarkStats->flushUs += flushUs;
+        if (flushUs > benchmarkStats->maxFlushUs)
+        {
+            benchmarkStats->maxFlushUs = flushUs;
+        }
+        break;
+    }
+    case LV_EVENT_REFR_READY:
+        benchmarkStats->frames++;
+        break;
+    default:
+        break;
+    }
+}
+
+void runDisplayBenchmark(uint32_t durationMs, DisplayStats &stats)
+{
+    stats = DisplayStats();
+    benchmarkStats = &stats;
+    lv_display_add_event_cb(display, onBenchmarkEvent, LV_EVENT_ALL, NULL);
+
+    // Whole screen every frame, the worst case of the GUI
+    uint32_t startMs = millis();
+    while (millis() - startMs < durationMs)
+    {
+        lv_obj_invalidate(lv_screen_active());
+        lv_refr_now(display);
+    }
+    stats.elapsedMs = millis() - startMs;
+
+    lv_display_remove_event_cb_with_user_data(display, onBenchmarkEvent, NULL);
+    benchmarkStats = NULL;
+
+    Serial.printf("Display %s: %u frames in %u ms, %.1f fps, %u flushes, flush %u us avg %u us max\n",
+                  DISPLAY_DMA ? "DMA" : "lv_tft_espi", (unsigned)stats.frames, (unsigned)stats.elapsedMs,
+                  stats.elapsedMs ? stats.frames * 1000.0f / stats.elapsedMs : 0.0f, (unsigned)stats.flushes,
+                  (unsigned)(stats.flushes ? stats.flushUs / stats.flushes : 0), (unsigned)stats.maxFlushUs);
+}
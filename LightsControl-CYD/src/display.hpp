@@ -0,0 +1,36 @@
+#ifndef DISPLAY_HPP
+#define DISPLAY_HPP
+
+#include <lvgl.h>
+
+// Display dimensions, panel in portrait
+#define SCREEN_WIDTH 240
+#define SCREEN_HEIGHT 320
+
+// Display driver on TFT_eSPI: LVGL renders into one buffer while the other one
+// goes out over SPI DMA, and the panel rotates itself (MADCTL) so LVGL draws in
+// landscape directly. DISPLAY_DMA false goes back to lv_tft_espi_create() to compare.
+#define DISPLAY_DMA true
+#define DISPLAY_ROTATION 1          // TFT_eSPI rotation, 1 = landscape
+#define DISPLAY_BUFFER_LINES 24     // Lines of a render buffer, two of them
+#define DISPLAY_BENCHMARK_MS 0      // Redraw continuously this long at boot and report, 0 = off
+
+// Figures of a benchmark run
+struct DisplayStats
+{
+    uint32_t elapsedMs;
+    uint32_t frames;
+    uint32_t flushes;     // Areas sent to the panel
+    uint32_t flushUs;     // Time the CPU spent in the flush callback
+    uint32_t maxFlushUs;
+};
+
+lv_display_t *initDisplay();
+// Touch point of the portrait calibration in the coordinates LVGL draws in
+void displayTouchPoint(int x, int y, lv_point_t &point);
+// The other way round, where a point LVGL draws is in the portrait calibration
+void displayCalibrationPoint(const lv_point_t &point, int &x, int &y);
+// Redraw the whole screen as fast as possible for durationMs, blocks
+void runDisplayBenchmark(uint32_t durationMs, DisplayStats &stats);
+
+#endif // DISPLAY_HPP
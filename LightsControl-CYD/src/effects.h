@@ -1,3 +1,6 @@
+#ifndef EFFECTS_H
+#define EFFECTS_H
+
 enum EffectType
 {
   BLINKING_LR,
@@ -8,5 +11,17 @@ enum EffectType
   EXTINT,
   CASCADE_LR,
   CASCADE_RL,
-  EFFECT_COUNT // Used to determine array size
-};
\ No newline at end of file
+  EFFECT_COUNT, // Used to determine array size
+  EFFECT_PROGRAM_BASE = 16 // Programs uploaded on light/program play as EFFECT_PROGRAM_BASE + slot
+};
+
+// Flags of an effect command, combined as a bitfield
+enum EffectFlags
+{
+  EFFECT_INVERT = 1 << 0,  // Lights that should be on are off and vice versa
+  EFFECT_MIRROR = 1 << 1,  // Left and right are swapped
+  EFFECT_REVERSE = 1 << 2, // The pattern plays backwards
+  EFFECT_VARIANTS = 1 << 3 // Number of flag combinations
+};
+
+#endif // EFFECTS_H
@@ -0,0 +1,50 @@
+#include "espnow.hpp"
+#include <Arduino.h>
+#include "espnowradio.h"
+#include "ESP32_Utils.hpp"
+#include "mqtt.hpp"
+#include "ui.hpp"
+
+#ifndef ESPNOW_KEY
+#define ESPNOW_KEY "" // Shared with the RelaysBoard, set it in credentials.h
+#endif
+
+// The UI task drops the copy of the light state coming through the broker
+static void onEspNowMessage(const char *topic, char *payload, size_t length)
+{
+    handleLightTopic(topic, payload, length, true);
+}
+
+// Peers expire silently, look at the link at least once per hello period
+static void onEspNowTick()
+{
+    static bool linkShown = false;
+    bool linkUp = espNowLinkUp();
+    if (linkUp != linkShown)
+    {
+        linkShown = linkUp;
+        UiMessage message = {UI_DIRECT_LINK};
+        message.directLink = linkUp;
+        postUi(message);
+    }
+}
+
+void initEspNow()
+{
+    espNowStart(ESPNOW_KEY, WIFI_CHANNEL, onEspNowMessage, onEspNowTick);
+}
+
+void setEspNowVehicle(const char *vehicleId)
+{
+    espNowSetVehicle(vehicleId);
+}
+
+bool sendEspNow(const char *topic, const char *payload, size_t length)
+{
+    return espNowSend(topic, payload, length);
+}
+
+bool espNowLinkUp()
+{
+    return espNowLivePeers() != 0;
+}
@@ -0,0 +1,21 @@
+#ifndef ESPNOW_HPP
+#define ESPNOW_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include "espnowlink.h"
+
+// Direct link to the RelaysBoard of the vehicle, see espnowlink.h and
+// espnowradio.h. The buttons keep working when the broker or the access point
+// is down.
+
+// Start ESP-NOW on the WiFi channel and its task, WiFi must be in STA mode
+void initEspNow();
+// Pair with the RelaysBoard of this vehicle id from now on ("" for none)
+void setEspNowVehicle(const char *vehicleId);
+// Send a message to every live RelaysBoard, false if none is paired
+bool sendEspNow(const char *topic, const char *payload, size_t length);
+// True while a RelaysBoard answers
+bool espNowLinkUp();
+
+#endif // ESPNOW_HPP
@@ -1,5 +1,9 @@
 #include "gui.hpp"
 #include "mqtt.hpp"
+#include "effects.h"
+#include "lightwire.h"
+#include "touch.hpp"
+#include "clocksync.hpp"
 #include <ArduinoJson.h>
 
 // Define styles for the light indicators
@@ -19,9 +23,12 @@ int speed = 500;            // Default speed in ms
 // Pointer to option label for easier updates
 static lv_obj_t *option_label;
 
-// Array to store the light button objects
+// Array to store the light button objects, checked while their subject is 1
 lv_obj_t *lightButtons[MAX_LIGHTS];
+lv_subject_t lightSubjects[MAX_LIGHTS];
 lv_obj_t *label; // Label for displaying connection status
+lv_obj_t *rtt_label; // Label for the command round trip
+uint8_t lightState = 0; // Relays as shown by the indicators
 
 // Effect options array
 const char *options[NUM_OPTIONS] = {
@@ -180,10 +187,21 @@ static void start_handler(lv_event_t *e)
 
     if (code == LV_EVENT_PRESSED)
     {
+        // Every board starts the first step at the same time once the master clock is known
+        uint64_t startMs = effectStartMs();
+        if (WIRE_BINARY)
+        {
+            LightWireEffect effect = {(uint8_t)current_option_index, (uint8_t)(inv ? EFFECT_INVERT : 0), (int16_t)repetitions, (uint16_t)speed, startMs};
+            uint8_t payload[LIGHTWIRE_EFFECT_SIZE];
+            size_t length = lightWireEncodeEffect(payload, sizeof(payload), effect);
+            publishTopic(TOPIC_LIGHT_EFFECT, 0, false, (const char *)payload, length);
+            return;
+        }
+
         // Use the index in the topic string for each light
-        char payload[32];
-        snprintf(payload, sizeof(payload), "%i,%i,%i,%i", current_option_index, repetitions, speed, inv);
-        mqttClient.publish("light/effect", 0, false, payload);
+        char payload[48];
+        snprintf(payload, sizeof(payload), "%i,%i,%i,%i,%llu", current_option_index, repetitions, speed, inv, (unsigned long long)startMs);
+        publishTopic(TOPIC_LIGHT_EFFECT, 0, false, payload);
     }
 }
 
@@ -194,7 +212,7 @@ static void stop_handler(lv_event_t *e)
     if (code == LV_EVENT_PRESSED)
     {
         LV_LOG_USER("Toggled stop button");
-        mqttClient.publish("light/stop", 1, false, NULL);
+        publishTopic(TOPIC_LIGHT_STOP, 1, false, NULL);
     }
 }
 
@@ -267,25 +285,49 @@ static void lm_handler(lv_event_t *e)
             lv_btnmatrix_clear_btn_ctrl(btnmatrix, 1, LV_BTNMATRIX_CTRL_HIDDEN);
         }
 
-        StaticJsonDocument<200> doc;
+        JsonDocument doc;
         doc["LEGAL_MODE"] = legalMode;
         char buffer[256];
         size_t n = serializeJson(doc, buffer);
-        mqttClient.publish(TOPIC_CONFIG, 0, false, buffer, n);
+        publishTopic(TOPIC_CONFIG, 0, false, buffer, n);
+    }
+}
+
+// Show the state the RelaysBoard reported, one bit per light. Only the
+// subjects of the lights that changed are set, so only their indicators redraw.
+// False when the state was already shown.
+bool showLightState(uint8_t state)
+{
+    uint8_t changed = state ^ lightState;
+    lightState = state;
+    for (int i = 0; i < MAX_LIGHTS; i++)
+    {
+        if (changed & (1 << i))
+        {
+            lv_subject_set_int(&lightSubjects[i], (state >> i) & 1);
+        }
     }
+    return changed != 0;
 }
 
-// Update the state and style of each light indicator
-void updateLightState(int index, bool state)
+// Send a light/command given as a 4-character bitstring ("1010"), binary when WIRE_BINARY is set
+static void publishLightCommand(const char *bits, bool retain)
 {
-    if (state)
+    if (!WIRE_BINARY)
     {
-        lv_obj_add_state(lightButtons[index], LV_STATE_CHECKED);
+        publishTopic(TOPIC_LIGHT_COMMAND, 0, retain, bits);
+        return;
     }
-    else
+
+    uint8_t state = 0;
+    for (int i = 0; i < 4 && bits[i] != '\0'; i++)
     {
-        lv_obj_remove_state(lightButtons[index], LV_STATE_CHECKED);
+        state = (state << 1) | (bits[i] == '1');
     }
+    // Numbered so the echo in light/state gives the round trip
+    uint8_t payload[LIGHTWIRE_STATE_SIZE];
+    size_t length = lightWireEncodeState(payload, sizeof(payload), LIGHTWIRE_COMMAND, state, nextCommandSeq());
+    publishTopic(TOPIC_LIGHT_COMMAND, 0, retain, (const char *)payload, length);
 }
 
 static void event_handler_btnm(lv_event_t *e)
@@ -297,7 +339,7 @@ static void event_handler_btnm(lv_event_t *e)
     {
         uint32_t id = lv_btnmatrix_get_selected_btn(obj);
         const char *txt = lv_btnmatrix_get_btn_text(obj, id);
-        mqttClient.publish(TOPIC_LIGHT_COMMAND, 0, false, txt);
+        publishLightCommand(txt, false);
     }
 }
 
@@ -342,10 +384,6 @@ static void event_handler_light(lv_event_t *e)
             newState |= (1 << *index); // Turn on the bit
         }
 
-        // Update the global light state
-        // lightState = newState;
-        // stateChanged = true;
-
         // Publish the updated state to the MQTT topic
         char payload[5];
         for (int i = 0; i < 4; i++)
@@ -354,7 +392,7 @@ static void event_handler_light(lv_event_t *e)
         }
         payload[4] = '\0'; // Null-terminate the string
         Serial.println(payload);
-        mqttClient.publish(TOPIC_LIGHT_COMMAND, 0, true, payload);
+        publishLightCommand(payload, true);
     }
 }
 
@@ -380,6 +418,8 @@ void create_light_indicators(lv_obj_t *parent)
         lv_obj_set_size(lightButtons[i], 60, 60);
         lv_obj_add_style(lightButtons[i], &style_indicator_off, LV_STATE_DEFAULT);
         lv_obj_add_style(lightButtons[i], &style_indicator_on, LV_STATE_CHECKED);
+        lv_subject_init_int(&lightSubjects[i], 0);
+        lv_obj_bind_state_if_eq(lightButtons[i], &lightSubjects[i], LV_STATE_CHECKED, 1);
     }
 }
 
@@ -388,6 +428,21 @@ void create_status_label(lv_obj_t *parent)
     // Créer un label pour afficher "Connecting..."
     label = lv_label_create(parent);
     lv_obj_align(label, LV_ALIGN_BOTTOM_MID, 0, 0);
+
+    rtt_label = lv_label_create(parent);
+    lv_label_set_text(rtt_label, "RTT: -");
+}
+
+static void calibrate_handler(lv_event_t *e)
+{
+    startTouchCalibration(); // Once released, so this touch is not the first target
+}
+
+// Show the command round trip on the status tab
+void update_rtt_label(const RttStats &stats)
+{
+    lv_label_set_text_fmt(rtt_label, "RTT p50 %u ms  p99 %u ms  (%u, %u lost)",
+                          (unsigned)stats.p50Ms, (unsigned)stats.p99Ms, (unsigned)stats.samples, (unsigned)stats.lost);
 }
 
 void define_styles()
@@ -472,4 +527,10 @@ void lv_create_main_gui(void *mqttClient)
     lv_obj_t *checkbox_legal = lv_checkbox_create(cont_tab3);
     lv_checkbox_set_text(checkbox_legal, "LM");
     lv_obj_add_event_cb(checkbox_legal, lm_handler, LV_EVENT_VALUE_CHANGED, (void *)tabview);
+
+    // Three-point touch calibration, stored on the display
+    lv_obj_t *btn_calibrate = lv_btn_create(cont_tab3);
+    lv_obj_add_event_cb(btn_calibrate, calibrate_handler, LV_EVENT_CLICKED, NULL);
+    lv_obj_t *label_calibrate = lv_label_create(btn_calibrate);
+    lv_label_set_text(label_calibrate, "Touch calibration");
 }
\ No newline at end of file
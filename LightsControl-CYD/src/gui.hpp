@@ -3,6 +3,7 @@
 
 #include <lvgl.h> // Inclure la bibliothèque LVGL pour utiliser les types et fonctions LVGL
 #include <AsyncMqttClient.h>
+#include "rtt.hpp"
 
 // Background colors for light indicators
 #define BG_COLOR_OFF LV_PALETTE_GREY
@@ -26,6 +27,7 @@
 // Prototypes des fonctions et variables externes si nécessaire
 void lv_create_main_gui(void *mqttClient);
 void update_label(const char *text);
-void updateLightState(int index, bool state);
+bool showLightState(uint8_t state);
+void update_rtt_label(const RttStats &stats);
 
 #endif // GUI_HPP
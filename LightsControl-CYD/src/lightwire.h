@@ -0,0 +1,177 @@
+#ifndef LIGHTWIRE_H
+#define LIGHTWIRE_H
+
+// Binary payloads of the light topics, shared by the RelaysBoard and the CYD
+// (keep both copies identical). Fixed layout, little endian:
+//   0  LIGHTWIRE_MAGIC, never a printable character, so text payloads still work
+//   1  version, later versions only append fields
+//   2  LightWireType
+//   3  fields of the type
+// light/state and light/command: state mask (bit 0 = light 1), since version 2
+//                                command sequence (uint16, 0 = none) and its send
+//                                time in CYD ms (uint32), light/state echoes the last applied,
+//                                since version 3 the number of the published state
+//                                (uint16, 0 = none), the same on every path it takes,
+//                                and the board numbering it (uint32)
+// light/effect and light/queue:  effect, flags, repetitions (int16, -1 = forever),
+//                                delay ms (uint16), start time in shared ms (uint64, 0 = now)
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define LIGHTWIRE_MAGIC 0xA5
+#define LIGHTWIRE_VERSION 3
+#define LIGHTWIRE_HEADER_SIZE 3
+#define LIGHTWIRE_STATE_V1_SIZE (LIGHTWIRE_HEADER_SIZE + 1)
+#define LIGHTWIRE_STATE_V2_SIZE (LIGHTWIRE_STATE_V1_SIZE + 6)
+#define LIGHTWIRE_STATE_SIZE (LIGHTWIRE_STATE_V2_SIZE + 6)
+#define LIGHTWIRE_EFFECT_SIZE (LIGHTWIRE_HEADER_SIZE + 14)
+#define LIGHTWIRE_MAX_SIZE LIGHTWIRE_EFFECT_SIZE
+
+enum LightWireType
+{
+    LIGHTWIRE_STATE = 1,   // Relay state published by the RelaysBoard
+    LIGHTWIRE_COMMAND = 2, // Relay state requested by the CYD
+    LIGHTWIRE_EFFECT = 3   // Effect to play or queue
+};
+
+// Identifies a command of the CYD, to measure its round trip
+struct LightWireSeq
+{
+    uint16_t seq;    // 0 when the sender did not number it
+    uint32_t sentMs; // millis() of the CYD when it sent the command
+};
+
+// Number of a published state, counted by each board on its own
+struct LightWireStateNumber
+{
+    uint16_t seq;   // 0 when the sender did not number it
+    uint32_t board; // Low 4 bytes of the board MAC
+};
+
+struct LightWireEffect
+{
+    uint8_t effect;
+    uint8_t flags;       // EffectFlags
+    int16_t repetitions; // -1 plays forever
+    uint16_t delayMs;
+    uint64_t startMs;    // Shared time of the first step, 0 to start now
+};
+
+// True when the payload is binary, otherwise it is the text format
+inline bool lightWireIsBinary(const uint8_t *payload, size_t length)
+{
+    return length >= LIGHTWIRE_HEADER_SIZE && payload[0] == LIGHTWIRE_MAGIC;
+}
+
+inline void lightWirePut(uint8_t *buffer, uint64_t value, uint8_t bytes)
+{
+    for (uint8_t i = 0; i < bytes; i++)
+    {
+        buffer[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+inline uint64_t lightWireGet(const uint8_t *buffer, uint8_t bytes)
+{
+    uint64_t value = 0;
+    for (uint8_t i = 0; i < bytes; i++)
+    {
+        value |= (uint64_t)buffer[i] << (8 * i);
+    }
+    return value;
+}
+
+// Header check shared by the decoders: any version from 1, at least the fields of version 1
+inline bool lightWireCheck(const uint8_t *payload, size_t length, uint8_t type, size_t size)
+{
+    return length >= size && payload[0] == LIGHTWIRE_MAGIC && payload[1] >= 1 && payload[2] == type;
+}
+
+// LIGHTWIRE_STATE or LIGHTWIRE_COMMAND, returns the payload length or 0 if buffer is too small
+inline size_t lightWireEncodeState(uint8_t *buffer, size_t size, uint8_t type, uint8_t state,
+                                   const LightWireSeq &seq = {0, 0}, const LightWireStateNumber &number = {0, 0})
+{
+    if (size < LIGHTWIRE_STATE_SIZE)
+    {
+        return 0;
+    }
+    buffer[0] = LIGHTWIRE_MAGIC;
+    buffer[1] = LIGHTWIRE_VERSION;
+    buffer[2] = type;
+    buffer[3] = state;
+    lightWirePut(buffer + 4, seq.seq, 2);
+    lightWirePut(buffer + 6, seq.sentMs, 4);
+    lightWirePut(buffer + 10, number.seq, 2);
+    lightWirePut(buffer + 12, number.board, 4);
+    return LIGHTWIRE_STATE_SIZE;
+}
+
+// seq is {0, 0} for version 1 payloads, number {0, 0} before version 3
+inline bool lightWireDecodeState(const uint8_t *payload, size_t length, uint8_t type, uint8_t &state, LightWireSeq &seq,
+                                 LightWireStateNumber &number)
+{
+    if (!lightWireCheck(payload, length, type, LIGHTWIRE_STATE_V1_SIZE))
+    {
+        return false;
+    }
+    state = payload[3];
+    seq = {0, 0};
+    number = {0, 0};
+    if (payload[1] >= 2 && length >= LIGHTWIRE_STATE_V2_SIZE)
+    {
+        seq.seq = (uint16_t)lightWireGet(payload + 4, 2);
+        seq.sentMs = (uint32_t)lightWireGet(payload + 6, 4);
+    }
+    if (payload[1] >= 3 && length >= LIGHTWIRE_STATE_SIZE)
+    {
+        number.seq = (uint16_t)lightWireGet(payload + 10, 2);
+        number.board = (uint32_t)lightWireGet(payload + 12, 4);
+    }
+    return true;
+}
+
+inline bool lightWireDecodeState(const uint8_t *payload, size_t length, uint8_t type, uint8_t &state, LightWireSeq &seq)
+{
+    LightWireStateNumber number;
+    return lightWireDecodeState(payload, length, type, state, seq, number);
+}
+
+inline bool lightWireDecodeState(const uint8_t *payload, size_t length, uint8_t type, uint8_t &state)
+{
+    LightWireSeq seq;
+    return lightWireDecodeState(payload, length, type, state, seq);
+}
+
+inline size_t lightWireEncodeEffect(uint8_t *buffer, size_t size, const LightWireEffect &effect)
+{
+    if (size < LIGHTWIRE_EFFECT_SIZE)
+    {
+        return 0;
+    }
+    buffer[0] = LIGHTWIRE_MAGIC;
+    buffer[1] = LIGHTWIRE_VERSION;
+    buffer[2] = LIGHTWIRE_EFFECT;
+    buffer[3] = effect.effect;
+    buffer[4] = effect.flags;
+    lightWirePut(buffer + 5, (uint16_t)effect.repetitions, 2);
+    lightWirePut(buffer + 7, effect.delayMs, 2);
+    lightWirePut(buffer + 9, effect.startMs, 8);
+    return LIGHTWIRE_EFFECT_SIZE;
+}
+
+inline bool lightWireDecodeEffect(const uint8_t *payload, size_t length, LightWireEffect &effect)
+{
+    if (!lightWireCheck(payload, length, LIGHTWIRE_EFFECT, LIGHTWIRE_EFFECT_SIZE))
+    {
+        return false;
+    }
+    effect.effect = payload[3];
+    effect.flags = payload[4];
+    effect.repetitions = (int16_t)lightWireGet(payload + 5, 2);
+    effect.delayMs = (uint16_t)lightWireGet(payload + 7, 2);
+    effect.startMs = lightWireGet(payload + 9, 8);
+    return true;
+}
+
+#endif // LIGHTWIRE_H
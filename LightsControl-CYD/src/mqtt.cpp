@@ -1,17 +1,39 @@
 #include "mqtt.hpp"
 #include "ESP32_Utils.hpp"
 #include "gui.hpp"
+#include "lightwire.h"
 
-TimerHandle_t mqttReconnectTimer;
-TimerHandle_t wifiReconnectTimer;
+#define MQTT_RX_BUFFER_SIZE 64 // The CYD only receives short light topics
+#include "mqttrx.h"
+#include "topicrouter.h"
+#include "espnow.hpp"
+#include "rtt.hpp"
+#include "connection.hpp"
+#include "telemetry.h"
+#include "ui.hpp"
+#include "clocksync.hpp"
 
 AsyncMqttClient mqttClient;
-extern void update_connection_status(bool success);
-extern void updateLightState(int index, bool state);
+MqttRxPool rxPool; // Incoming payloads, assembled and NUL-terminated
+char topicPrefix[TOPIC_PREFIX_SIZE] = ""; // "veh/<id>/" in front of every topic
+char boardId[13]; // MAC address in hex, tells the displays apart in the telemetry
+Telemetry telemetry = {TELEMETRY_MS};
+uint32_t mqttReconnects = 0; // Broker sessions lost since boot
+bool mqttSession = false;     // Connected since the last disconnect
 
-// Variables to store light state and state change indicator
-uint8_t lightState = 0;
-bool stateChanged = false;
+// Handlers of the topics the CYD subscribes to
+enum TopicId
+{
+    TOPIC_ID_LIGHT_STATE,
+    TOPIC_ID_SYNC_RESPONSE
+};
+
+static constexpr TopicRoute guiRoutes[] = {
+    {TOPIC_LIGHT_STATE, TOPIC_ID_LIGHT_STATE, 0},
+    {TOPIC_SYNC_RESPONSE, TOPIC_ID_SYNC_RESPONSE, 0},
+};
+static constexpr auto guiRouter = compileTopicRouter(guiRoutes);
+static_assert(guiRouter.seed != 0, "no perfect hash for the CYD topics");
 
 void ConnectToMqtt()
 {
@@ -22,38 +44,56 @@ void ConnectToMqtt()
 void WiFiEvent(WiFiEvent_t event)
 {
     Serial.printf("[WiFi-event] event: %d\n", event);
-    String ipStr = WiFi.localIP().toString();   // Get IP address as a string
-    String message = "Connected! IP: " + ipStr; // Create message with IP
     switch (event)
     {
     case SYSTEM_EVENT_STA_GOT_IP:
         Serial.println("WiFi connected");
         Serial.println("IP address: ");
         Serial.println(WiFi.localIP());
-        // Connection successful, retrieve IP address
-
-        update_label(message.c_str());
-        ConnectToMqtt();
+        connectionEvent(CONNECTION_EVENT_WIFI_UP); // The connection manager goes on with the broker
         break;
     case SYSTEM_EVENT_STA_DISCONNECTED:
         Serial.println("WiFi lost connection");
-        xTimerStop(mqttReconnectTimer, 0); // ensure we don't reconnect to MQTT while reconnecting to Wi-Fi
-        xTimerStart(wifiReconnectTimer, 0);
+        connectionEvent(CONNECTION_EVENT_WIFI_DOWN);
         break;
     }
 }
 
 void SuscribeMqtt()
 {
-    uint16_t packetIdSub = mqttClient.subscribe(TOPIC_LIGHT_STATE, 0); // Subscribes to lights topic
-    Serial.print("Subscribing at QoS 0, packetId: ");
-    Serial.println(packetIdSub);
+    for (const TopicRoute &route : guiRoutes)
+    {
+        char topic[TOPIC_PREFIX_SIZE + MQTT_RX_TOPIC_SIZE];
+        uint16_t packetIdSub = mqttClient.subscribe(topicJoin(topic, sizeof(topic), topicPrefix, route.suffix), route.qos);
+        Serial.print("Subscribing at QoS 0, packetId: ");
+        Serial.println(packetIdSub);
+    }
+}
+
+bool publishTopic(const char *suffix, uint8_t qos, bool retain, const char *payload, size_t length)
+{
+    if (length == 0 && payload != NULL)
+    {
+        length = strlen(payload);
+    }
+
+    // The paired RelaysBoard gets the light topics directly and through the broker
+    // when it is reachable, the board drops whichever copy arrives second
+    bool direct = sendEspNow(suffix, payload, length);
+    bool broker = false;
+    if (mqttClient.connected())
+    {
+        char topic[TOPIC_PREFIX_SIZE + MQTT_RX_TOPIC_SIZE];
+        broker = mqttClient.publish(topicJoin(topic, sizeof(topic), topicPrefix, suffix), qos, retain, payload, length) != 0;
+    }
+    return direct || broker;
 }
 
 void OnMqttConnect(bool sessionPresent)
 {
     Serial.println("Connected to MQTT.");
-    update_connection_status(true);
+    mqttSession = true;
+    connectionEvent(CONNECTION_EVENT_MQTT_UP);
     Serial.print("Session present: ");
     Serial.println(sessionPresent);
     SuscribeMqtt();
@@ -62,12 +102,13 @@ void OnMqttConnect(bool sessionPresent)
 void OnMqttDisconnect(AsyncMqttClientDisconnectReason reason)
 {
     Serial.println("Disconnected from MQTT.");
-    update_connection_status(false);
-
-    if (WiFi.isConnected())
+    // Failed connection attempts also end here, only a lost session counts
+    if (mqttSession)
     {
-        xTimerStart(mqttReconnectTimer, 0);
+        mqttReconnects++;
+        mqttSession = false;
     }
+    connectionEvent(CONNECTION_EVENT_MQTT_DOWN);
 }
 
 void OnMqttSubscribe(uint16_t packetId, uint8_t qos)
@@ -112,19 +153,55 @@ int stringToInt(const char *str)
 
     return static_cast<int>(value);
 }
-void OnMqttReceived(char *topic, char *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total)
+
+// Handle a message of the route table, from MQTT or ESP-NOW (direct). payload is terminated at payload[len].
+void handleLightTopic(const char *suffix, const char *payload, size_t len, bool direct)
+{
+    switch (topicLookup(guiRouter, guiRoutes, suffix))
+    {
+    case TOPIC_ID_LIGHT_STATE:
+    {
+        // Hand the light state to the UI task, binary or decimal text
+        uint8_t state;
+        LightWireSeq echo;
+        LightWireStateNumber number = {0, 0}; // Not numbered in text
+        if (lightWireDecodeState((const uint8_t *)payload, len, LIGHTWIRE_STATE, state, echo, number))
+        {
+            noteStateEcho(echo);
+        }
+        else
+        {
+            state = stringToInt(payload);
+        }
+        postLightState(state, number, direct);
+        break;
+    }
+
+    case TOPIC_ID_SYNC_RESPONSE:
+        handleClockSyncResponse(payload, len);
+        break;
+    }
+}
+
+void OnMqttReceived(char *topic, char *fragment, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total)
 {
-    if (len != 0)
+    // Topics of other vehicles are not ours
+    const char *suffix = topicStripPrefix(topic, topicPrefix);
+    if (suffix == NULL)
     {
-        payload[len] = '\0'; // Null-terminate the string
+        return;
     }
 
-    if (strcmp(topic, TOPIC_LIGHT_STATE) == 0)
+    // The payload may come in fragments and is not terminated, work on a complete copy
+    MqttRxSlot *message = mqttRxFeed(rxPool, suffix, fragment, len, index, total, MQTT_RX_BUFFER_SIZE);
+    if (message == NULL)
     {
-        // Update the light state and set the stateChanged flag
-        lightState = stringToInt(payload);
-        stateChanged = true;
+        return;
     }
+    char *payload = message->data;
+    len = message->total;
+
+    handleLightTopic(suffix, payload, len);
 
     /*elseif (strncmp(topic, "light/", 6) == 0 && strstr(topic, "/state") != NULL)
     {
@@ -141,12 +218,64 @@ void OnMqttReceived(char *topic, char *payload, AsyncMqttClientMessageProperties
             }
         }
     }*/
+    mqttRxRelease(message);
+}
+
+// Publish the command round trip figures
+void publishRttStats(const RttStats &stats)
+{
+    char payload[128];
+    snprintf(payload, sizeof(payload), "{\"samples\":%u,\"lost\":%u,\"last_ms\":%u,\"p50_ms\":%u,\"p99_ms\":%u,\"max_ms\":%u}",
+             (unsigned)stats.samples, (unsigned)stats.lost, (unsigned)stats.lastMs,
+             (unsigned)stats.p50Ms, (unsigned)stats.p99Ms, (unsigned)stats.maxMs);
+    publishTopic(TOPIC_LIGHT_RTT, 0, false, payload);
+}
+
+void serviceTelemetry()
+{
+    if (!telemetryDue(telemetry, millis()))
+    {
+        return;
+    }
+
+    TelemetryExtra extra = {boardId, mqttReconnects, false, 0, 0, 0};
+    static char payload[TELEMETRY_PAYLOAD_SIZE];
+    size_t length = telemetrySample(telemetry, millis(), extra, payload, sizeof(payload));
+    if (length > 0 && mqttClient.connected())
+    {
+        char topic[TOPIC_PREFIX_SIZE + MQTT_RX_TOPIC_SIZE];
+        mqttClient.publish(topicJoin(topic, sizeof(topic), topicPrefix, TOPIC_TELEMETRY), 0, false, payload, length);
+    }
+}
+
+void serviceClockSync()
+{
+    // The master only answers through the broker
+    char payload[48];
+    if (mqttClient.connected() && clockSyncRequest(payload, sizeof(payload)))
+    {
+        char topic[TOPIC_PREFIX_SIZE + MQTT_RX_TOPIC_SIZE];
+        mqttClient.publish(topicJoin(topic, sizeof(topic), topicPrefix, TOPIC_SYNC_REQUEST), 0, false, payload);
+    }
 }
 
 AsyncMqttClient *InitMqtt()
 {
-    mqttReconnectTimer = xTimerCreate("mqttTimer", pdMS_TO_TICKS(2000), pdFALSE, (void *)0, reinterpret_cast<TimerCallbackFunction_t>(ConnectToMqtt));
-    wifiReconnectTimer = xTimerCreate("wifiTimer", pdMS_TO_TICKS(5000), pdFALSE, (void *)0, reinterpret_cast<TimerCallbackFunction_t>(ConnectWiFi_STA));
+    uint8_t mac[6];
+    WiFi.macAddress(mac);
+    snprintf(boardId, sizeof(boardId), "%02x%02x%02x%02x%02x%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    initClockSync(boardId);
+
+    // The vehicle this display controls is set at build time
+    if (!topicVehicleIdValid(VEHICLE_ID))
+    {
+        Serial.println("VEHICLE_ID is not a valid topic level, using the global topics");
+    }
+    topicSetPrefix(topicPrefix, VEHICLE_ID);
+    setEspNowVehicle(topicPrefix[0] != '\0' ? VEHICLE_ID : "");
+
+    initUi();
+    initConnection();
 
     mqttClient.onConnect(OnMqttConnect);
     mqttClient.onDisconnect(OnMqttDisconnect);
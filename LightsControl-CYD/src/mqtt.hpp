@@ -4,6 +4,7 @@
 #include <AsyncMqttClient.h>
 #include <WiFi.h>
 #include <lvgl.h>
+#include "rtt.hpp"
 
 // MQTT connection constants
 #define MQTT_HOST IPAddress(192, 168, 2, 1) // IP address of the MQTT broker
@@ -15,6 +16,13 @@
 #define TOPIC_CONFIG "config"               // Topic for configuration
 #define STATE_OFF "0"                       // State representation for off
 #define STATE_ON "1"                        // State representation for on
+#define TOPIC_LIGHT_RTT "light/rtt"         // Topic for the command round trip histogram
+#define TOPIC_SYNC_REQUEST "light/sync/req" // Topic for time sync requests to the master board
+#define TOPIC_SYNC_RESPONSE "light/sync/resp" // Topic for time sync answers of the master board
+#define VEHICLE_ID ""                       // Vehicle of the display, topics are "veh/<id>/..." unless empty
+#define WIRE_BINARY true                    // Send light/command and light/effect as lightwire.h, text otherwise
+#define TOPIC_TELEMETRY "telemetry/cyd"     // Topic for the health figures of the display
+#define TELEMETRY_MS 60000                  // Telemetry period, 0 disables it
 
 // Function declarations for MQTT operations
 AsyncMqttClient *InitMqtt();
@@ -23,9 +31,14 @@ void WiFiEvent(WiFiEvent_t event);
 void OnMqttConnect(bool sessionPresent);
 void OnMqttDisconnect(AsyncMqttClientDisconnectReason reason);
 void OnMqttReceived(char *topic, char *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total);
-
-// Variables to store light state and state change indicator
-extern uint8_t lightState;
-extern bool stateChanged;
+// Publish on a topic below the vehicle prefix, to the broker and the paired RelaysBoard.
+// True when at least one of the two took it.
+bool publishTopic(const char *suffix, uint8_t qos, bool retain, const char *payload, size_t length = 0);
+void handleLightTopic(const char *suffix, const char *payload, size_t len, bool direct = false);
+void publishRttStats(const RttStats &stats);
+// Once per loop iteration, publishes the telemetry when its period is over
+void serviceTelemetry();
+// Once per loop iteration, asks the master board for its clock when due
+void serviceClockSync();
 
 #endif // MQTT_HPP
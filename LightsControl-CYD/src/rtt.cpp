@@ -0,0 +1,129 @@
+#include "rtt.hpp"
+#include <Arduino.h>
+
+portMUX_TYPE rttMux = portMUX_INITIALIZER_UNLOCKED;
+
+LightWireSeq pendingCommands[RTT_PENDING]; // seq 0 marks a free entry
+uint16_t lastCommandSeq = 0;
+uint32_t rttBuckets[RTT_BUCKETS];
+RttStats rttStats = {0, 0, 0, 0, 0, 0};
+bool rttUpdated = false;
+
+// Bucket of a round trip: RTT_SUB_BUCKETS linear steps within each power of two
+static uint8_t rttBucket(uint32_t rttMs)
+{
+    if (rttMs < RTT_SUB_BUCKETS)
+    {
+        return rttMs;
+    }
+    uint8_t octave = 31 - __builtin_clz(rttMs); // rttMs >= 2^octave
+    uint8_t step = (rttMs >> (octave - 2)) & (RTT_SUB_BUCKETS - 1);
+    uint16_t bucket = (octave - 1) * RTT_SUB_BUCKETS + step;
+    return bucket < RTT_BUCKETS ? bucket : RTT_BUCKETS - 1;
+}
+
+// Largest round trip that falls in a bucket
+static uint32_t rttBucketLimit(uint8_t bucket)
+{
+    if (bucket < RTT_SUB_BUCKETS)
+    {
+        return bucket;
+    }
+    uint8_t octave = bucket / RTT_SUB_BUCKETS + 1;
+    uint8_t step = bucket % RTT_SUB_BUCKETS;
+    return ((uint32_t)(RTT_SUB_BUCKETS + step + 1) << (octave - 2)) - 1;
+}
+
+static uint32_t rttPercentile(uint32_t samples, uint8_t percent)
+{
+    uint32_t rank = (samples * percent + 99) / 100;
+    uint32_t count = 0;
+    for (uint8_t i = 0; i < RTT_BUCKETS; i++)
+    {
+        count += rttBuckets[i];
+        if (count >= rank)
+        {
+            return rttBucketLimit(i);
+        }
+    }
+    return rttBucketLimit(RTT_BUCKETS - 1);
+}
+
+LightWireSeq nextCommandSeq()
+{
+    LightWireSeq command;
+    uint32_t nowMs = millis();
+
+    portENTER_CRITICAL(&rttMux);
+    lastCommandSeq = lastCommandSeq == UINT16_MAX ? 1 : lastCommandSeq + 1;
+    command = {lastCommandSeq, nowMs};
+
+    // Take a free entry, expired ones count as lost, or the oldest
+    LightWireSeq *slot = &pendingCommands[0];
+    for (uint8_t i = 0; i < RTT_PENDING; i++)
+    {
+        LightWireSeq &entry = pendingCommands[i];
+        if (entry.seq != 0 && nowMs - entry.sentMs >= RTT_TIMEOUT_MS)
+        {
+            entry.seq = 0;
+            rttStats.lost++;
+        }
+        if (entry.seq == 0 || (slot->seq != 0 && entry.sentMs - slot->sentMs > 0x80000000UL))
+        {
+            slot = &entry;
+        }
+    }
+    if (slot->seq != 0)
+    {
+        rttStats.lost++;
+    }
+    *slot = command;
+    portEXIT_CRITICAL(&rttMux);
+    return command;
+}
+
+void noteStateEcho(const LightWireSeq &echo)
+{
+    if (echo.seq == 0)
+    {
+        return;
+    }
+    uint32_t nowMs = millis();
+
+    // The same echo comes through MQTT and ESP-NOW, the first one counts
+    portENTER_CRITICAL(&rttMux);
+    for (uint8_t i = 0; i < RTT_PENDING; i++)
+    {
+        LightWireSeq &entry = pendingCommands[i];
+        if (entry.seq == echo.seq && entry.sentMs == echo.sentMs)
+        {
+            uint32_t rttMs = nowMs - entry.sentMs;
+            entry.seq = 0;
+            rttBuckets[rttBucket(rttMs)]++;
+            rttStats.samples++;
+            rttStats.lastMs = rttMs;
+            if (rttMs > rttStats.maxMs)
+            {
+                rttStats.maxMs = rttMs;
+            }
+            rttUpdated = true;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&rttMux);
+}
+
+bool takeRttStats(RttStats &stats)
+{
+    portENTER_CRITICAL(&rttMux);
+    bool updated = rttUpdated;
+    if (updated)
+    {
+        rttUpdated = false;
+        stats = rttStats;
+        stats.p50Ms = rttPercentile(stats.samples, 50);
+        stats.p99Ms = rttPercentile(stats.samples, 99);
+    }
+    portEXIT_CRITICAL(&rttMux);
+    return updated;
+}
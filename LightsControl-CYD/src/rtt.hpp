@@ -0,0 +1,32 @@
+#ifndef RTT_HPP
+#define RTT_HPP
+
+#include <stdint.h>
+#include "lightwire.h"
+
+// Round trip of the light commands: each light/command carries a sequence number
+// and its send time, the RelaysBoard echoes the last one it applied in light/state.
+#define RTT_PENDING 8             // Commands waiting for their echo
+#define RTT_TIMEOUT_MS 5000       // A command without echo after this long was lost
+#define RTT_SUB_BUCKETS 4         // Histogram buckets per power of two, 19% resolution
+#define RTT_BUCKETS (14 * RTT_SUB_BUCKETS) // Up to 32 s
+#define RTT_PUBLISH_MS 10000      // light/rtt period while new samples come in
+
+struct RttStats
+{
+    uint32_t samples;
+    uint32_t lost;   // Commands never echoed
+    uint32_t lastMs;
+    uint32_t p50Ms;  // Upper bound of the bucket holding the median
+    uint32_t p99Ms;
+    uint32_t maxMs;
+};
+
+// Number the next command, GUI side
+LightWireSeq nextCommandSeq();
+// Sequence echoed in a light/state, from the MQTT or ESP-NOW task
+void noteStateEcho(const LightWireSeq &echo);
+// Statistics, only filled and true when samples came in since the last call
+bool takeRttStats(RttStats &stats);
+
+#endif // RTT_HPP
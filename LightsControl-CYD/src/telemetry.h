@@ -0,0 +1,235 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+// Health figures of a firmware, published on telemetry/<board>, shared by the
+// RelaysBoard and the CYD (keep both copies identical). ESP32 only.
+// The loop calls telemetryDue() once per iteration: it counts the iteration and
+// says when the period is over, with the period at 0 that is all it costs.
+// The CPU share of each task needs the FreeRTOS run time statistics
+// (configGENERATE_RUN_TIME_STATS), which the stock Arduino-ESP32 core is built
+// without. The "cpu" field is then left out, unless built with
+// -DTELEMETRY_DEBUG_CPU=1: it then has the busy share of each core, "core0" and
+// "core1", from an idle hook adding up the time the idle task spends between
+// two of its calls. That hook keeps the idle task looping instead of waiting
+// for an interrupt, both cores stay awake: for a bench, not for the vehicle.
+
+#include <Arduino.h>
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_freertos_hooks.h>
+#include <esp_timer.h>
+
+#define TELEMETRY_MAX_TASKS 24    // Tasks the CPU share is computed for
+#define TELEMETRY_CPU_TASKS 6     // Busiest tasks in the payload
+#define TELEMETRY_PAYLOAD_SIZE 512
+
+#define TELEMETRY_IDLE_GAP_US 20   // Longer between two idle hook calls, something else ran
+
+#ifndef TELEMETRY_DEBUG_CPU
+#define TELEMETRY_DEBUG_CPU 0
+#endif
+
+#if configGENERATE_RUN_TIME_STATS && configUSE_TRACE_FACILITY
+#define TELEMETRY_CPU 1 // Share of each task
+#elif TELEMETRY_DEBUG_CPU
+#define TELEMETRY_CPU 2 // Busy share of each core
+#else
+#define TELEMETRY_CPU 0
+#endif
+
+// Figures the firmware adds to the common ones
+struct TelemetryExtra
+{
+    const char *board;        // Board id
+    uint32_t mqttReconnects;  // Broker sessions lost since boot
+    bool effects;             // Has an effect engine, the fields below are valid
+    uint32_t steps;           // Effect steps played in the period
+    uint32_t lateAvgUs;       // Their lateness against the deadline
+    uint32_t lateMaxUs;
+};
+
+struct TelemetryTaskTime
+{
+    TaskHandle_t handle;
+    uint32_t runTime; // Run time counter at the last sample
+};
+
+struct Telemetry
+{
+    uint32_t periodMs; // 0 disables the publisher
+    uint32_t lastMs;
+    uint32_t loops;    // Loop iterations in the period
+#if TELEMETRY_CPU == 1
+    TaskStatus_t tasks[TELEMETRY_MAX_TASKS];
+    TelemetryTaskTime previous[TELEMETRY_MAX_TASKS];
+    uint8_t previousCount;
+    uint32_t previousTotal;
+#elif TELEMETRY_CPU == 2
+    bool idleHooked;
+    uint32_t previousIdleUs[portNUM_PROCESSORS];
+    uint64_t previousUs;
+#endif
+};
+
+// Once per loop iteration, true when a sample is due
+inline bool telemetryDue(Telemetry &telemetry, uint32_t nowMs)
+{
+    telemetry.loops++;
+    return telemetry.periodMs != 0 && nowMs - telemetry.lastMs >= telemetry.periodMs;
+}
+
+#if TELEMETRY_CPU == 1
+// Share of one core each task used since the last sample, busiest first, as "name":percent
+inline int telemetryCpu(Telemetry &telemetry, char *out, size_t size)
+{
+    uint32_t total = 0;
+    UBaseType_t count = uxTaskGetSystemState(telemetry.tasks, TELEMETRY_MAX_TASKS, &total);
+    uint32_t elapsed = total - telemetry.previousTotal;
+
+    // Run time of each task in the period, against its counter at the last sample
+    uint32_t used[TELEMETRY_MAX_TASKS];
+    for (UBaseType_t i = 0; i < count; i++)
+    {
+        uint32_t before = 0;
+        for (uint8_t j = 0; j < telemetry.previousCount; j++)
+        {
+            if (telemetry.previous[j].handle == telemetry.tasks[i].xHandle)
+            {
+                before = telemetry.previous[j].runTime;
+                break;
+            }
+        }
+        used[i] = telemetry.tasks[i].ulRunTimeCounter - before;
+    }
+
+    int length = 0;
+    for (uint8_t reported = 0; reported < TELEMETRY_CPU_TASKS && elapsed != 0; reported++)
+    {
+        int busiest = -1;
+        for (UBaseType_t i = 0; i < count; i++)
+        {
+            if (used[i] != UINT32_MAX && (busiest < 0 || used[i] > used[busiest]))
+            {
+                busiest = i;
+            }
+        }
+        if (busiest < 0)
+        {
+            break;
+        }
+        length += snprintf(out + length, size > (size_t)length ? size - length : 0, "%s\"%s\":%u", reported ? "," : "",
+                           telemetry.tasks[busiest].pcTaskName, (unsigned)((uint64_t)used[busiest] * 100 / elapsed));
+        used[busiest] = UINT32_MAX;
+    }
+
+    for (UBaseType_t i = 0; i < count; i++)
+    {
+        telemetry.previous[i] = {telemetry.tasks[i].xHandle, telemetry.tasks[i].ulRunTimeCounter};
+    }
+    telemetry.previousCount = count;
+    telemetry.previousTotal = total;
+    return length;
+}
+#elif TELEMETRY_CPU == 2
+struct TelemetryIdle
+{
+    uint32_t idleUs;     // Idle time, wraps: one 32-bit word the other core reads whole
+    int64_t lastCallUs;
+};
+
+inline TelemetryIdle *telemetryIdle()
+{
+    static TelemetryIdle idle[portNUM_PROCESSORS];
+    return idle;
+}
+
+// Idle task of each core, runs only when nothing else can
+inline bool telemetryIdleHook()
+{
+    TelemetryIdle &idle = telemetryIdle()[xPortGetCoreID()];
+    int64_t nowUs = esp_timer_get_time();
+    if (nowUs - idle.lastCallUs < TELEMETRY_IDLE_GAP_US)
+    {
+        idle.idleUs += nowUs - idle.lastCallUs;
+    }
+    idle.lastCallUs = nowUs;
+    return false; // Called again at once, the gaps stay short while idle
+}
+
+// Busy share of each core since the last sample, as "core<n>":percent. The first
+// sample installs the hook and has nothing to report.
+inline int telemetryCpu(Telemetry &telemetry, char *out, size_t size)
+{
+    uint64_t nowUs = esp_timer_get_time();
+    uint64_t elapsedUs = nowUs - telemetry.previousUs;
+    telemetry.previousUs = nowUs;
+    if (!telemetry.idleHooked)
+    {
+        for (int core = 0; core < portNUM_PROCESSORS; core++)
+        {
+            esp_register_freertos_idle_hook_for_cpu(telemetryIdleHook, core);
+        }
+        telemetry.idleHooked = true;
+        return 0;
+    }
+
+    int length = 0;
+    for (int core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        uint32_t idleUs = telemetryIdle()[core].idleUs; // Written by the hook of that core only
+        uint64_t usedIdleUs = (uint32_t)(idleUs - telemetry.previousIdleUs[core]);
+        telemetry.previousIdleUs[core] = idleUs;
+        unsigned busy = elapsedUs != 0 && usedIdleUs < elapsedUs ? (unsigned)(100 - usedIdleUs * 100 / elapsedUs) : 0;
+        length += snprintf(out + length, size > (size_t)length ? size - length : 0, "%s\"core%d\":%u", core ? "," : "", core, busy);
+    }
+    return length;
+}
+#else
+inline int telemetryCpu(Telemetry &, char *, size_t)
+{
+    return 0; // Nothing to measure it with
+}
+#endif
+
+// Sample everything into a JSON payload and start the next period, returns its length
+inline size_t telemetrySample(Telemetry &telemetry, uint32_t nowMs, const TelemetryExtra &extra, char *payload, size_t size)
+{
+    uint32_t elapsedMs = nowMs - telemetry.lastMs;
+    uint32_t loopsPerS = elapsedMs ? (uint32_t)((uint64_t)telemetry.loops * 1000 / elapsedMs) : 0;
+    telemetry.loops = 0;
+    telemetry.lastMs = nowMs;
+
+    int length = snprintf(payload, size,
+                          "{\"board\":\"%s\",\"build\":\"%s %s\",\"uptime_s\":%u,\"heap_free\":%u,\"heap_min\":%u,"
+                          "\"heap_block\":%u,\"loops_s\":%u,\"mqtt_reconnects\":%u",
+                          extra.board, __DATE__, __TIME__, (unsigned)(millis() / 1000),
+                          (unsigned)heap_caps_get_free_size(MALLOC_CAP_8BIT),
+                          (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT),
+                          (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT),
+                          (unsigned)loopsPerS, (unsigned)extra.mqttReconnects);
+    if (extra.effects && length > 0 && (size_t)length < size)
+    {
+        length += snprintf(payload + length, size - length, ",\"steps\":%u,\"late_avg_us\":%u,\"late_max_us\":%u",
+                           (unsigned)extra.steps, (unsigned)extra.lateAvgUs, (unsigned)extra.lateMaxUs);
+    }
+    if (length > 0 && (size_t)length + 10 < size)
+    {
+        // Left out when there is nothing to report yet
+        int cpuStart = length;
+        length += snprintf(payload + length, size - length, ",\"cpu\":{");
+        int cpuLength = telemetryCpu(telemetry, payload + length, size - length);
+        length = cpuLength > 0 ? length + cpuLength : cpuStart;
+        if (cpuLength > 0 && (size_t)length < size)
+        {
+            length += snprintf(payload + length, size - length, "}");
+        }
+    }
+    if (length > 0 && (size_t)length < size)
+    {
+        length += snprintf(payload + length, size - length, "}");
+    }
+    return length > 0 && (size_t)length < size ? length : 0;
+}
+
+#endif // TELEMETRY_H
@@ -0,0 +1,283 @@
+#include "touch.hpp"
+#include <Arduino.h>
+// Install the "XPT2046_Touchscreen" library by Paul Stoffregen to use the Touchscreen - https://github.com/PaulStoffregen/XPT2046_Touchscreen
+#include <XPT2046_Touchscreen.h>
+#include <Preferences.h>
+#include "display.hpp"
+#include "ui.hpp"
+
+#define TOUCH_FRACTION_BITS 4 // Of the filtered position
+#define TOUCH_CALIBRATION_POINTS 3
+#define TOUCH_TARGET_SIZE 12
+
+// Touchscreen SPI configuration. T_IRQ is handled here and not by the library:
+// it wakes the UI task, which only talks to the controller while it is pressed.
+SPIClass touchscreenSPI = SPIClass(VSPI);
+XPT2046_Touchscreen touchscreen(XPT2046_CS);
+
+// Factory calibration of the first panel, until one is stored
+TouchCalibration touchCalibration = {4325, 0, -991101, 0, 6029, -2956132};
+
+// Filter state, only touched in the UI task
+bool touching = false;
+int16_t medianWindow[2][TOUCH_MEDIAN_SAMPLES];
+uint8_t medianNext = 0;
+int32_t filteredX = 0; // Raw position, TOUCH_FRACTION_BITS below the point
+int32_t filteredY = 0;
+
+// Calibration screen, on the top layer while it runs
+lv_obj_t *calibrationScreen = NULL;
+lv_obj_t *calibrationTarget;
+lv_obj_t *calibrationLabel;
+uint8_t calibrationStep; // Target waiting for its touch
+bool calibrationPress;   // The current press started on the calibration screen
+int32_t calibrationRaw[TOUCH_CALIBRATION_POINTS][2];
+lv_point_t calibrationTargets[TOUCH_CALIBRATION_POINTS];
+
+static int16_t median(const int16_t *samples)
+{
+    int16_t sorted[TOUCH_MEDIAN_SAMPLES];
+    for (uint8_t i = 0; i < TOUCH_MEDIAN_SAMPLES; i++)
+    {
+        int16_t value = samples[i];
+        uint8_t j = i;
+        for (; j > 0 && sorted[j - 1] > value; j--)
+        {
+            sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = value;
+    }
+    return sorted[TOUCH_MEDIAN_SAMPLES / 2];
+}
+
+// Feed a raw sample of the current press
+static void filterSample(int16_t x, int16_t y)
+{
+    if (!touching)
+    {
+        // First sample of a press, nothing to smooth against yet
+        for (uint8_t i = 0; i < TOUCH_MEDIAN_SAMPLES; i++)
+        {
+            medianWindow[0][i] = x;
+            medianWindow[1][i] = y;
+        }
+        filteredX = (int32_t)x << TOUCH_FRACTION_BITS;
+        filteredY = (int32_t)y << TOUCH_FRACTION_BITS;
+        return;
+    }
+
+    medianWindow[0][medianNext] = x;
+    medianWindow[1][medianNext] = y;
+    medianNext = (medianNext + 1) % TOUCH_MEDIAN_SAMPLES;
+    filteredX += (((int32_t)median(medianWindow[0]) << TOUCH_FRACTION_BITS) - filteredX) >> TOUCH_IIR_SHIFT;
+    filteredY += (((int32_t)median(medianWindow[1]) << TOUCH_FRACTION_BITS) - filteredY) >> TOUCH_IIR_SHIFT;
+}
+
+// Raw position through the calibration matrix, in the portrait coordinates
+static void calibratePoint(int32_t rawX, int32_t rawY, int &x, int &y)
+{
+    const TouchCalibration &m = touchCalibration;
+    x = (m.a * rawX + m.b * rawY + m.c) >> TOUCH_MATRIX_SHIFT;
+    x = constrain(x, 0, SCREEN_WIDTH - 1);
+    y = (m.d * rawX + m.e * rawY + m.f) >> TOUCH_MATRIX_SHIFT;
+    y = constrain(y, 0, SCREEN_HEIGHT - 1);
+}
+
+// Matrix taking the raw points to the targets, false when they do not make one
+static bool solveCalibration(TouchCalibration &m)
+{
+    int32_t screen[TOUCH_CALIBRATION_POINTS][2];
+    for (uint8_t i = 0; i < TOUCH_CALIBRATION_POINTS; i++)
+    {
+        int x, y;
+        displayCalibrationPoint(calibrationTargets[i], x, y);
+        screen[i][0] = x;
+        screen[i][1] = y;
+    }
+
+    // Relative to the third point, the matrix is the solution of two 2x2 systems
+    int64_t rx0 = calibrationRaw[0][0] - calibrationRaw[2][0], ry0 = calibrationRaw[0][1] - calibrationRaw[2][1];
+    int64_t rx1 = calibrationRaw[1][0] - calibrationRaw[2][0], ry1 = calibrationRaw[1][1] - calibrationRaw[2][1];
+    int64_t det = rx0 * ry1 - rx1 * ry0;
+    if (det > -TOUCH_CALIBRATION_MIN_DET && det < TOUCH_CALIBRATION_MIN_DET)
+    {
+        return false;
+    }
+
+    int32_t coefficients[2][3];
+    for (uint8_t axis = 0; axis < 2; axis++)
+    {
+        int64_t s0 = screen[0][axis] - screen[2][axis];
+        int64_t s1 = screen[1][axis] - screen[2][axis];
+        int64_t a = ((s0 * ry1 - s1 * ry0) << TOUCH_MATRIX_SHIFT) / det;
+        int64_t b = ((rx0 * s1 - rx1 * s0) << TOUCH_MATRIX_SHIFT) / det;
+        int64_t c = ((int64_t)screen[2][axis] << TOUCH_MATRIX_SHIFT) - a * calibrationRaw[2][0] - b * calibrationRaw[2][1];
+
+        // Far more than a pixel per raw step, or offsets the 32-bit products cannot take
+        if (a <= -(1 << TOUCH_MATRIX_SHIFT) || a >= (1 << TOUCH_MATRIX_SHIFT) ||
+            b <= -(1 << TOUCH_MATRIX_SHIFT) || b >= (1 << TOUCH_MATRIX_SHIFT) ||
+            c <= -(1 << 28) || c >= (1 << 28))
+        {
+            return false;
+        }
+        coefficients[axis][0] = a;
+        coefficients[axis][1] = b;
+        coefficients[axis][2] = c;
+    }
+    m = {coefficients[0][0], coefficients[0][1], coefficients[0][2],
+         coefficients[1][0], coefficients[1][1], coefficients[1][2]};
+    return true;
+}
+
+static void showCalibrationTarget(const char *text)
+{
+    const lv_point_t &target = calibrationTargets[calibrationStep];
+    lv_obj_set_pos(calibrationTarget, target.x - TOUCH_TARGET_SIZE / 2, target.y - TOUCH_TARGET_SIZE / 2);
+    lv_label_set_text_fmt(calibrationLabel, "%s\nTouch the target %u/%u", text,
+                          (unsigned)calibrationStep + 1, (unsigned)TOUCH_CALIBRATION_POINTS);
+}
+
+// A press of the calibration screen ended on this raw point
+static void noteCalibrationPoint(int32_t rawX, int32_t rawY)
+{
+    calibrationRaw[calibrationStep][0] = rawX;
+    calibrationRaw[calibrationStep][1] = rawY;
+    if (++calibrationStep < TOUCH_CALIBRATION_POINTS)
+    {
+        showCalibrationTarget("Touch calibration");
+        return;
+    }
+
+    TouchCalibration calibration;
+    if (!solveCalibration(calibration))
+    {
+        calibrationStep = 0;
+        showCalibrationTarget("Inconsistent touches, again");
+        return;
+    }
+    touchCalibration = calibration;
+
+    Preferences preferences;
+    preferences.begin(TOUCH_NAMESPACE, false);
+    preferences.putBytes("matrix", &touchCalibration, sizeof(touchCalibration));
+    preferences.end();
+    Serial.printf("Touch calibration: %d %d %d / %d %d %d\n", (int)calibration.a, (int)calibration.b,
+                  (int)calibration.c, (int)calibration.d, (int)calibration.e, (int)calibration.f);
+
+    lv_obj_delete_async(calibrationScreen); // We are inside the input device read
+    calibrationScreen = NULL;
+}
+
+void startTouchCalibration()
+{
+    if (calibrationScreen != NULL)
+    {
+        return;
+    }
+
+    // Spread over the screen and not on a line
+    int32_t width = lv_display_get_horizontal_resolution(NULL);
+    int32_t height = lv_display_get_vertical_resolution(NULL);
+    calibrationTargets[0] = {TOUCH_CALIBRATION_MARGIN, TOUCH_CALIBRATION_MARGIN};
+    calibrationTargets[1] = {width - 1 - TOUCH_CALIBRATION_MARGIN, height / 2};
+    calibrationTargets[2] = {width / 2, height - 1 - TOUCH_CALIBRATION_MARGIN};
+
+    calibrationScreen = lv_obj_create(lv_layer_top());
+    lv_obj_remove_style_all(calibrationScreen);
+    lv_obj_set_size(calibrationScreen, lv_pct(100), lv_pct(100));
+    lv_obj_set_style_bg_color(calibrationScreen, lv_color_white(), 0);
+    lv_obj_set_style_bg_opa(calibrationScreen, LV_OPA_COVER, 0);
+
+    calibrationLabel = lv_label_create(calibrationScreen);
+    lv_obj_set_style_text_align(calibrationLabel, LV_TEXT_ALIGN_CENTER, 0);
+    lv_obj_center(calibrationLabel);
+
+    calibrationTarget = lv_obj_create(calibrationScreen);
+    lv_obj_remove_style_all(calibrationTarget);
+    lv_obj_set_size(calibrationTarget, TOUCH_TARGET_SIZE, TOUCH_TARGET_SIZE);
+    lv_obj_set_style_radius(calibrationTarget, LV_RADIUS_CIRCLE, 0);
+    lv_obj_set_style_bg_color(calibrationTarget, lv_palette_main(LV_PALETTE_RED), 0);
+    lv_obj_set_style_bg_opa(calibrationTarget, LV_OPA_COVER, 0);
+
+    calibrationStep = 0;
+    calibrationPress = false; // The press that opened it does not count
+    showCalibrationTarget("Touch calibration");
+}
+
+// LVGL input callback, run by the UI task on the T_IRQ interrupt
+static void readTouch(lv_indev_t *indev, lv_indev_data_t *data)
+{
+    // T_IRQ is low while the panel is pressed, no SPI transfer otherwise. A light
+    // sample is a finger landing or leaving, its position is off.
+    TS_Point p;
+    bool pressed = digitalRead(XPT2046_IRQ) == LOW && touchscreen.touched();
+    if (pressed)
+    {
+        p = touchscreen.getPoint();
+        pressed = p.z >= TOUCH_Z_MIN;
+    }
+
+    if (!pressed)
+    {
+        if (touching && calibrationPress && calibrationScreen != NULL)
+        {
+            noteCalibrationPoint(filteredX >> TOUCH_FRACTION_BITS, filteredY >> TOUCH_FRACTION_BITS);
+        }
+        touching = false;
+        data->state = LV_INDEV_STATE_RELEASED;
+        return;
+    }
+
+    if (!touching)
+    {
+        calibrationPress = calibrationScreen != NULL;
+    }
+    filterSample(p.x, p.y);
+    touching = true;
+
+    // The GUI does not see the touches of the calibration
+    if (calibrationScreen != NULL)
+    {
+        data->state = LV_INDEV_STATE_RELEASED;
+        return;
+    }
+
+    int x, y;
+    calibratePoint(filteredX >> TOUCH_FRACTION_BITS, filteredY >> TOUCH_FRACTION_BITS, x, y);
+    data->state = LV_INDEV_STATE_PRESSED;
+    displayTouchPoint(x, y, data->point);
+}
+
+lv_indev_t *initTouch()
+{
+    // Start the SPI for the touchscreen and init the touchscreen
+    touchscreenSPI.begin(XPT2046_CLK, XPT2046_MISO, XPT2046_MOSI, XPT2046_CS);
+    touchscreen.begin(touchscreenSPI);
+    // Set the Touchscreen rotation in landscape mode
+    // Note: in some displays, the touchscreen might be upside down, so you might need to set the rotation to 0: touchscreen.setRotation(0);
+    touchscreen.setRotation(2);
+
+    Preferences preferences;
+    preferences.begin(TOUCH_NAMESPACE, true);
+    if (preferences.getBytesLength("matrix") == sizeof(touchCalibration))
+    {
+        preferences.getBytes("matrix", &touchCalibration, sizeof(touchCalibration));
+    }
+    preferences.end();
+
+    // Initialize an LVGL input device object (Touchscreen)
+    lv_indev_t *indev = lv_indev_create();
+    lv_indev_set_type(indev, LV_INDEV_TYPE_POINTER);
+    // Set the callback function to read Touchscreen input
+    lv_indev_set_read_cb(indev, readTouch);
+    // Read when T_IRQ falls instead of polling the controller
+    lv_indev_set_mode(indev, LV_INDEV_MODE_EVENT);
+    pinMode(XPT2046_IRQ, INPUT);
+    attachInterrupt(digitalPinToInterrupt(XPT2046_IRQ), postTouchFromISR, FALLING);
+    return indev;
+}
+
+bool touchHeld()
+{
+    return touching || digitalRead(XPT2046_IRQ) == LOW;
+}
@@ -0,0 +1,44 @@
+#ifndef TOUCH_HPP
+#define TOUCH_HPP
+
+#include <stdint.h>
+#include <lvgl.h>
+
+// Touchscreen pin configuration
+#define XPT2046_IRQ 36  // T_IRQ
+#define XPT2046_MOSI 32 // T_DIN
+#define XPT2046_MISO 39 // T_OUT
+#define XPT2046_CLK 25  // T_CLK
+#define XPT2046_CS 33   // T_CS
+
+// XPT2046 touch input. Samples under TOUCH_Z_MIN are no touch, the others go
+// through a median of the last TOUCH_MEDIAN_SAMPLES and an IIR low pass, then a
+// calibration matrix maps them to the screen in integer fixed point.
+// The matrix comes from a three-point calibration, kept in NVS.
+#define TOUCH_NAMESPACE "touch"    // NVS namespace of the calibration
+#define TOUCH_Z_MIN 600            // Pressure of a real touch, the library takes 400
+#define TOUCH_MEDIAN_SAMPLES 3     // Odd, the window of the median filter
+#define TOUCH_IIR_SHIFT 1          // Each sample moves the position by 1/2^shift of the difference
+#define TOUCH_MATRIX_SHIFT 16      // Fixed point of the calibration matrix
+#define TOUCH_CALIBRATION_MARGIN 30 // Targets this far from the edges of the screen
+#define TOUCH_CALIBRATION_MIN_DET 100000 // Targets read closer than this are a bad calibration
+
+// Screen point = raw point through the matrix, >> TOUCH_MATRIX_SHIFT:
+//   x = a * rawX + b * rawY + c
+//   y = d * rawX + e * rawY + f
+// in the portrait coordinates of displayTouchPoint()
+struct TouchCalibration
+{
+    int32_t a, b, c;
+    int32_t d, e, f;
+};
+
+// Start the controller, load the calibration and create the LVGL input device,
+// read on the T_IRQ interrupt (see startUi())
+lv_indev_t *initTouch();
+// Show the calibration screen, runs in the UI task until the three targets are touched
+void startTouchCalibration();
+// True while the panel is pressed, or until the read that sees it released
+bool touchHeld();
+
+#endif // TOUCH_HPP
@@ -0,0 +1,376 @@
+#include "ui.hpp"
+#include <Arduino.h>
+#include <WiFi.h>
+#include <atomic>
+#include <lvgl.h>
+#include "gui.hpp"
+#include "touch.hpp"
+
+#define UI_LIGHT_STEP_MASK (UI_LIGHT_STEPS - 1)
+
+struct LightStep
+{
+    uint32_t receivedMs;
+    LightWireStateNumber number; // {0, 0} when the board did not number it
+    uint8_t state;
+};
+
+// Last state shown of one board
+struct LightBoard
+{
+    uint32_t board;
+    uint16_t lastSeq;
+    uint32_t shownMs;
+    bool used;
+};
+
+// Single producer, single consumer: no lock between the network task and the UI
+struct LightStepRing
+{
+    LightStep steps[UI_LIGHT_STEPS];
+    std::atomic<uint32_t> head;     // Written by the producer only
+    std::atomic<uint32_t> tail;     // Written by the UI task only
+    LightStep latest;               // Latest state, even when the ring was full, under uiMux
+    std::atomic<uint32_t> overruns;
+};
+
+static QueueHandle_t uiQueue = NULL;
+
+// Latest message posted of each type, shown again when the queue dropped one
+static portMUX_TYPE uiMux = portMUX_INITIALIZER_UNLOCKED;
+static UiMessage uiLatest[UI_MESSAGE_TYPES];
+static uint8_t uiDroppedTypes = 0; // Bit per type the queue had no room for
+
+static LightStepRing lightRings[2]; // From the broker, from the direct link
+
+// Only touched in the UI task
+static lv_indev_t *touchIndev = NULL;
+static bool touchPressed = false; // Read every UI_TOUCH_POLL_MS until released
+static ConnectionStatus shownConnection = {CONNECTION_IDLE, 0, 0, 0};
+static bool shownDirectLink = false;
+static LightBoard lightBoards[UI_LIGHT_BOARDS];
+static uint32_t seenOverruns[2] = {0, 0};
+static uint32_t lastStepMs = 0;         // When the last state was shown...
+static uint32_t lastStepReceivedMs = 0; // ...and when it had arrived
+static bool lastStepDrawn = true;
+
+// Connection label of the status tab
+static void showConnection()
+{
+    String ipStr = IPAddress(shownConnection.ip).toString();
+    String retry = String(shownConnection.retryMs / 1000.0, 1) + " s";
+    String message;
+    switch (shownConnection.state)
+    {
+    case CONNECTION_IDLE:
+    case CONNECTION_WIFI_CONNECTING:
+        message = "Connecting to WiFi...";
+        break;
+    case CONNECTION_WIFI_BACKOFF:
+        message = "NO WiFi, retry in " + retry;
+        break;
+    case CONNECTION_MQTT_CONNECTING:
+        message = "IP: " + ipStr + " connecting to MQTT...";
+        break;
+    case CONNECTION_MQTT_BACKOFF:
+        message = "IP: " + ipStr + " NO MQTT, retry in " + retry;
+        break;
+    case CONNECTION_ONLINE:
+        message = "IP: " + ipStr + " MQTT OK";
+        break;
+    }
+    if (shownDirectLink)
+    {
+        message += " + DIRECT";
+    }
+    update_label(message.c_str());
+}
+
+static void applyUiMessage(const UiMessage &message)
+{
+    switch (message.type)
+    {
+    case UI_LIGHT_STATE:
+        break; // Only wakes the task up, the states are in the rings
+    case UI_CONNECTION:
+        shownConnection = message.connection;
+        showConnection();
+        break;
+    case UI_DIRECT_LINK:
+        shownDirectLink = message.directLink;
+        showConnection();
+        break;
+    case UI_RTT:
+        update_rtt_label(message.rtt);
+        break;
+    case UI_TOUCH:
+        touchPressed = true;
+        break;
+    default:
+        break;
+    }
+}
+
+// Oldest state waiting in the two rings
+static bool peekLightStep(uint8_t &path, LightStep &step)
+{
+    bool found = false;
+    for (uint8_t i = 0; i < 2; i++)
+    {
+        LightStepRing &ring = lightRings[i];
+        uint32_t tail = ring.tail.load(std::memory_order_relaxed);
+        if (tail == ring.head.load(std::memory_order_acquire))
+        {
+            continue;
+        }
+        const LightStep &candidate = ring.steps[tail & UI_LIGHT_STEP_MASK];
+        if (!found || (int32_t)(candidate.receivedMs - step.receivedMs) < 0)
+        {
+            path = i;
+            step = candidate;
+            found = true;
+        }
+    }
+    return found;
+}
+
+static void popLightStep(uint8_t path)
+{
+    LightStepRing &ring = lightRings[path];
+    ring.tail.store(ring.tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+static LightBoard *findLightBoard(uint32_t board)
+{
+    for (LightBoard &entry : lightBoards)
+    {
+        if (entry.used && entry.board == board)
+        {
+            return &entry;
+        }
+    }
+    return NULL;
+}
+
+// A RelaysBoard sends each state through both paths, only a state newer than
+// the last one shown of that board counts: the first copy of each
+static bool newLightStep(uint8_t path, const LightStep &step)
+{
+    if (step.number.seq == 0)
+    {
+        return path == (shownDirectLink ? 1 : 0);
+    }
+    const LightBoard *board = findLightBoard(step.number.board);
+    if (board == NULL)
+    {
+        return true;
+    }
+    int16_t ahead = (int16_t)(step.number.seq - board->lastSeq);
+    return ahead > 0 || ahead < -UI_LIGHT_SEQ_WINDOW;
+}
+
+// Remember the number of a state shown, in place of the board shown the longest ago
+static void noteLightStep(const LightStep &step)
+{
+    if (step.number.seq == 0)
+    {
+        return;
+    }
+    LightBoard *board = findLightBoard(step.number.board);
+    if (board == NULL)
+    {
+        board = &lightBoards[0];
+        for (LightBoard &entry : lightBoards)
+        {
+            if (!entry.used)
+            {
+                board = &entry;
+                break;
+            }
+            if ((int32_t)(entry.shownMs - board->shownMs) < 0)
+            {
+                board = &entry;
+            }
+        }
+    }
+    *board = {step.number.board, step.number.seq, millis(), true};
+}
+
+// Show the waiting states in order, returns the ms until the next one is due
+static uint32_t playLightSteps()
+{
+    uint8_t path;
+    LightStep step;
+    while (peekLightStep(path, step))
+    {
+        if (!newLightStep(path, step))
+        {
+            popLightStep(path);
+            continue;
+        }
+
+        uint32_t nowMs = millis();
+        if (nowMs - step.receivedMs <= UI_LIGHT_MAX_LAG_MS)
+        {
+            // Each state is drawn before the next one, and kept as long as the board did
+            if (!lastStepDrawn)
+            {
+                return UINT32_MAX; // The display refresh is an LVGL timer
+            }
+            uint32_t spacingMs = step.receivedMs - lastStepReceivedMs;
+            uint32_t shownMs = nowMs - lastStepMs;
+            if (spacingMs <= UI_LIGHT_MAX_LAG_MS && shownMs < spacingMs)
+            {
+                return spacingMs - shownMs;
+            }
+        }
+        popLightStep(path);
+        noteLightStep(step);
+        lastStepDrawn = !showLightState(step.state); // Nothing to draw when it did not change
+        lastStepMs = nowMs;
+        lastStepReceivedMs = step.receivedMs;
+    }
+
+    // Both rings are empty, the states a full ring dropped end with its latest one
+    for (uint8_t i = 0; i < 2; i++)
+    {
+        uint32_t overruns = lightRings[i].overruns.load(std::memory_order_acquire);
+        if (overruns != seenOverruns[i])
+        {
+            seenOverruns[i] = overruns;
+            portENTER_CRITICAL(&uiMux);
+            LightStep latest = lightRings[i].latest;
+            portEXIT_CRITICAL(&uiMux);
+            if (newLightStep(i, latest))
+            {
+                noteLightStep(latest);
+                showLightState(latest.state);
+            }
+        }
+    }
+    return UINT32_MAX;
+}
+
+static void onRefreshReady(lv_event_t *e)
+{
+    lastStepDrawn = true;
+}
+
+static void uiTaskMain(void *arg)
+{
+    showConnection(); // The label starts empty
+    for (;;)
+    {
+        // The touch controller only interrupts on the press, follow the touch until released
+        if (touchPressed)
+        {
+            lv_indev_read(touchIndev);
+            touchPressed = touchHeld();
+        }
+
+        uint32_t waitMs = lv_timer_handler(); // let the GUI do its work
+        uint32_t stepMs = playLightSteps();
+        if (stepMs < waitMs)
+        {
+            waitMs = stepMs;
+        }
+        if (touchPressed && waitMs > UI_TOUCH_POLL_MS)
+        {
+            waitMs = UI_TOUCH_POLL_MS;
+        }
+
+        // Sleep until the next LVGL timer or the next message, then take them all
+        UiMessage message;
+        TickType_t wait = pdMS_TO_TICKS(waitMs < UI_MAX_WAIT_MS ? waitMs : UI_MAX_WAIT_MS);
+        while (xQueueReceive(uiQueue, &message, wait) == pdTRUE)
+        {
+            applyUiMessage(message);
+            wait = 0;
+        }
+
+        // The queue is empty, catch up on the types it dropped with their latest message
+        uint8_t types = 0;
+        UiMessage latest[UI_MESSAGE_TYPES];
+        portENTER_CRITICAL(&uiMux);
+        if (uiDroppedTypes != 0)
+        {
+            types = uiDroppedTypes;
+            uiDroppedTypes = 0;
+            memcpy(latest, uiLatest, sizeof(latest));
+        }
+        portEXIT_CRITICAL(&uiMux);
+        for (uint8_t type = 0; type < UI_MESSAGE_TYPES; type++)
+        {
+            if (types & (1 << type))
+            {
+                applyUiMessage(latest[type]);
+            }
+        }
+    }
+}
+
+void initUi()
+{
+    uiQueue = xQueueCreate(UI_QUEUE_LENGTH, sizeof(UiMessage));
+}
+
+void startUi(lv_indev_t *touch)
+{
+    touchIndev = touch;
+    lv_display_add_event_cb(lv_display_get_default(), onRefreshReady, LV_EVENT_REFR_READY, NULL);
+    xTaskCreatePinnedToCore(uiTaskMain, "ui", UI_TASK_STACK, NULL, UI_TASK_PRIORITY, NULL, UI_TASK_CORE);
+}
+
+void postUi(const UiMessage &message)
+{
+    portENTER_CRITICAL(&uiMux);
+    uiLatest[message.type] = message;
+    portEXIT_CRITICAL(&uiMux);
+
+    if (xQueueSend(uiQueue, &message, 0) != pdTRUE)
+    {
+        portENTER_CRITICAL(&uiMux);
+        uiDroppedTypes |= 1 << message.type;
+        portEXIT_CRITICAL(&uiMux);
+    }
+}
+
+void postLightState(uint8_t state, const LightWireStateNumber &number, bool direct)
+{
+    LightStepRing &ring = lightRings[direct ? 1 : 0];
+    LightStep step = {millis(), number, state};
+    portENTER_CRITICAL(&uiMux);
+    ring.latest = step;
+    portEXIT_CRITICAL(&uiMux);
+    uint32_t head = ring.head.load(std::memory_order_relaxed);
+    if (head - ring.tail.load(std::memory_order_acquire) < UI_LIGHT_STEPS)
+    {
+        ring.steps[head & UI_LIGHT_STEP_MASK] = step;
+        ring.head.store(head + 1, std::memory_order_release);
+    }
+    else
+    {
+        ring.overruns.fetch_add(1, std::memory_order_release);
+    }
+
+    UiMessage message = {UI_LIGHT_STATE};
+    postUi(message);
+}
+
+void IRAM_ATTR postTouchFromISR()
+{
+    UiMessage message;
+    message.type = UI_TOUCH;
+    BaseType_t woken = pdFALSE;
+    if (xQueueSendFromISR(uiQueue, &message, &woken) != pdTRUE)
+    {
+        portENTER_CRITICAL_ISR(&uiMux);
+        uiLatest[UI_TOUCH].type = UI_TOUCH;
+        uiDroppedTypes |= 1 << UI_TOUCH;
+        portEXIT_CRITICAL_ISR(&uiMux);
+    }
+    if (woken)
+    {
+        portYIELD_FROM_ISR();
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef UI_HPP
+#define UI_HPP
+
+#include <stdint.h>
+#include <lvgl.h>
+#include "connection.hpp"
+#include "lightwire.h"
+#include "rtt.hpp"
+
+// LVGL is not thread safe, so it only runs in the UI task. The MQTT, WiFi and
+// ESP-NOW tasks hand what the screen shows to it as messages: postUi() never
+// waits. Every type is a snapshot replacing the previous one, so when the queue
+// is full the task catches up with the latest message of the types it dropped.
+#define UI_TASK_CORE 1          // With the Arduino loop, away from WiFi
+#define UI_TASK_PRIORITY 2      // Above the loop
+#define UI_TASK_STACK 8192      // LVGL renders in it
+#define UI_QUEUE_LENGTH 16      // Messages waiting for the task
+#define UI_MAX_WAIT_MS 1000     // Longest sleep, everything else wakes the task up
+#define UI_TOUCH_POLL_MS 10     // Touch read period while the panel is pressed
+
+// The light states are not snapshots: the indicators play every state the
+// RelaysBoard reports, each one drawn at least once and spaced as they came,
+// so they follow the effects step for step. The board coalesces them to one per
+// STATE_PUBLISH_DEFAULT_MS (100 ms) though, faster effect steps merge before
+// they get here. Each path (broker and direct link) has its own lock-free ring,
+// the UI task merges them and drops any state not newer than the last one shown
+// of the same board, by the number the board gives each state. Text states have
+// no number, they are only followed from the direct link while it is up, else
+// from the broker.
+#define UI_LIGHT_STEPS 32           // States waiting per path, a power of two
+#define UI_LIGHT_SEQ_WINDOW 64      // Further behind than this, the board restarted
+#define UI_LIGHT_BOARDS 4           // Boards whose last number is kept
+#define UI_LIGHT_MAX_LAG_MS 500     // Further behind the relays, states are skipped
+
+enum UiMessageType
+{
+    UI_LIGHT_STATE, // New light states in the rings, no payload
+    UI_CONNECTION,  // WiFi and broker progress
+    UI_DIRECT_LINK, // ESP-NOW link to the RelaysBoard up or down
+    UI_RTT,         // Command round trip figures
+    UI_TOUCH,       // The panel was pressed, no payload
+    UI_MESSAGE_TYPES
+};
+
+struct UiMessage
+{
+    UiMessageType type;
+    union
+    {
+        ConnectionStatus connection;
+        bool directLink;
+        RttStats rtt;
+    };
+};
+
+// Create the queue, before anything can post
+void initUi();
+// Start the UI task once the GUI is built, LVGL belongs to it from then on.
+// The touch input device is read on UI_TOUCH only, set it to LV_INDEV_MODE_EVENT.
+void startUi(lv_indev_t *touch);
+// From any task, returns at once
+void postUi(const UiMessage &message);
+// Light state from the MQTT task, or from the ESP-NOW task when direct.
+// number is {0, 0} when the board did not number it.
+void postLightState(uint8_t state, const LightWireStateNumber &number, bool direct);
+// Interrupt of the touch controller
+void postTouchFromISR();
+
+#endif // UI_HPP
@@ -0,0 +1,150 @@
+// Host benchmark of the light topic payloads: lightwire.h against the text formats.
+// Prints the cost of one encode and one decode per message type, in nanoseconds.
+//   pio run -e bench -t exec
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "lightwire.h"
+
+#define BENCH_ITERATIONS 2000000
+#define EFFECT_FLAGS_ALL 7
+
+static volatile uint32_t sink; // Keeps the compiler from dropping the work
+
+template <typename F>
+static double nsPerCall(F body)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        body(i);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / BENCH_ITERATIONS;
+}
+
+static void report(const char *name, size_t binarySize, size_t textSize, double binaryNs, double textNs)
+{
+    printf("%-16s %3u B %8.1f ns   text %3u B %8.1f ns\n",
+           name, (unsigned)binarySize, binaryNs, (unsigned)textSize, textNs);
+}
+
+int main()
+{
+    uint8_t binary[LIGHTWIRE_MAX_SIZE];
+    char text[48];
+
+    // Both ends must agree before the figures mean anything
+    LightWireEffect sent = {17, EFFECT_FLAGS_ALL, -1, 65535, 0x0123456789ABCDEFULL};
+    LightWireEffect received = {};
+    size_t length = lightWireEncodeEffect(binary, sizeof(binary), sent);
+    if (!lightWireDecodeEffect(binary, length, received) || received.effect != sent.effect || received.flags != sent.flags ||
+        received.repetitions != sent.repetitions || received.delayMs != sent.delayMs || received.startMs != sent.startMs ||
+        lightWireDecodeEffect(binary, length - 1, received) || lightWireIsBinary((const uint8_t *)"1010", 4))
+    {
+        printf("lightwire round trip failed\n");
+        return 1;
+    }
+
+    // light/command with its sequence, and a version 1 payload without one
+    uint8_t state = 0;
+    LightWireSeq seq = {};
+    length = lightWireEncodeState(binary, sizeof(binary), LIGHTWIRE_COMMAND, 9, {65535, 0xFEDCBA98});
+    bool stateOk = lightWireDecodeState(binary, length, LIGHTWIRE_COMMAND, state, seq) && state == 9 &&
+                   seq.seq == 65535 && seq.sentMs == 0xFEDCBA98;
+    const uint8_t version1[LIGHTWIRE_STATE_V1_SIZE] = {LIGHTWIRE_MAGIC, 1, LIGHTWIRE_COMMAND, 5};
+    stateOk = stateOk && lightWireDecodeState(version1, sizeof(version1), LIGHTWIRE_COMMAND, state, seq) &&
+              state == 5 && seq.seq == 0;
+
+    // light/state with its number, and a version 2 payload without one
+    LightWireStateNumber number = {};
+    length = lightWireEncodeState(binary, sizeof(binary), LIGHTWIRE_STATE, 6, {7, 8}, {0xBEEF, 0x89ABCDEF});
+    stateOk = stateOk && lightWireDecodeState(binary, length, LIGHTWIRE_STATE, state, seq, number) &&
+              state == 6 && seq.seq == 7 && number.seq == 0xBEEF && number.board == 0x89ABCDEF;
+    binary[1] = 2;
+    stateOk = stateOk && lightWireDecodeState(binary, LIGHTWIRE_STATE_V2_SIZE, LIGHTWIRE_STATE, state, seq, number) &&
+              state == 6 && seq.seq == 7 && number.seq == 0 && number.board == 0;
+    if (!stateOk)
+    {
+        printf("lightwire state round trip failed\n");
+        return 1;
+    }
+
+    printf("%u iterations per figure\n", BENCH_ITERATIONS);
+
+    // light/state, decimal text as published before
+    double stateEncode = nsPerCall([&](uint32_t i)
+                                   { sink += lightWireEncodeState(binary, sizeof(binary), LIGHTWIRE_STATE, i & 15); });
+    double stateEncodeText = nsPerCall([&](uint32_t i)
+                                       { sink += snprintf(text, sizeof(text), "%u", (unsigned)(i & 15)); });
+    report("state encode", LIGHTWIRE_STATE_SIZE, strlen(text), stateEncode, stateEncodeText);
+
+    lightWireEncodeState(binary, sizeof(binary), LIGHTWIRE_STATE, 10);
+    snprintf(text, sizeof(text), "%u", 10U);
+    double stateDecode = nsPerCall([&](uint32_t i)
+                                   {
+        uint8_t state = 0;
+        binary[3] = (uint8_t)i;
+        lightWireDecodeState(binary, LIGHTWIRE_STATE_SIZE, LIGHTWIRE_STATE, state);
+        sink += state; });
+    double stateDecodeText = nsPerCall([&](uint32_t i)
+                                       {
+        text[1] = '0' + (i & 7);
+        sink += strtol(text, NULL, 10); });
+    report("state decode", LIGHTWIRE_STATE_SIZE, strlen(text), stateDecode, stateDecodeText);
+
+    // light/command, 4-character bitstring
+    strcpy(text, "1010");
+    lightWireEncodeState(binary, sizeof(binary), LIGHTWIRE_COMMAND, 10);
+    double commandDecode = nsPerCall([&](uint32_t i)
+                                     {
+        uint8_t state = 0;
+        binary[3] = (uint8_t)i;
+        lightWireDecodeState(binary, LIGHTWIRE_STATE_SIZE, LIGHTWIRE_COMMAND, state);
+        sink += state; });
+    double commandDecodeText = nsPerCall([&](uint32_t i)
+                                         {
+        uint8_t state = 0;
+        text[3] = '0' + (i & 1);
+        for (int bit = 0; bit < 4; bit++)
+        {
+            state = (state << 1) | (text[bit] == '1');
+        }
+        sink += strlen(text) == 4 ? state : 0; });
+    report("command decode", LIGHTWIRE_STATE_SIZE, strlen(text), commandDecode, commandDecodeText);
+
+    // light/effect, CSV parsed with strtok/atoi like the RelaysBoard does
+    LightWireEffect effect = {2, 1, 3, 200, 1700000000000ULL};
+    double effectEncode = nsPerCall([&](uint32_t i)
+                                    {
+        effect.delayMs = 200 + (i & 7);
+        sink += lightWireEncodeEffect(binary, sizeof(binary), effect); });
+    double effectEncodeText = nsPerCall([&](uint32_t i)
+                                        { sink += snprintf(text, sizeof(text), "%i,%i,%i,%i,%llu", 2, 3, 200 + (int)(i & 7), 1, 1700000000000ULL); });
+    report("effect encode", LIGHTWIRE_EFFECT_SIZE, strlen(text), effectEncode, effectEncodeText);
+
+    lightWireEncodeEffect(binary, sizeof(binary), effect);
+    char csv[48];
+    strcpy(csv, text);
+    double effectDecode = nsPerCall([&](uint32_t i)
+                                    {
+        LightWireEffect decoded = {};
+        binary[7] = (uint8_t)i;
+        lightWireDecodeEffect(binary, LIGHTWIRE_EFFECT_SIZE, decoded);
+        sink += decoded.delayMs; });
+    double effectDecodeText = nsPerCall([&](uint32_t i)
+                                        {
+        memcpy(text, csv, sizeof(csv)); // strtok writes into the payload
+        text[6] = '0' + (i & 7);        // Last digit of the delay
+        int effectName = atoi(strtok(text, ","));
+        int repetitions = atoi(strtok(NULL, ","));
+        int delayMs = atoi(strtok(NULL, ","));
+        int flags = atoi(strtok(NULL, ","));
+        unsigned long long startMs = strtoull(strtok(NULL, ","), NULL, 10);
+        sink += effectName + repetitions + delayMs + flags + (uint32_t)startMs; });
+    report("effect decode", LIGHTWIRE_EFFECT_SIZE, strlen(csv), effectDecode, effectDecodeText);
+
+    return 0;
+}
@@ -0,0 +1,81 @@
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+// Minimal Arduino core used by the native simulator (see sim.hpp)
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+
+#define ICACHE_RAM_ATTR
+#define IRAM_ATTR
+#define RTC_NOINIT_ATTR
+
+// Every simulator run is a cold boot
+typedef enum
+{
+    ESP_RST_POWERON = 1,
+    ESP_RST_SW = 3,
+    ESP_RST_BROWNOUT = 9
+} esp_reset_reason_t;
+inline esp_reset_reason_t esp_reset_reason() { return ESP_RST_POWERON; }
+
+// ESP32 GPIO set/clear and input registers, routed to the virtual GPIO block
+#define GPIO_OUT_W1TS_REG 0x3FF44008
+#define GPIO_OUT_W1TC_REG 0x3FF4400C
+#define GPIO_IN_REG 0x3FF4403C
+#define GPIO_REG_WRITE(reg, val) simGpioRegWrite((reg), (val))
+#define GPIO_REG_READ(reg) simGpioRegRead(reg)
+
+// Single-threaded simulation: critical sections are no-ops
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+#define portENTER_CRITICAL_ISR(mux) ((void)(mux))
+#define portEXIT_CRITICAL_ISR(mux) ((void)(mux))
+
+#define F(string_literal) (string_literal)
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+void simGpioRegWrite(uint32_t reg, uint32_t value);
+uint32_t simGpioRegRead(uint32_t reg);
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+
+void pinMode(uint8_t pin, uint8_t mode);
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t value);
+void attachInterrupt(uint8_t pin, void (*isr)(void), int mode);
+
+// Serial output is discarded so the trace stays deterministic
+class SimSerial
+{
+public:
+    void begin(unsigned long) {}
+    template <typename T>
+    void print(const T &) {}
+    template <typename T>
+    void println(const T &) {}
+    void println() {}
+    void printf(const char *, ...) {}
+};
+
+extern SimSerial Serial;
+
+#endif // SIM_ARDUINO_H
@@ -0,0 +1,9 @@
+#ifndef SIM_ASYNCMQTTCLIENT_H
+#define SIM_ASYNCMQTTCLIENT_H
+
+#include <Arduino.h>
+
+// The simulator never talks to a broker: publishState() is provided by sim.cpp
+class AsyncMqttClient;
+
+#endif // SIM_ASYNCMQTTCLIENT_H
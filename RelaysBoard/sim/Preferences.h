@@ -0,0 +1,56 @@
+#ifndef SIM_PREFERENCES_H
+#define SIM_PREFERENCES_H
+
+#include <Arduino.h>
+
+// In-memory stand-in for the NVS backed Preferences, lost when the simulator exits
+class Preferences
+{
+public:
+    bool begin(const char *name, bool readOnly = false);
+    void end();
+    bool clear();
+    bool remove(const char *key);
+    bool isKey(const char *key);
+
+    size_t putBytes(const char *key, const void *value, size_t len);
+    size_t getBytes(const char *key, void *buf, size_t maxLen);
+    size_t getBytesLength(const char *key);
+
+    size_t putUChar(const char *key, uint8_t value) { return putBytes(key, &value, sizeof(value)); }
+    uint8_t getUChar(const char *key, uint8_t defaultValue = 0) { return getValue(key, defaultValue); }
+    size_t putUShort(const char *key, uint16_t value) { return putBytes(key, &value, sizeof(value)); }
+    uint16_t getUShort(const char *key, uint16_t defaultValue = 0) { return getValue(key, defaultValue); }
+    size_t putUInt(const char *key, uint32_t value) { return putBytes(key, &value, sizeof(value)); }
+    uint32_t getUInt(const char *key, uint32_t defaultValue = 0) { return getValue(key, defaultValue); }
+    size_t putBool(const char *key, bool value) { return putUChar(key, value); }
+    bool getBool(const char *key, bool defaultValue = false) { return getUChar(key, defaultValue); }
+    size_t getString(const char *key, char *value, size_t maxLen)
+    {
+        size_t length = getBytesLength(key);
+        if (length == 0 || length >= maxLen || getBytes(key, value, maxLen) != length)
+        {
+            return 0;
+        }
+        value[length] = '\0';
+        return length + 1;
+    }
+
+private:
+    template <typename T>
+    T getValue(const char *key, T defaultValue)
+    {
+        T value = defaultValue;
+        if (getBytesLength(key) == sizeof(T))
+        {
+            getBytes(key, &value, sizeof(T));
+        }
+        return value;
+    }
+
+    char name[16];
+    bool readOnly;
+    bool started;
+};
+
+#endif // SIM_PREFERENCES_H
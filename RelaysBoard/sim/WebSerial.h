@@ -0,0 +1,6 @@
+#ifndef SIM_WEBSERIAL_H
+#define SIM_WEBSERIAL_H
+
+#include <Arduino.h>
+
+#endif // SIM_WEBSERIAL_H
@@ -0,0 +1,8 @@
+#ifndef SIM_WIFI_H
+#define SIM_WIFI_H
+
+#include <Arduino.h>
+
+typedef int WiFiEvent_t;
+
+#endif // SIM_WIFI_H
@@ -0,0 +1,188 @@
+// Native simulator for the RelaysBoard effect engine.
+//
+// Reads a scenario (file argument or stdin), one event per line:
+//   <time_ms> <topic> [payload]   deliver an MQTT message, e.g. "0 light/effect 2,3,200"
+//   <time_ms> hb <0|1>            drive the high beam signal (1 = signal active)
+//   <time_ms> end                 stop the simulation
+// Lines starting with '#' are ignored. Events must be in time order.
+//
+// Like the scheduler task on the board, updateEffect() runs when an event arrives or at
+// the deadline it returned, so long runs only cost as much as the frames they contain.
+// Every relay frame written by changeState() is printed with its virtual timestamp,
+// light/state and light/running publishes as loop() would send them.
+// Options: -l <us> wake-up latency added to every step deadline, -q summary only,
+// -r offload the effects that fit to the RMT stand-in (see sim/rmt_check.sh).
+
+#include <Arduino.h>
+#include <time.h>
+#include "sim.hpp"
+#include "light.hpp"
+#include "command.hpp"
+#include "program.hpp"
+#include "timesync.hpp"
+#include "statepub.hpp"
+#include "hbinput.hpp"
+#include "laststate.hpp"
+#include "config.hpp"
+
+#define SIM_LINE_MAX 512
+
+struct SimEvent
+{
+    unsigned long long timeMs;
+    char topic[64];
+    char payload[SIM_LINE_MAX];
+    bool valid;
+};
+
+static bool readEvent(FILE *in, SimEvent &event)
+{
+    char line[SIM_LINE_MAX];
+    while (fgets(line, sizeof(line), in) != NULL)
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '#' || line[0] == '\0')
+        {
+            continue;
+        }
+
+        event.payload[0] = '\0';
+        int fields = sscanf(line, "%llu %63s %511s", &event.timeMs, event.topic, event.payload);
+        if (fields < 2)
+        {
+            fprintf(stderr, "sim: ignoring malformed line: %s\n", line);
+            continue;
+        }
+        event.valid = true;
+        return true;
+    }
+    event.valid = false;
+    return false;
+}
+
+static bool applyEvent(SimEvent &event)
+{
+    if (strcmp(event.topic, "end") == 0)
+    {
+        return false;
+    }
+    if (strcmp(event.topic, "hb") == 0)
+    {
+        // The high beam input is active low
+        simSetPin(boardConfig.hbSignalPin, atoi(event.payload) ? LOW : HIGH);
+        return true;
+    }
+    handleMessage(event.topic, event.payload, strlen(event.payload));
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long latencyUs = 0;
+    bool quiet = false;
+    bool rmt = false;
+    const char *path = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-l") == 0 && i + 1 < argc)
+        {
+            latencyUs = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-q") == 0)
+        {
+            quiet = true;
+        }
+        else if (strcmp(argv[i], "-r") == 0)
+        {
+            rmt = true;
+        }
+        else
+        {
+            path = argv[i];
+        }
+    }
+    FILE *in = path != NULL ? fopen(path, "r") : stdin;
+    if (in == NULL)
+    {
+        perror(path);
+        return 1;
+    }
+
+    simInit(quiet ? NULL : stdout);
+    simSetRmt(rmt);
+    loadConfig();
+    init_pins();
+    restoreLastState();
+    loadPrograms();
+    initTimeSync("sim");
+    applyConfig();
+
+    clock_t wallStart = clock();
+    SimEvent event;
+    readEvent(in, event);
+    bool running = true;
+    while (running)
+    {
+        // Deliver every event due at the current virtual time
+        while (event.valid && event.timeMs * 1000 <= simMicros())
+        {
+            if (!applyEvent(event))
+            {
+                running = false;
+                break;
+            }
+            readEvent(in, event);
+        }
+        if (!running || !event.valid)
+        {
+            break;
+        }
+
+        unsigned long waitUs = updateEffect();
+        unsigned long publishWaitUs = serviceStatePublish();
+        if (publishWaitUs < waitUs)
+        {
+            waitUs = publishWaitUs;
+        }
+
+        EffectTiming timing;
+        if (takeEffectTiming(timing) && !quiet)
+        {
+            printf("%10llu.%03llu timing steps %u late avg %llu us max %u us\n",
+                   (unsigned long long)(simMicros() / 1000), (unsigned long long)(simMicros() % 1000),
+                   (unsigned)timing.steps,
+                   (unsigned long long)(timing.steps ? timing.totalLateUs / timing.steps : 0),
+                   (unsigned)timing.maxLateUs);
+        }
+
+        HbLatency latency;
+        if (takeHbLatency(latency) && !quiet)
+        {
+            printf("%10llu.%03llu hb latency %u us, %u bounces\n",
+                   (unsigned long long)(simMicros() / 1000), (unsigned long long)(simMicros() % 1000),
+                   (unsigned)latency.lastUs, (unsigned)latency.bounces);
+        }
+
+        // Sleep until the next step deadline or the next event, whichever comes first
+        uint64_t nextUs = event.timeMs * 1000;
+        if (waitUs != EFFECT_IDLE && simMicros() + waitUs + latencyUs < nextUs)
+        {
+            nextUs = simMicros() + waitUs + latencyUs;
+        }
+        if (nextUs > simMicros())
+        {
+            simAdvance(nextUs - simMicros());
+        }
+    }
+    double wallSeconds = (double)(clock() - wallStart) / CLOCKS_PER_SEC;
+
+    fprintf(stderr, "sim: %llu ms simulated, %lu frames, %.3f s wall\n",
+            (unsigned long long)(simMicros() / 1000), simFrameCount(), wallSeconds);
+
+    if (in != stdin)
+    {
+        fclose(in);
+    }
+    return 0;
+}
@@ -0,0 +1,14 @@
+#!/bin/sh
+# The light/state sequence must not depend on where an effect plays: run a
+# scenario on the engine and on the RMT stand-in and compare what is published.
+# Usage: sim/rmt_check.sh <simulator> [scenario], scenario defaults to sim/rmt.txt
+SIM=${1:?usage: $0 <simulator> [scenario]}
+SCENARIO=${2:-$(dirname "$0")/rmt.txt}
+
+"$SIM" "$SCENARIO" 2>/dev/null | grep " light/state " > /tmp/rmt_check_cpu.txt
+"$SIM" -r "$SCENARIO" 2>/dev/null | grep " light/state " > /tmp/rmt_check_rmt.txt
+if ! diff /tmp/rmt_check_cpu.txt /tmp/rmt_check_rmt.txt; then
+    echo "rmt_check: light/state differs between the engine and the RMT" >&2
+    exit 1
+fi
+echo "rmt_check: $(wc -l < /tmp/rmt_check_cpu.txt) light/state publishes match"
@@ -0,0 +1,378 @@
+#include "sim.hpp"
+#include <Arduino.h>
+#include <Preferences.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "light.hpp"
+#include "mqtt.hpp"
+#include "scheduler.hpp"
+#include "rmtout.hpp"
+#include "waveform.hpp"
+#include "config.hpp"
+
+#define SIM_PIN_COUNT 40
+
+SimSerial Serial;
+
+static FILE *traceOut = NULL;
+static uint64_t nowUs = 0;
+static uint32_t gpioOut = 0;
+static int pinLevel[SIM_PIN_COUNT];
+static void (*pinIsr[SIM_PIN_COUNT])(void);
+static int pinIsrMode[SIM_PIN_COUNT];
+static unsigned long frameCount = 0;
+
+static const uint8_t *tracedPins = boardConfig.relayPins;
+
+static void traceTime()
+{
+    fprintf(traceOut, "%10llu.%03llu ", (unsigned long long)(nowUs / 1000), (unsigned long long)(nowUs % 1000));
+}
+
+void simInit(FILE *trace)
+{
+    traceOut = trace;
+    nowUs = 0;
+    gpioOut = 0;
+    frameCount = 0;
+    for (int i = 0; i < SIM_PIN_COUNT; i++)
+    {
+        pinLevel[i] = HIGH; // Inputs idle high through their pull-ups
+        pinIsr[i] = NULL;
+        pinIsrMode[i] = 0;
+    }
+}
+
+void simAdvance(unsigned long us)
+{
+    nowUs += us;
+}
+
+uint64_t simMicros()
+{
+    return nowUs;
+}
+
+unsigned long simFrameCount()
+{
+    return frameCount;
+}
+
+void simSetPin(uint8_t pin, int level)
+{
+    if (pin >= SIM_PIN_COUNT || pinLevel[pin] == level)
+    {
+        return;
+    }
+    pinLevel[pin] = level;
+
+    int mode = pinIsrMode[pin];
+    if (pinIsr[pin] != NULL && (mode == CHANGE || (mode == RISING && level == HIGH) || (mode == FALLING && level == LOW)))
+    {
+        pinIsr[pin]();
+    }
+}
+
+// Input levels of GPIO0-31
+uint32_t simGpioRegRead(uint32_t reg)
+{
+    uint32_t value = 0;
+    for (int pin = 0; pin < 32 && reg == GPIO_IN_REG; pin++)
+    {
+        value |= (uint32_t)(pinLevel[pin] == HIGH) << pin;
+    }
+    return value;
+}
+
+// changeState() always sets then clears, so a W1TC write completes one relay frame
+void simGpioRegWrite(uint32_t reg, uint32_t value)
+{
+    if (reg == GPIO_OUT_W1TS_REG)
+    {
+        gpioOut |= value;
+        return;
+    }
+    if (reg != GPIO_OUT_W1TC_REG)
+    {
+        return;
+    }
+    gpioOut &= ~value;
+
+    frameCount++;
+    if (traceOut == NULL)
+    {
+        return;
+    }
+    traceTime();
+    fputs("relays ", traceOut);
+    for (int i = 3; i >= 0; i--)
+    {
+        fputc((gpioOut >> tracedPins[i]) & 1 ? '1' : '0', traceOut);
+    }
+    fputc('\n', traceOut);
+}
+
+unsigned long millis()
+{
+    return (unsigned long)(nowUs / 1000);
+}
+
+unsigned long micros()
+{
+    return (unsigned long)nowUs;
+}
+
+void delay(unsigned long ms)
+{
+    nowUs += (uint64_t)ms * 1000;
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+}
+
+int digitalRead(uint8_t pin)
+{
+    return pin < SIM_PIN_COUNT ? pinLevel[pin] : LOW;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+    if (pin >= SIM_PIN_COUNT)
+    {
+        return;
+    }
+    pinLevel[pin] = value;
+    if (traceOut != NULL)
+    {
+        traceTime();
+        fprintf(traceOut, "pin %u %u\n", pin, value);
+    }
+}
+
+void attachInterrupt(uint8_t pin, void (*isr)(void), int mode)
+{
+    if (pin < SIM_PIN_COUNT)
+    {
+        pinIsr[pin] = isr;
+        pinIsrMode[pin] = mode;
+    }
+}
+
+// Stand-ins for the MQTT publishes in mqtt.cpp
+bool publishState(uint8_t state, uint16_t seq, uint32_t sentMs)
+{
+    if (traceOut != NULL && seq != 0)
+    {
+        traceTime();
+        fprintf(traceOut, "publish %s %u seq %u sent %u\n", TOPIC_LIGHT_STATE, state, (unsigned)seq, (unsigned)sentMs);
+    }
+    else if (traceOut != NULL)
+    {
+        traceTime();
+        fprintf(traceOut, "publish %s %u\n", TOPIC_LIGHT_STATE, state);
+    }
+    return true;
+}
+
+void setWireBinary(bool binary)
+{
+}
+
+void setVehicleId(const char *vehicleId)
+{
+}
+
+void setTelemetryPeriod(uint32_t periodMs)
+{
+}
+
+void setMqttServer(uint32_t host, uint16_t port)
+{
+}
+
+bool publishRetained(const char *topic, const char *payload)
+{
+    publishMessage(topic, payload);
+    return true;
+}
+
+void publishMessage(const char *topic, const char *payload)
+{
+    if (traceOut != NULL)
+    {
+        traceTime();
+        fprintf(traceOut, "publish %s %s\n", topic, payload);
+    }
+}
+
+// main.cpp calls updateEffect() itself at the deadlines it returns
+void wakeEffectScheduler()
+{
+}
+
+void wakeEffectSchedulerFromISR()
+{
+}
+
+// RMT stand-in, off unless simSetRmt(): effects then stay on the engine and every
+// frame shows in the trace. On, the waveform plays in virtual time without
+// touching the relay pins, like the peripheral, and the trace only has what the
+// engine publishes of it.
+static bool rmtEnabled = false;
+static bool rmtPlaying = false;
+static RmtFrame rmtFrames[RMT_MAX_FRAMES];
+static size_t rmtFrameCount = 0;
+static uint8_t rmtInitialState = OFF_STATE;
+static uint64_t rmtCycleUs = 0;
+static uint64_t rmtStartUs = 0;
+static uint64_t rmtDurationUs = 0;
+
+void simSetRmt(bool enabled)
+{
+    rmtEnabled = enabled;
+}
+
+void initRmtOutput()
+{
+}
+
+bool rmtPlay(const RmtFrame *frames, size_t count, uint8_t currentState, unsigned long durationUs)
+{
+    if (rmtPlaying)
+    {
+        currentState = rmtStop();
+    }
+    if (!rmtEnabled || count == 0 || count > RMT_MAX_FRAMES)
+    {
+        return false;
+    }
+
+    // The items of the peripheral need two ticks at least
+    rmtCycleUs = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (frames[i].durationUs % RMT_TICK_US != 0 || frames[i].durationUs < 2 * RMT_TICK_US)
+        {
+            return false;
+        }
+        rmtFrames[i] = frames[i];
+        rmtCycleUs += frames[i].durationUs;
+    }
+    rmtFrameCount = count;
+    rmtInitialState = currentState;
+    rmtStartUs = nowUs;
+    rmtDurationUs = durationUs;
+    rmtPlaying = true;
+    return true;
+}
+
+bool rmtActive()
+{
+    return rmtPlaying;
+}
+
+static uint64_t rmtElapsedUs()
+{
+    uint64_t elapsedUs = nowUs - rmtStartUs;
+    if (rmtDurationUs != 0 && elapsedUs >= rmtDurationUs)
+    {
+        elapsedUs = rmtDurationUs - 1;
+    }
+    return elapsedUs;
+}
+
+uint8_t rmtCurrentFrame(uint32_t &cycles, uint8_t &frame, unsigned long &nextFrameUs)
+{
+    WaveformPosition position;
+    waveformPosition(rmtFrames, rmtFrameCount, rmtCycleUs, rmtElapsedUs(), position);
+    cycles = (uint32_t)position.cycles;
+    frame = (uint8_t)position.frame;
+    nextFrameUs = (unsigned long)(position.frameStartUs + rmtFrames[position.frame].durationUs - position.offsetUs);
+    return rmtFrames[position.frame].mask;
+}
+
+uint8_t rmtStop()
+{
+    if (!rmtPlaying)
+    {
+        return OFF_STATE;
+    }
+    rmtPlaying = false;
+    return accountWaveform(rmtFrames, rmtFrameCount, rmtCycleUs, rmtInitialState, (unsigned long)rmtStartUs, rmtElapsedUs());
+}
+
+// Preferences namespaces and keys, kept for the lifetime of the process
+static std::map<std::string, std::vector<uint8_t>> nvs;
+
+static std::string nvsKey(const char *name, const char *key)
+{
+    return std::string(name) + "/" + key;
+}
+
+bool Preferences::begin(const char *nameParam, bool readOnlyParam)
+{
+    strncpy(name, nameParam, sizeof(name) - 1);
+    name[sizeof(name) - 1] = '\0';
+    readOnly = readOnlyParam;
+    started = true;
+    return true;
+}
+
+void Preferences::end()
+{
+    started = false;
+}
+
+bool Preferences::clear()
+{
+    if (!started || readOnly)
+    {
+        return false;
+    }
+    std::string prefix = std::string(name) + "/";
+    for (auto it = nvs.begin(); it != nvs.end();)
+    {
+        it = it->first.compare(0, prefix.size(), prefix) == 0 ? nvs.erase(it) : std::next(it);
+    }
+    return true;
+}
+
+bool Preferences::remove(const char *key)
+{
+    return started && !readOnly && nvs.erase(nvsKey(name, key)) > 0;
+}
+
+bool Preferences::isKey(const char *key)
+{
+    return started && nvs.count(nvsKey(name, key)) > 0;
+}
+
+size_t Preferences::putBytes(const char *key, const void *value, size_t len)
+{
+    if (!started || readOnly)
+    {
+        return 0;
+    }
+    const uint8_t *bytes = (const uint8_t *)value;
+    nvs[nvsKey(name, key)].assign(bytes, bytes + len);
+    return len;
+}
+
+size_t Preferences::getBytes(const char *key, void *buf, size_t maxLen)
+{
+    auto it = nvs.find(nvsKey(name, key));
+    if (!started || it == nvs.end() || it->second.size() > maxLen)
+    {
+        return 0;
+    }
+    memcpy(buf, it->second.data(), it->second.size());
+    return it->second.size();
+}
+
+size_t Preferences::getBytesLength(const char *key)
+{
+    auto it = nvs.find(nvsKey(name, key));
+    return started && it != nvs.end() ? it->second.size() : 0;
+}
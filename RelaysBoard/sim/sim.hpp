@@ -0,0 +1,23 @@
+#ifndef SIM_HPP
+#define SIM_HPP
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Host-side hardware shim for the RelaysBoard effect engine.
+// Time only moves when simAdvance() is called, so every run is deterministic.
+
+void simInit(FILE *trace);
+void simAdvance(unsigned long us);
+uint64_t simMicros();
+
+// Drive an input pin and fire its interrupt handler like the GPIO matrix would
+void simSetPin(uint8_t pin, int level);
+
+// Let effects whose waveform fits play on the RMT stand-in, as on the board
+void simSetRmt(bool enabled);
+
+// Number of relay frames written since simInit()
+unsigned long simFrameCount();
+
+#endif // SIM_HPP
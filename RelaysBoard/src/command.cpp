@@ -0,0 +1,248 @@
+#include "command.hpp"
+#include "light.hpp"
+#include "effects.h"
+#include "mqtt.hpp"
+#include "program.hpp"
+#include "wear.hpp"
+#include "timesync.hpp"
+#include "statepub.hpp"
+#include "lightwire.h"
+#include "topicrouter.h"
+#include "config.hpp"
+
+// Function to convert a 4-bit binary string to uint8_t
+uint8_t convertBinaryStringToUint8(const char *payload)
+{
+    // Check if the string is exactly 4 characters long
+    if (strlen(payload) != 4)
+    {
+        // Handle error if necessary (returns 0 by default)
+        return 0;
+    }
+
+    uint8_t result = 0;
+
+    // Iterate over each character in the string
+    for (int i = 0; i < 4; ++i)
+    {
+        result <<= 1; // Shift `result` one bit to the left
+
+        // Add the corresponding bit (0 or 1)
+        if (payload[i] == '1')
+        {
+            result |= 1;
+        }
+        else if (payload[i] != '0')
+        {
+            // Handle incorrect string (return 0 as an example)
+            return 0;
+        }
+    }
+
+    return result;
+}
+
+// Decode a hex string into bytes, returns the number of bytes or 0 on error
+static size_t decodeHex(const char *hex, uint8_t *out, size_t maxLength)
+{
+    size_t length = strlen(hex);
+    if (length == 0 || length % 2 != 0 || length / 2 > maxLength)
+    {
+        return 0;
+    }
+
+    for (size_t i = 0; i < length / 2; i++)
+    {
+        char byte[3] = {hex[2 * i], hex[2 * i + 1], '\0'};
+        char *end;
+        out[i] = (uint8_t)strtoul(byte, &end, 16);
+        if (*end != '\0')
+        {
+            return 0;
+        }
+    }
+    return length / 2;
+}
+
+// Store an effect program sent as "<slot>,<hex bytecode>[,save]"
+static void handleProgram(char *payload)
+{
+    char *slotStr = strtok(payload, ",");
+    char *codeStr = strtok(NULL, ",");
+    char *saveStr = strtok(NULL, ",");
+    if (slotStr == NULL || codeStr == NULL)
+    {
+        return;
+    }
+
+    uint8_t code[PROGRAM_MAX_LENGTH];
+    size_t length = decodeHex(codeStr, code, sizeof(code));
+    bool save = saveStr != NULL && strcmp(saveStr, "save") == 0;
+    if (length == 0 || !programStore(atoi(slotStr), code, length, save))
+    {
+        Serial.println(F("Rejected effect program"));
+    }
+}
+
+struct EffectCommand
+{
+    int effect;
+    int repetitions;
+    int delayMs;
+    uint8_t flags;
+    uint64_t startMs; // Shared time of the first step, 0 to start now
+};
+
+// Parse a binary effect (lightwire.h) or "<effect>,<repetitions>,<delay ms>[,<EffectFlags>[,<start ms>]]"
+// as sent on light/effect and light/queue
+static void parseEffectCommand(char *payload, size_t len, EffectCommand &command)
+{
+    command.effect = EFFECT_COUNT;
+    command.repetitions = boardConfig.effectRepetitions;
+    command.delayMs = boardConfig.effectDelayMs;
+    command.flags = 0;
+    command.startMs = 0;
+
+    LightWireEffect effect;
+    if (lightWireIsBinary((const uint8_t *)payload, len))
+    {
+        if (lightWireDecodeEffect((const uint8_t *)payload, len, effect))
+        {
+            command.effect = effect.effect;
+            command.repetitions = effect.repetitions <= 0 ? -1 : effect.repetitions;
+            command.delayMs = effect.delayMs;
+            command.flags = effect.flags;
+            command.startMs = effect.startMs;
+        }
+        return;
+    }
+
+    // Parse the payload for effect name, repetitions, delay, and optional EffectFlags
+    char *effectStr = strtok((char *)payload, ",");
+    char *repetitionsStr = strtok(NULL, ",");
+    char *delayStr = strtok(NULL, ",");
+    char *flagsStr = strtok(NULL, ",");
+    char *startStr = strtok(NULL, ",");
+
+    if (effectStr != NULL)
+    {
+        command.effect = atoi(effectStr);
+    }
+
+    if (repetitionsStr != NULL)
+    {
+        command.repetitions = atoi(repetitionsStr);
+    }
+    if (delayStr != NULL)
+    {
+        command.delayMs = atoi(delayStr);
+    }
+    if (flagsStr != NULL)
+    {
+        // "invert" is still accepted from older senders
+        command.flags = strcmp(flagsStr, "invert") == 0 ? EFFECT_INVERT : atoi(flagsStr);
+    }
+    if (startStr != NULL)
+    {
+        command.startMs = strtoull(startStr, NULL, 10);
+    }
+
+    if (command.repetitions <= 0)
+    {
+        command.repetitions = -1; // Infinite loop
+    }
+}
+
+// Topics handled by the board, below the vehicle prefix
+static constexpr TopicRoute commandRoutes[] = {
+    {TOPIC_LIGHT_COMMAND, TOPIC_ID_LIGHT_COMMAND, 0},
+    {TOPIC_LIGHT_EFFECT, TOPIC_ID_LIGHT_EFFECT, 0},
+    {TOPIC_LIGHT_STOP, TOPIC_ID_LIGHT_STOP, 1},
+    {TOPIC_CONFIG, TOPIC_ID_CONFIG, 0},
+    {TOPIC_LIGHT_PROGRAM, TOPIC_ID_LIGHT_PROGRAM, 1},
+    {TOPIC_LIGHT_QUEUE, TOPIC_ID_LIGHT_QUEUE, 1},
+    {TOPIC_LIGHT_QUEUE_CLEAR, TOPIC_ID_LIGHT_QUEUE_CLEAR, 1},
+    {TOPIC_LIGHT_QUEUE_LOOP, TOPIC_ID_LIGHT_QUEUE_LOOP, 1},
+    {TOPIC_SYNC_REQUEST, TOPIC_ID_SYNC_REQUEST, 0},
+    {TOPIC_SYNC_RESPONSE, TOPIC_ID_SYNC_RESPONSE, 0},
+};
+static constexpr auto commandRouter = compileTopicRouter(commandRoutes);
+static_assert(commandRouter.seed != 0, "no perfect hash for the command topics");
+
+const TopicRoute *getCommandRoutes(size_t &count)
+{
+    count = sizeof(commandRoutes) / sizeof(commandRoutes[0]);
+    return commandRoutes;
+}
+
+void handleMessage(const char *topic, char *payload, size_t len)
+{
+    switch (topicLookup(commandRouter, commandRoutes, topic))
+    {
+    case TOPIC_ID_LIGHT_STOP:
+        stop();
+        break;
+
+    case TOPIC_ID_LIGHT_COMMAND:
+    {
+        uint8_t state;
+        LightWireSeq seq = {0, 0};
+        if (!lightWireDecodeState((const uint8_t *)payload, len, LIGHTWIRE_COMMAND, state, seq))
+        {
+            state = convertBinaryStringToUint8(payload);
+        }
+        setLightState(state, seq.seq, seq.sentMs);
+        break;
+    }
+
+    case TOPIC_ID_LIGHT_EFFECT:
+    {
+        EffectCommand command;
+        parseEffectCommand(payload, len, command);
+
+        // Boards sharing a timebase start the same step together
+        unsigned long startUs = micros();
+        if (command.startMs != 0)
+        {
+            sharedToLocalMicros(command.startMs, startUs);
+        }
+        playEffectAt(command.effect, command.repetitions, command.delayMs, command.flags, startUs);
+        break;
+    }
+
+    case TOPIC_ID_LIGHT_QUEUE:
+    {
+        EffectCommand command;
+        parseEffectCommand(payload, len, command);
+        if (!queueEffect(command.effect, command.repetitions, command.delayMs, command.flags))
+        {
+            Serial.println(F("Playlist full"));
+        }
+        break;
+    }
+
+    case TOPIC_ID_LIGHT_QUEUE_CLEAR:
+        clearPlaylist();
+        break;
+
+    case TOPIC_ID_LIGHT_QUEUE_LOOP:
+        setPlaylistLoop(strcmp(payload, STATE_ON) == 0);
+        break;
+
+    case TOPIC_ID_SYNC_REQUEST:
+        handleSyncRequest(payload);
+        break;
+
+    case TOPIC_ID_SYNC_RESPONSE:
+        handleSyncResponse(payload);
+        break;
+
+    case TOPIC_ID_LIGHT_PROGRAM:
+        handleProgram(payload);
+        break;
+
+    case TOPIC_ID_CONFIG:
+        updateConfig(payload);
+        break;
+    }
+}
@@ -0,0 +1,28 @@
+#ifndef COMMAND_HPP
+#define COMMAND_HPP
+
+#include <stddef.h>
+#include "topicrouter.h"
+
+// Handlers of the topics in the route table of command.cpp
+enum TopicId
+{
+    TOPIC_ID_LIGHT_COMMAND,
+    TOPIC_ID_LIGHT_EFFECT,
+    TOPIC_ID_LIGHT_STOP,
+    TOPIC_ID_CONFIG,
+    TOPIC_ID_LIGHT_PROGRAM,
+    TOPIC_ID_LIGHT_QUEUE,
+    TOPIC_ID_LIGHT_QUEUE_CLEAR,
+    TOPIC_ID_LIGHT_QUEUE_LOOP,
+    TOPIC_ID_SYNC_REQUEST,
+    TOPIC_ID_SYNC_RESPONSE
+};
+
+// Handle an incoming message independently of the network stack. topic is
+// below the vehicle prefix, payload must be writable and NUL-terminated at payload[len].
+void handleMessage(const char *topic, char *payload, size_t len);
+// Topics to subscribe to, with their QoS
+const TopicRoute *getCommandRoutes(size_t &count);
+
+#endif // COMMAND_HPP
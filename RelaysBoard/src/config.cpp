@@ -0,0 +1,376 @@
+#include "config.hpp"
+#include <Arduino.h>
+#include <Preferences.h>
+#include <ArduinoJson.h>
+#include "light.hpp"
+#include "mqtt.hpp"
+#include "timesync.hpp"
+#include "statepub.hpp"
+#include "hbinput.hpp"
+
+#define CONFIG_BLOB_MAX 256 // Largest blob read back, a newer firmware may have written more fields
+
+static const BoardConfig configDefaults = {
+    CONFIG_MAGIC, CONFIG_VERSION, 0, sizeof(BoardConfig), 0,
+    VEHICLE_ID,
+    CONFIG_DEFAULT_MQTT_HOST,
+    CONFIG_DEFAULT_MQTT_PORT,
+    false,
+    false,
+    WIRE_BINARY,
+    {PIN_LIGHT1, PIN_LIGHT2, PIN_LIGHT3, PIN_LIGHT4},
+    PIN_RELAY_HB,
+    PIN_HB_SIGNAL,
+    DEBOUNCE_TIME,
+    {WEAR_DEFAULT_DWELL_MS, WEAR_DEFAULT_DWELL_MS, WEAR_DEFAULT_DWELL_MS, WEAR_DEFAULT_DWELL_MS},
+    STATE_PUBLISH_DEFAULT_MS,
+    TELEMETRY_MS,
+    CONFIG_DEFAULT_EFFECT_REPETITIONS,
+    CONFIG_DEFAULT_EFFECT_DELAY_MS,
+};
+
+BoardConfig boardConfig = configDefaults;
+uint8_t hbRelayPin = PIN_RELAY_HB; // Pins of the configuration at boot, new ones wait for the next
+
+// Fletcher-16 of the fields after the header
+static uint16_t configChecksum(const uint8_t *blob, size_t size)
+{
+    uint16_t sum1 = 0;
+    uint16_t sum2 = 0;
+    for (size_t i = CONFIG_HEADER_SIZE; i < size; i++)
+    {
+        sum1 = (sum1 + blob[i]) % 255;
+        sum2 = (sum2 + sum1) % 255;
+    }
+    return (uint16_t)(sum2 << 8 | sum1);
+}
+
+static bool saveConfig(BoardConfig &config)
+{
+    config.magic = CONFIG_MAGIC;
+    config.version = CONFIG_VERSION;
+    config.size = sizeof(BoardConfig);
+    config.checksum = configChecksum((const uint8_t *)&config, sizeof(BoardConfig));
+
+    // One blob, NVS keeps the previous one until the new one is completely written
+    Preferences preferences;
+    preferences.begin(CONFIG_NAMESPACE, false);
+    bool saved = preferences.putBytes("blob", &config, sizeof(config)) == sizeof(config);
+    preferences.end();
+    return saved;
+}
+
+void loadConfig()
+{
+    uint8_t blob[CONFIG_BLOB_MAX];
+    Preferences preferences;
+    preferences.begin(CONFIG_NAMESPACE, true);
+    size_t length = preferences.isKey("blob") ? preferences.getBytesLength("blob") : 0;
+    if (length > sizeof(blob) || preferences.getBytes("blob", blob, length) != length)
+    {
+        length = 0;
+    }
+    preferences.end();
+
+    BoardConfig header;
+    memcpy(&header, blob, length >= CONFIG_HEADER_SIZE ? CONFIG_HEADER_SIZE : 0);
+    if (length < CONFIG_HEADER_SIZE || header.magic != CONFIG_MAGIC || header.size != length ||
+        header.checksum != configChecksum(blob, length))
+    {
+        boardConfig = configDefaults;
+        hbRelayPin = boardConfig.hbRelayPin;
+        return;
+    }
+
+    // Fields of the stored version over the defaults, the header is the current one
+    boardConfig = configDefaults;
+    memcpy((uint8_t *)&boardConfig + CONFIG_HEADER_SIZE, blob + CONFIG_HEADER_SIZE,
+           (length < sizeof(BoardConfig) ? length : sizeof(BoardConfig)) - CONFIG_HEADER_SIZE);
+    hbRelayPin = boardConfig.hbRelayPin;
+}
+
+// Push the changed fields to the modules that keep their own copy
+static void applyConfigFields(uint32_t fields)
+{
+    if (fields & CONFIG_VEHICLE_ID)
+    {
+        setVehicleId(boardConfig.vehicleId);
+    }
+    if (fields & CONFIG_MQTT_SERVER)
+    {
+        setMqttServer(boardConfig.mqttHost, boardConfig.mqttPort);
+    }
+    if (fields & CONFIG_LEGAL_MODE)
+    {
+        digitalWrite(hbRelayPin, boardConfig.legalMode);
+    }
+    if (fields & CONFIG_SYNC_MASTER)
+    {
+        setSyncMaster(boardConfig.syncMaster);
+    }
+    if (fields & CONFIG_WIRE_BINARY)
+    {
+        setWireBinary(boardConfig.wireBinary);
+    }
+    if (fields & CONFIG_DEBOUNCE)
+    {
+        setHbDebounce(boardConfig.debounceMs);
+    }
+    if (fields & CONFIG_MIN_DWELL)
+    {
+        for (uint8_t i = 0; i < RELAY_COUNT; i++)
+        {
+            setMinDwell(i, boardConfig.minDwellMs[i]);
+        }
+    }
+    if (fields & CONFIG_STATE_INTERVAL)
+    {
+        setStatePublishInterval(boardConfig.stateIntervalMs);
+    }
+    if (fields & CONFIG_TELEMETRY)
+    {
+        setTelemetryPeriod(boardConfig.telemetryMs);
+    }
+}
+
+void applyConfig()
+{
+    // The pins, the broker, the vehicle and the sync role were read by their init
+    uint32_t fields = CONFIG_MIN_DWELL | CONFIG_STATE_INTERVAL;
+    if (boardConfig.legalMode)
+    {
+        fields |= CONFIG_LEGAL_MODE;
+    }
+    applyConfigFields(fields);
+}
+
+// A GPIO of the allowed set, as a bit mask of pin numbers, or the one pin already
+// has: the board may be wired to a pin the set leaves out, like the default GPIO2
+static bool checkPin(JsonVariant value, uint64_t allowed, uint8_t &pin)
+{
+    int gpio = value.as<int>();
+    if (!value.is<int>() || (gpio != pin && (gpio < 0 || gpio >= 64 || !(allowed >> gpio & 1))))
+    {
+        return false;
+    }
+    pin = value.as<uint8_t>();
+    return true;
+}
+
+// An integer within [min, max]
+static bool checkRange(JsonVariant value, long min, long max, long &number)
+{
+    if (!value.is<long>() || value.as<long>() < min || value.as<long>() > max)
+    {
+        return false;
+    }
+    number = value.as<long>();
+    return true;
+}
+
+static bool parseIp(const char *text, uint32_t &ip)
+{
+    unsigned a, b, c, d;
+    char end;
+    if (text == NULL || sscanf(text, "%u.%u.%u.%u%c", &a, &b, &c, &d, &end) != 4 || a > 255 || b > 255 || c > 255 || d > 255)
+    {
+        return false;
+    }
+    ip = a | b << 8 | c << 16 | (uint32_t)d << 24;
+    return true;
+}
+
+// Mark a field changed when the update differs from the current value
+template <typename T>
+static void setField(T &field, const T &value, uint32_t mask, uint32_t &changed)
+{
+    if (memcmp(&field, &value, sizeof(T)) != 0)
+    {
+        memcpy(&field, &value, sizeof(T));
+        changed |= mask;
+    }
+}
+
+bool updateConfig(const char *payload)
+{
+    JsonDocument doc;
+    DeserializationError error = deserializeJson(doc, payload);
+    if (error)
+    {
+        Serial.print(F("deserializeJson() failed: "));
+        Serial.println(error.f_str());
+        return false;
+    }
+
+    // Every key into a copy, one bad value rejects the whole message
+    BoardConfig next = boardConfig;
+    uint32_t changed = 0;
+    bool valid = true;
+
+    if (!doc["VEHICLE_ID"].isNull())
+    {
+        const char *id = doc["VEHICLE_ID"] | "";
+        char vehicleId[TOPIC_PREFIX_SIZE] = {};
+        valid &= doc["VEHICLE_ID"].is<const char *>() && topicVehicleIdValid(id);
+        strncpy(vehicleId, id, sizeof(vehicleId) - 1);
+        setField(next.vehicleId, vehicleId, CONFIG_VEHICLE_ID, changed);
+    }
+    if (!doc["MQTT_HOST"].isNull())
+    {
+        uint32_t host = 0;
+        valid &= parseIp(doc["MQTT_HOST"].as<const char *>(), host);
+        setField(next.mqttHost, host, CONFIG_MQTT_SERVER, changed);
+    }
+    if (!doc["MQTT_PORT"].isNull())
+    {
+        valid &= doc["MQTT_PORT"].as<uint16_t>() != 0;
+        setField(next.mqttPort, doc["MQTT_PORT"].as<uint16_t>(), CONFIG_MQTT_SERVER, changed);
+    }
+    if (!doc["LEGAL_MODE"].isNull())
+    {
+        setField(next.legalMode, doc["LEGAL_MODE"].as<bool>(), CONFIG_LEGAL_MODE, changed);
+    }
+    if (!doc["SYNC_MASTER"].isNull())
+    {
+        setField(next.syncMaster, doc["SYNC_MASTER"].as<bool>(), CONFIG_SYNC_MASTER, changed);
+    }
+    if (!doc["WIRE_BINARY"].isNull())
+    {
+        setField(next.wireBinary, doc["WIRE_BINARY"].as<bool>(), CONFIG_WIRE_BINARY, changed);
+    }
+    // The pins an update leaves out keep theirs, all of them must differ
+    uint8_t relayPins[RELAY_COUNT];
+    memcpy(relayPins, next.relayPins, sizeof(relayPins));
+    uint8_t hbRelay = next.hbRelayPin;
+    uint8_t hbSignal = next.hbSignalPin;
+    if (!doc["PINS"].isNull())
+    {
+        JsonVariant pins = doc["PINS"];
+        valid &= pins.is<JsonArray>() && pins.size() == RELAY_COUNT;
+        for (uint8_t i = 0; i < RELAY_COUNT && valid; i++)
+        {
+            valid &= checkPin(pins[i], CONFIG_IO_PINS, relayPins[i]);
+        }
+    }
+    if (!doc["HB_RELAY_PIN"].isNull())
+    {
+        valid &= checkPin(doc["HB_RELAY_PIN"], CONFIG_HB_RELAY_PINS, hbRelay);
+    }
+    if (!doc["HB_SIGNAL_PIN"].isNull())
+    {
+        valid &= checkPin(doc["HB_SIGNAL_PIN"], CONFIG_IO_PINS, hbSignal);
+    }
+    uint64_t usedPins = 1ULL << hbRelay;
+    valid &= !(usedPins >> hbSignal & 1);
+    usedPins |= 1ULL << hbSignal;
+    for (uint8_t i = 0; i < RELAY_COUNT; i++)
+    {
+        valid &= !(usedPins >> relayPins[i] & 1);
+        usedPins |= 1ULL << relayPins[i];
+    }
+    if (valid)
+    {
+        setField(next.relayPins, relayPins, CONFIG_PINS, changed);
+        setField(next.hbRelayPin, hbRelay, CONFIG_PINS, changed);
+        setField(next.hbSignalPin, hbSignal, CONFIG_PINS, changed);
+    }
+
+    long number = 0;
+    if (!doc["DEBOUNCE_MS"].isNull())
+    {
+        if (checkRange(doc["DEBOUNCE_MS"], 0, CONFIG_MAX_DEBOUNCE_MS, number))
+        {
+            setField(next.debounceMs, (uint16_t)number, CONFIG_DEBOUNCE, changed);
+        }
+        else
+        {
+            valid = false;
+        }
+    }
+    // Minimum relay dwell, one value for all channels or an array of one per channel
+    if (!doc["MIN_DWELL_MS"].isNull())
+    {
+        JsonVariant dwell = doc["MIN_DWELL_MS"];
+        bool perChannel = dwell.is<JsonArray>();
+        uint16_t dwellMs[RELAY_COUNT];
+        valid &= !perChannel || dwell.size() == RELAY_COUNT;
+        for (uint8_t i = 0; i < RELAY_COUNT && valid; i++)
+        {
+            valid &= checkRange(perChannel ? dwell[i] : dwell, 0, CONFIG_MAX_DWELL_MS, number);
+            dwellMs[i] = (uint16_t)number;
+        }
+        if (valid)
+        {
+            setField(next.minDwellMs, dwellMs, CONFIG_MIN_DWELL, changed);
+        }
+    }
+    if (!doc["STATE_INTERVAL_MS"].isNull())
+    {
+        if (checkRange(doc["STATE_INTERVAL_MS"], 0, CONFIG_MAX_STATE_INTERVAL_MS, number))
+        {
+            setField(next.stateIntervalMs, (uint16_t)number, CONFIG_STATE_INTERVAL, changed);
+        }
+        else
+        {
+            valid = false;
+        }
+    }
+    if (!doc["TELEMETRY_MS"].isNull())
+    {
+        if (checkRange(doc["TELEMETRY_MS"], 0, CONFIG_MAX_TELEMETRY_MS, number) && (number == 0 || number >= CONFIG_MIN_TELEMETRY_MS))
+        {
+            setField(next.telemetryMs, (uint32_t)number, CONFIG_TELEMETRY, changed);
+        }
+        else
+        {
+            valid = false;
+        }
+    }
+    // The default of a light/effect without repetitions is a finite count
+    if (!doc["EFFECT_REPETITIONS"].isNull())
+    {
+        if (checkRange(doc["EFFECT_REPETITIONS"], 1, CONFIG_MAX_EFFECT_REPETITIONS, number))
+        {
+            setField(next.effectRepetitions, (int16_t)number, CONFIG_EFFECT_DEFAULTS, changed);
+        }
+        else
+        {
+            valid = false;
+        }
+    }
+    if (!doc["EFFECT_DELAY_MS"].isNull())
+    {
+        if (checkRange(doc["EFFECT_DELAY_MS"], EFFECT_MIN_DELAY_MS, CONFIG_MAX_EFFECT_DELAY_MS, number))
+        {
+            setField(next.effectDelayMs, (uint16_t)number, CONFIG_EFFECT_DEFAULTS, changed);
+        }
+        else
+        {
+            valid = false;
+        }
+    }
+
+    if (!valid)
+    {
+        Serial.println(F("Rejected configuration"));
+        return false;
+    }
+    if (changed == 0)
+    {
+        return true;
+    }
+
+    // Saved before it is applied, a reset in between boots with the new settings
+    if (!saveConfig(next))
+    {
+        Serial.println(F("Configuration not saved"));
+        return false;
+    }
+    boardConfig = next;
+    applyConfigFields(changed);
+    if (changed & CONFIG_PINS)
+    {
+        Serial.println(F("New pins are used from the next boot"));
+    }
+    return true;
+}
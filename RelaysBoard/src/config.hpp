@@ -0,0 +1,93 @@
+#ifndef CONFIG_HPP
+#define CONFIG_HPP
+
+#include <stdint.h>
+#include "topicrouter.h"
+#include "wear.hpp"
+
+// Settings of the board, one blob in NVS loaded at boot into boardConfig, so the
+// code reads plain fields and JSON is only parsed when the config topic changes them.
+// A message on config carries the keys to change, the others keep their value:
+//   {"LEGAL_MODE":true,"MIN_DWELL_MS":[100,100,150,150],"MQTT_HOST":"192.168.2.1"}
+// Later versions only append fields, a blob of an older version keeps the
+// defaults for the fields it does not have.
+#define CONFIG_NAMESPACE "config"
+#define CONFIG_MAGIC 0x4346u // "CF"
+#define CONFIG_VERSION 1
+#define CONFIG_HEADER_SIZE 8
+
+#define CONFIG_DEFAULT_MQTT_HOST 0x0102A8C0u // 192.168.2.1, first octet in the low byte like IPAddress
+#define CONFIG_DEFAULT_MQTT_PORT 1883
+#define CONFIG_DEFAULT_EFFECT_REPETITIONS 1 // Fields a text light/effect leaves out
+#define CONFIG_DEFAULT_EFFECT_DELAY_MS 200
+
+// GPIO the relays and the signal can use through the 32-bit GPIO registers: not
+// the strapping pins 0, 2 and 12 (a relay driving one at reset can stop the boot,
+// 12 sets the flash voltage), the flash (6-11), the console UART (1, 3), the
+// missing 20, 24 and 28-31, nor the input-only 34-39
+#define CONFIG_IO_PINS 0x0EEFE030ULL
+#define CONFIG_HB_RELAY_PINS (CONFIG_IO_PINS | 3ULL << 32) // digitalWrite() also reaches GPIO32 and 33
+
+// Accepted ranges of the other numbers, a message with one outside is rejected
+#define CONFIG_MAX_DEBOUNCE_MS 500
+#define CONFIG_MAX_DWELL_MS 10000
+#define CONFIG_MAX_STATE_INTERVAL_MS 10000
+#define CONFIG_MIN_TELEMETRY_MS 1000 // Or 0 to disable it
+#define CONFIG_MAX_TELEMETRY_MS 86400000L
+#define CONFIG_MAX_EFFECT_REPETITIONS 10000
+#define CONFIG_MAX_EFFECT_DELAY_MS 60000
+
+struct BoardConfig
+{
+    uint16_t magic;
+    uint8_t version;
+    uint8_t reserved;
+    uint16_t size;     // sizeof(BoardConfig) of the version that wrote it
+    uint16_t checksum; // Of the size - CONFIG_HEADER_SIZE bytes after the header
+
+    // Version 1
+    char vehicleId[TOPIC_PREFIX_SIZE]; // Topics are "veh/<id>/..." unless empty
+    uint32_t mqttHost;                 // Broker IPv4 address
+    uint16_t mqttPort;
+    bool legalMode;                    // High beam relay held off
+    bool syncMaster;                   // Answers the time sync requests of the other boards
+    bool wireBinary;                   // light/state as lightwire.h, text otherwise
+    uint8_t relayPins[RELAY_COUNT];    // CONFIG_IO_PINS, applied at the next boot
+    uint8_t hbRelayPin;                // CONFIG_HB_RELAY_PINS, applied at the next boot
+    uint8_t hbSignalPin;               // CONFIG_IO_PINS, applied at the next boot
+    uint16_t debounceMs;               // High beam signal debounce
+    uint16_t minDwellMs[RELAY_COUNT];  // Shortest time a relay holds a state
+    uint16_t stateIntervalMs;          // Shortest time between two light/state
+    uint32_t telemetryMs;              // Telemetry period, 0 disables it
+    int16_t effectRepetitions;         // Defaults of a light/effect without them
+    uint16_t effectDelayMs;
+};
+
+// Fields an update changed, to apply only those
+enum ConfigField
+{
+    CONFIG_VEHICLE_ID = 1 << 0,
+    CONFIG_MQTT_SERVER = 1 << 1,
+    CONFIG_LEGAL_MODE = 1 << 2,
+    CONFIG_SYNC_MASTER = 1 << 3,
+    CONFIG_WIRE_BINARY = 1 << 4,
+    CONFIG_PINS = 1 << 5,
+    CONFIG_DEBOUNCE = 1 << 6,
+    CONFIG_MIN_DWELL = 1 << 7,
+    CONFIG_STATE_INTERVAL = 1 << 8,
+    CONFIG_TELEMETRY = 1 << 9,
+    CONFIG_EFFECT_DEFAULTS = 1 << 10
+};
+
+// Read only outside config.cpp
+extern BoardConfig boardConfig;
+
+// Load the settings from NVS, first thing at boot, before anything reads boardConfig
+void loadConfig();
+// Hand the settings the modules keep themselves to them, once they are initialised
+void applyConfig();
+// Apply a JSON message of the config topic: every key is checked first, then the
+// changed fields are saved in one NVS write and applied. False if nothing was taken.
+bool updateConfig(const char *payload);
+
+#endif // CONFIG_HPP
@@ -0,0 +1,67 @@
+#include "espnow.hpp"
+#include <Arduino.h>
+#include "espnowradio.h"
+#include "command.hpp"
+#include "credentials.h"
+#include "mqtt.hpp"
+#include "fastwifi.hpp"
+
+#ifndef ESPNOW_KEY
+#define ESPNOW_KEY "" // Shared with the displays, set it in credentials.h
+#endif
+
+static SemaphoreHandle_t deliverMutex = NULL; // One message at a time through handleMessage()
+
+LinkDedup linkDedup;
+
+static void onEspNowMessage(const char *topic, char *payload, size_t length)
+{
+    deliverLinkMessage(LINK_PATH_ESPNOW, topic, payload, length);
+}
+
+void initEspNow()
+{
+    deliverMutex = xSemaphoreCreateMutex();
+    espNowStart(ESPNOW_KEY, WIFI_CHANNEL, onEspNowMessage, NULL);
+}
+
+void setEspNowVehicle(const char *vehicleId)
+{
+    espNowSetVehicle(vehicleId);
+}
+
+bool sendEspNow(const char *topic, const char *payload, size_t length)
+{
+    return espNowSend(topic, payload, length);
+}
+
+void deliverLinkMessage(uint8_t path, const char *topic, char *payload, size_t len)
+{
+    if (deliverMutex == NULL)
+    {
+        handleMessage(topic, payload, len);
+        return;
+    }
+
+    xSemaphoreTake(deliverMutex, portMAX_DELAY);
+    if (linkDedupAccept(linkDedup, espNowLinkDigest(topic, payload, len), path, millis()))
+    {
+        handleMessage(topic, payload, len);
+        // Time to the first command, the time sync traffic of other boards does not count
+        if (strncmp(topic, "light/sync", 10) != 0)
+        {
+            noteBootMilestone(BOOT_FIRST_COMMAND);
+        }
+    }
+    xSemaphoreGive(deliverMutex);
+}
+
+void getEspNowStats(EspNowStats &stats)
+{
+    const EspNowRadio &radio = espNowRadio();
+    stats.received = radio.received;
+    stats.sent = radio.sent;
+    stats.suppressed = linkDedup.suppressed;
+    stats.rejected = radio.rejected;
+    stats.peers = espNowLivePeers();
+}
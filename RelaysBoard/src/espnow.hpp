@@ -0,0 +1,32 @@
+#ifndef ESPNOW_HPP
+#define ESPNOW_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include "espnowlink.h"
+
+// Direct link to the CYD displays of the vehicle, see espnowlink.h and
+// espnowradio.h. Commands still run while WiFi is still connecting and no
+// broker is reachable.
+
+struct EspNowStats
+{
+    uint32_t received;   // Messages handled from the link
+    uint32_t sent;       // Frames handed to the radio
+    uint32_t suppressed; // Second copies of a message dropped
+    uint32_t rejected;   // Frames without the key, or of a topic the link does not carry
+    uint8_t peers;       // Displays heard within ESPNOW_LINK_PEER_TIMEOUT_MS
+};
+
+// Start ESP-NOW on the WiFi channel and its task, WiFi must be in STA mode
+void initEspNow();
+// Announce and accept this vehicle id from now on ("" for none)
+void setEspNowVehicle(const char *vehicleId);
+// Send a message to every live display, false if none is paired
+bool sendEspNow(const char *topic, const char *payload, size_t length);
+// Hand a complete message to handleMessage() unless the other path already
+// delivered it. Both paths go through here, one message at a time.
+void deliverLinkMessage(uint8_t path, const char *topic, char *payload, size_t len);
+void getEspNowStats(EspNowStats &stats);
+
+#endif // ESPNOW_HPP
@@ -0,0 +1,223 @@
+#ifndef ESPNOWLINK_H
+#define ESPNOWLINK_H
+
+// Direct ESP-NOW link between the CYD and the RelaysBoard, shared by both firmwares
+// (keep both copies identical). A frame carries one message of the MQTT topics, so
+// the handlers do not care which path delivered it:
+//   0  ESPNOW_LINK_MAGIC
+//   1  version, later versions only append fields
+//   2  EspNowLinkType
+//   3  topic length n
+//   4  topic below the vehicle prefix (n bytes), then the payload
+//   .. ESPNOW_LINK_TAG_SIZE bytes of tag, see espnowradio.h
+// A hello carries the vehicle id in place of the topic and no payload. Both boards
+// broadcast one every ESPNOW_LINK_HELLO_MS and only talk to peers of their vehicle.
+// Only the light topics of espNowLinkTopicAllowed() go over the link, the
+// settings and the effect programs only come through the broker.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define ESPNOW_LINK_MAGIC 0x5A
+#define ESPNOW_LINK_VERSION 2               // 2 added the tag
+#define ESPNOW_LINK_HEADER_SIZE 4
+#define ESPNOW_LINK_TAG_SIZE 8
+#define ESPNOW_LINK_FRAME_SIZE 250          // ESP_NOW_MAX_DATA_LEN
+#define ESPNOW_LINK_TOPIC_SIZE 64
+#define ESPNOW_LINK_MAX_PEERS 4
+#define ESPNOW_LINK_HELLO_MS 1000           // Hello broadcast period
+#define ESPNOW_LINK_PEER_TIMEOUT_MS 3500    // A peer is gone after this long without a frame
+#define ESPNOW_LINK_DEDUP_SIZE 8            // Messages remembered to drop their second copy...
+#define ESPNOW_LINK_DEDUP_WINDOW_MS 2000    // ...for this long
+
+enum EspNowLinkType
+{
+    ESPNOW_LINK_HELLO = 1,  // Vehicle id of the sender
+    ESPNOW_LINK_MESSAGE = 2 // Topic and payload
+};
+
+// Path a message arrived on
+enum LinkPath
+{
+    LINK_PATH_MQTT,
+    LINK_PATH_ESPNOW
+};
+
+struct EspNowPeer
+{
+    uint8_t mac[6];
+    unsigned long lastMs; // millis() of its last frame
+    bool used;
+};
+
+struct LinkDedupEntry
+{
+    uint32_t digest;
+    unsigned long timeMs;
+    uint8_t path;
+    bool used;
+};
+
+// Messages recently delivered by one path, waiting for their copy on the other
+struct LinkDedup
+{
+    LinkDedupEntry entries[ESPNOW_LINK_DEDUP_SIZE];
+    uint8_t next;        // Entry to overwrite when all are taken
+    uint32_t suppressed; // Copies dropped
+};
+
+// Topics the link carries
+inline bool espNowLinkTopicAllowed(const char *topic)
+{
+    static const char *const topics[] = {"light/state", "light/command", "light/effect", "light/stop"};
+    for (const char *allowed : topics)
+    {
+        if (strcmp(topic, allowed) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns the frame length without its tag, 0 if the message does not fit in a
+// frame. The tag goes at the returned offset.
+inline size_t espNowLinkEncode(uint8_t *frame, uint8_t type, const char *topic, const char *payload, size_t length)
+{
+    size_t topicLength = strlen(topic);
+    if (topicLength >= ESPNOW_LINK_TOPIC_SIZE ||
+        ESPNOW_LINK_HEADER_SIZE + topicLength + length + ESPNOW_LINK_TAG_SIZE > ESPNOW_LINK_FRAME_SIZE)
+    {
+        return 0;
+    }
+    frame[0] = ESPNOW_LINK_MAGIC;
+    frame[1] = ESPNOW_LINK_VERSION;
+    frame[2] = type;
+    frame[3] = (uint8_t)topicLength;
+    memcpy(frame + ESPNOW_LINK_HEADER_SIZE, topic, topicLength);
+    if (length > 0)
+    {
+        memcpy(frame + ESPNOW_LINK_HEADER_SIZE + topicLength, payload, length);
+    }
+    return ESPNOW_LINK_HEADER_SIZE + topicLength + length;
+}
+
+// Splits a frame, length without its tag. topic gets a terminated copy (ESPNOW_LINK_TOPIC_SIZE bytes), payload points into the frame
+inline bool espNowLinkDecode(const uint8_t *frame, size_t length, uint8_t &type, char *topic,
+                             const uint8_t *&payload, size_t &payloadLength)
+{
+    if (length < ESPNOW_LINK_HEADER_SIZE || frame[0] != ESPNOW_LINK_MAGIC || frame[1] < 2)
+    {
+        return false;
+    }
+    size_t topicLength = frame[3];
+    if (topicLength >= ESPNOW_LINK_TOPIC_SIZE || ESPNOW_LINK_HEADER_SIZE + topicLength > length)
+    {
+        return false;
+    }
+    type = frame[2];
+    memcpy(topic, frame + ESPNOW_LINK_HEADER_SIZE, topicLength);
+    topic[topicLength] = '\0';
+    payload = frame + ESPNOW_LINK_HEADER_SIZE + topicLength;
+    payloadLength = length - ESPNOW_LINK_HEADER_SIZE - topicLength;
+    return true;
+}
+
+// FNV-1a of the topic and the payload
+inline uint32_t espNowLinkDigest(const char *topic, const char *payload, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for (; *topic != '\0'; topic++)
+    {
+        hash = (hash ^ (uint8_t)*topic) * 16777619u;
+    }
+    hash = (hash ^ 0xFF) * 16777619u; // Separator, "a" + "bc" is not "ab" + "c"
+    for (size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ (uint8_t)payload[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// False when the message is the copy of one the other path delivered within the
+// window, each copy cancels one entry so a command sent twice on purpose still runs twice
+inline bool linkDedupAccept(LinkDedup &dedup, uint32_t digest, uint8_t path, unsigned long nowMs)
+{
+    for (uint8_t i = 0; i < ESPNOW_LINK_DEDUP_SIZE; i++)
+    {
+        LinkDedupEntry &entry = dedup.entries[i];
+        if (entry.used && nowMs - entry.timeMs >= ESPNOW_LINK_DEDUP_WINDOW_MS)
+        {
+            entry.used = false;
+        }
+        if (entry.used && entry.digest == digest && entry.path != path)
+        {
+            entry.used = false;
+            dedup.suppressed++;
+            return false;
+        }
+    }
+
+    // Remember it for the other path, in a free entry or over the oldest
+    uint8_t slot = dedup.next;
+    for (uint8_t i = 0; i < ESPNOW_LINK_DEDUP_SIZE; i++)
+    {
+        if (!dedup.entries[i].used)
+        {
+            slot = i;
+            break;
+        }
+    }
+    dedup.entries[slot] = {digest, nowMs, path, true};
+    dedup.next = (slot + 1) % ESPNOW_LINK_DEDUP_SIZE;
+    return true;
+}
+
+inline bool espNowPeerAlive(const EspNowPeer &peer, unsigned long nowMs)
+{
+    return peer.used && nowMs - peer.lastMs < ESPNOW_LINK_PEER_TIMEOUT_MS;
+}
+
+// Refresh a peer that sent a hello of our vehicle, returns it or NULL when the table
+// is full of live peers. isNew tells the caller to register it with esp_now_add_peer().
+inline EspNowPeer *espNowPeerSeen(EspNowPeer *peers, const uint8_t *mac, unsigned long nowMs, bool &isNew)
+{
+    EspNowPeer *free = NULL;
+    isNew = false;
+    for (uint8_t i = 0; i < ESPNOW_LINK_MAX_PEERS; i++)
+    {
+        if (peers[i].used && memcmp(peers[i].mac, mac, 6) == 0)
+        {
+            peers[i].lastMs = nowMs;
+            return &peers[i];
+        }
+        if (!espNowPeerAlive(peers[i], nowMs) && free == NULL)
+        {
+            free = &peers[i];
+        }
+    }
+    if (free != NULL)
+    {
+        memcpy(free->mac, mac, 6);
+        free->lastMs = nowMs;
+        free->used = true;
+        isNew = true;
+    }
+    return free;
+}
+
+// A known peer, NULL for unpaired senders
+inline EspNowPeer *espNowPeerFind(EspNowPeer *peers, const uint8_t *mac)
+{
+    for (uint8_t i = 0; i < ESPNOW_LINK_MAX_PEERS; i++)
+    {
+        if (peers[i].used && memcmp(peers[i].mac, mac, 6) == 0)
+        {
+            return &peers[i];
+        }
+    }
+    return NULL;
+}
+
+#endif // ESPNOWLINK_H
@@ -0,0 +1,340 @@
+#ifndef ESPNOWRADIO_H
+#define ESPNOWRADIO_H
+
+// Radio side of the ESP-NOW link of espnowlink.h, shared by the RelaysBoard and
+// the CYD (keep both copies identical). ESP32 only. The boards of a vehicle hold
+// the same ESPNOW_KEY (credentials.h), without one the link stays off:
+// - every frame ends with a tag, HMAC-SHA256 of the sender MAC and the frame,
+//   only a board holding the key pairs or gets its messages handled
+// - ESP-NOW encrypts the frames to a peer, the PMK and the LMK come from the key
+// The WiFi task only queues the frames, a task of their own handles them so the
+// messages still arrive while WiFi is connecting and no broker is reachable.
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <esp_now.h>
+#include <esp_wifi.h>
+#include <mbedtls/md.h>
+#include "espnowlink.h"
+
+#define ESPNOW_TASK_CORE 0
+#define ESPNOW_TASK_PRIORITY 5
+#define ESPNOW_TASK_STACK 4096
+#define ESPNOW_QUEUE_LENGTH 4 // Frames waiting for the task
+#define ESPNOW_HMAC_SIZE 32   // SHA-256, the tag is its first ESPNOW_LINK_TAG_SIZE bytes
+
+// Message of a paired peer on a topic the link carries, payload is writable and terminated
+typedef void (*EspNowMessageHandler)(const char *topic, char *payload, size_t length);
+// After each frame and at least once per hello period, in the link task
+typedef void (*EspNowTick)();
+
+static const uint8_t espNowBroadcastMac[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+struct EspNowFrame
+{
+    uint8_t mac[6];
+    uint8_t length;
+    uint8_t data[ESPNOW_LINK_FRAME_SIZE];
+};
+
+struct EspNowRadio
+{
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED; // Guards peers and vehicle
+    QueueHandle_t queue;
+    EspNowMessageHandler onMessage;
+    EspNowTick onTick;
+    EspNowPeer peers[ESPNOW_LINK_MAX_PEERS];
+    char vehicle[ESPNOW_LINK_TOPIC_SIZE];
+    uint8_t tagKey[ESPNOW_HMAC_SIZE];
+    uint8_t lmk[ESPNOW_HMAC_SIZE]; // First ESP_NOW_KEY_LEN bytes used
+    uint8_t mac[6];                // Own station MAC, part of the tags sent
+    uint32_t received;             // Messages handed to onMessage
+    uint32_t sent;                 // Frames handed to the radio
+    uint32_t rejected;             // Frames with a wrong tag, or of a topic the link does not carry
+};
+
+inline EspNowRadio &espNowRadio()
+{
+    static EspNowRadio radio; // Zeroed but for the lock
+    return radio;
+}
+
+// HMAC-SHA256 of mac (may be NULL) followed by data
+inline void espNowHmac(const uint8_t *key, size_t keyLength, const uint8_t *mac, const uint8_t *data, size_t length,
+                       uint8_t *out)
+{
+    mbedtls_md_context_t context;
+    mbedtls_md_init(&context);
+    mbedtls_md_setup(&context, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1);
+    mbedtls_md_hmac_starts(&context, key, keyLength);
+    if (mac != NULL)
+    {
+        mbedtls_md_hmac_update(&context, mac, 6);
+    }
+    mbedtls_md_hmac_update(&context, data, length);
+    mbedtls_md_hmac_finish(&context, out);
+    mbedtls_md_free(&context);
+}
+
+// Tag of a frame sent by mac
+inline void espNowTag(const uint8_t *mac, const uint8_t *frame, size_t length, uint8_t *tag)
+{
+    uint8_t hmac[ESPNOW_HMAC_SIZE];
+    espNowHmac(espNowRadio().tagKey, sizeof(espNowRadio().tagKey), mac, frame, length, hmac);
+    memcpy(tag, hmac, ESPNOW_LINK_TAG_SIZE);
+}
+
+// The tag ending a frame of length bytes, compared in constant time
+inline bool espNowTagValid(const uint8_t *mac, const uint8_t *frame, size_t length)
+{
+    uint8_t tag[ESPNOW_LINK_TAG_SIZE];
+    espNowTag(mac, frame, length, tag);
+    uint8_t difference = 0;
+    for (uint8_t i = 0; i < ESPNOW_LINK_TAG_SIZE; i++)
+    {
+        difference |= tag[i] ^ frame[length + i];
+    }
+    return difference == 0;
+}
+
+// Runs in the WiFi task, only queue the frame
+inline void espNowReceive(const uint8_t *mac, const uint8_t *data, int length)
+{
+    if (length <= 0 || length > ESPNOW_LINK_FRAME_SIZE)
+    {
+        return;
+    }
+    EspNowFrame frame;
+    memcpy(frame.mac, mac, 6);
+    frame.length = (uint8_t)length;
+    memcpy(frame.data, data, length);
+    xQueueSend(espNowRadio().queue, &frame, 0); // Dropped when the task is behind
+}
+
+// Unicast peers are encrypted, the broadcast one cannot be
+inline void espNowAddPeer(const uint8_t *mac, bool encrypt)
+{
+    if (esp_now_is_peer_exist(mac))
+    {
+        return;
+    }
+    esp_now_peer_info_t peer = {};
+    memcpy(peer.peer_addr, mac, 6);
+    peer.channel = 0; // The current WiFi channel
+    peer.ifidx = WIFI_IF_STA;
+    peer.encrypt = encrypt;
+    memcpy(peer.lmk, espNowRadio().lmk, ESP_NOW_KEY_LEN);
+    esp_now_add_peer(&peer);
+}
+
+// Frame with its tag, 0 if the message does not fit
+inline size_t espNowFrame(uint8_t *frame, uint8_t type, const char *topic, const char *payload, size_t length)
+{
+    size_t frameLength = espNowLinkEncode(frame, type, topic, payload, length);
+    if (frameLength == 0)
+    {
+        return 0;
+    }
+    espNowTag(espNowRadio().mac, frame, frameLength, frame + frameLength);
+    return frameLength + ESPNOW_LINK_TAG_SIZE;
+}
+
+inline void espNowSendHello()
+{
+    EspNowRadio &radio = espNowRadio();
+    char vehicle[ESPNOW_LINK_TOPIC_SIZE];
+    portENTER_CRITICAL(&radio.mux);
+    memcpy(vehicle, radio.vehicle, sizeof(vehicle));
+    portEXIT_CRITICAL(&radio.mux);
+
+    uint8_t frame[ESPNOW_LINK_FRAME_SIZE];
+    size_t length = espNowFrame(frame, ESPNOW_LINK_HELLO, vehicle, NULL, 0);
+    esp_now_send(espNowBroadcastMac, frame, length);
+}
+
+inline void espNowHandleFrame(EspNowFrame &frame)
+{
+    EspNowRadio &radio = espNowRadio();
+    uint8_t type;
+    char topic[ESPNOW_LINK_TOPIC_SIZE];
+    const uint8_t *payload;
+    size_t length;
+    size_t frameLength = frame.length > ESPNOW_LINK_TAG_SIZE ? frame.length - ESPNOW_LINK_TAG_SIZE : 0;
+    if (frameLength == 0 || !espNowTagValid(frame.mac, frame.data, frameLength))
+    {
+        radio.rejected++;
+        return;
+    }
+    if (!espNowLinkDecode(frame.data, frameLength, type, topic, payload, length))
+    {
+        return;
+    }
+
+    if (type == ESPNOW_LINK_HELLO)
+    {
+        bool isNew = false;
+        portENTER_CRITICAL(&radio.mux);
+        if (strcmp(topic, radio.vehicle) == 0)
+        {
+            espNowPeerSeen(radio.peers, frame.mac, millis(), isNew);
+        }
+        portEXIT_CRITICAL(&radio.mux);
+        if (isNew)
+        {
+            espNowAddPeer(frame.mac, true);
+        }
+        return;
+    }
+
+    // Only the boards of this vehicle, and only on the light topics
+    portENTER_CRITICAL(&radio.mux);
+    EspNowPeer *peer = espNowPeerFind(radio.peers, frame.mac);
+    if (peer != NULL)
+    {
+        peer->lastMs = millis();
+    }
+    portEXIT_CRITICAL(&radio.mux);
+    if (type != ESPNOW_LINK_MESSAGE || peer == NULL)
+    {
+        return;
+    }
+    if (!espNowLinkTopicAllowed(topic))
+    {
+        radio.rejected++;
+        return;
+    }
+
+    // The handlers want a writable, terminated payload
+    char message[ESPNOW_LINK_FRAME_SIZE + 1];
+    memcpy(message, payload, length);
+    message[length] = '\0';
+    radio.received++;
+    radio.onMessage(topic, message, length);
+}
+
+inline void espNowTaskMain(void *arg)
+{
+    EspNowRadio &radio = espNowRadio();
+    unsigned long lastHelloMs = 0;
+    for (;;)
+    {
+        EspNowFrame frame;
+        if (xQueueReceive(radio.queue, &frame, pdMS_TO_TICKS(ESPNOW_LINK_HELLO_MS)) == pdTRUE)
+        {
+            espNowHandleFrame(frame);
+        }
+        if (millis() - lastHelloMs >= ESPNOW_LINK_HELLO_MS)
+        {
+            lastHelloMs = millis();
+            espNowSendHello();
+        }
+        if (radio.onTick != NULL)
+        {
+            radio.onTick();
+        }
+    }
+}
+
+// Start ESP-NOW on channel and its task, WiFi must be in STA mode. key is
+// ESPNOW_KEY, NULL or "" leaves the link off. onTick may be NULL.
+inline bool espNowStart(const char *key, uint8_t channel, EspNowMessageHandler onMessage, EspNowTick onTick)
+{
+    EspNowRadio &radio = espNowRadio();
+    if (key == NULL || key[0] == '\0')
+    {
+        Serial.println("ESPNOW_KEY not set, direct link off");
+        return false;
+    }
+
+    // One key per use, derived from the shared one
+    uint8_t pmk[ESPNOW_HMAC_SIZE];
+    espNowHmac((const uint8_t *)key, strlen(key), NULL, (const uint8_t *)"tag", 3, radio.tagKey);
+    espNowHmac((const uint8_t *)key, strlen(key), NULL, (const uint8_t *)"pmk", 3, pmk);
+    espNowHmac((const uint8_t *)key, strlen(key), NULL, (const uint8_t *)"lmk", 3, radio.lmk);
+    esp_wifi_get_mac(WIFI_IF_STA, radio.mac);
+    radio.onMessage = onMessage;
+    radio.onTick = onTick;
+    radio.queue = xQueueCreate(ESPNOW_QUEUE_LENGTH, sizeof(EspNowFrame));
+
+    // The boards sit on the same channel, even before the access point answers
+    esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE);
+    if (esp_now_init() != ESP_OK || esp_now_set_pmk(pmk) != ESP_OK)
+    {
+        Serial.println("ESP-NOW init failed");
+        return false;
+    }
+    esp_now_register_recv_cb(espNowReceive);
+    espNowAddPeer(espNowBroadcastMac, false);
+
+    xTaskCreatePinnedToCore(espNowTaskMain, "espnow", ESPNOW_TASK_STACK, NULL,
+                            ESPNOW_TASK_PRIORITY, NULL, ESPNOW_TASK_CORE);
+    return true;
+}
+
+// Announce and accept this vehicle id from now on, the peers of the old one pair again
+inline void espNowSetVehicle(const char *vehicleId)
+{
+    EspNowRadio &radio = espNowRadio();
+    portENTER_CRITICAL(&radio.mux);
+    strncpy(radio.vehicle, vehicleId, sizeof(radio.vehicle) - 1);
+    radio.vehicle[sizeof(radio.vehicle) - 1] = '\0';
+    memset(radio.peers, 0, sizeof(radio.peers));
+    portEXIT_CRITICAL(&radio.mux);
+}
+
+// Send a message to every live peer, false if none is paired or the link does not carry the topic
+inline bool espNowSend(const char *topic, const char *payload, size_t length)
+{
+    EspNowRadio &radio = espNowRadio();
+    if (radio.queue == NULL || !espNowLinkTopicAllowed(topic))
+    {
+        return false;
+    }
+    uint8_t frame[ESPNOW_LINK_FRAME_SIZE];
+    size_t frameLength = espNowFrame(frame, ESPNOW_LINK_MESSAGE, topic, payload, length);
+    if (frameLength == 0)
+    {
+        return false;
+    }
+
+    uint8_t macs[ESPNOW_LINK_MAX_PEERS][6];
+    uint8_t count = 0;
+    portENTER_CRITICAL(&radio.mux);
+    unsigned long nowMs = millis();
+    for (uint8_t i = 0; i < ESPNOW_LINK_MAX_PEERS; i++)
+    {
+        if (espNowPeerAlive(radio.peers[i], nowMs))
+        {
+            memcpy(macs[count++], radio.peers[i].mac, 6);
+        }
+    }
+    portEXIT_CRITICAL(&radio.mux);
+
+    bool sent = false;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        if (esp_now_send(macs[i], frame, frameLength) == ESP_OK)
+        {
+            radio.sent++;
+            sent = true;
+        }
+    }
+    return sent;
+}
+
+// Peers heard within ESPNOW_LINK_PEER_TIMEOUT_MS
+inline uint8_t espNowLivePeers()
+{
+    EspNowRadio &radio = espNowRadio();
+    uint8_t count = 0;
+    portENTER_CRITICAL(&radio.mux);
+    unsigned long nowMs = millis();
+    for (uint8_t i = 0; i < ESPNOW_LINK_MAX_PEERS; i++)
+    {
+        count += espNowPeerAlive(radio.peers[i], nowMs);
+    }
+    portEXIT_CRITICAL(&radio.mux);
+    return count;
+}
+
+#endif // ESPNOWRADIO_H
@@ -0,0 +1,184 @@
+#include "fastwifi.hpp"
+#include <Arduino.h>
+#include <WiFi.h>
+#include <Ticker.h>
+#include <Preferences.h>
+#include "credentials.h"
+#include "mqtt.hpp"
+
+#define WIFI_NAMESPACE "wifi"
+#define WIFI_CACHE_MAGIC 0x5743u // "WC"
+#define WIFI_CACHE_VERSION 1
+
+// Everything a connection needs besides the credentials
+struct WiFiCache
+{
+    uint16_t magic;
+    uint8_t version;
+    uint8_t channel;
+    uint8_t bssid[6];
+    uint32_t ip;
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns;
+    uint8_t checksum; // RTC memory is garbage after a power cycle
+};
+
+static portMUX_TYPE bootTimingMux = portMUX_INITIALIZER_UNLOCKED;
+RTC_NOINIT_ATTR WiFiCache rtcWiFiCache;
+WiFiCache wifiCache;
+bool wifiCacheValid = false; // Cleared when a fast connect fails, until the next full one succeeds
+bool fastAttempt = false;    // A fast connect is running
+Ticker fastTimeout;
+
+BootTiming bootTiming = {{0, 0, 0}, false, 0, 0, 0};
+bool bootTimingChanged = false;
+
+static uint8_t wifiCacheChecksum(const WiFiCache &cache)
+{
+    const uint8_t *bytes = (const uint8_t *)&cache;
+    uint8_t sum = 0x5A;
+    for (size_t i = 0; i < offsetof(WiFiCache, checksum); i++)
+    {
+        sum = (uint8_t)((sum << 1) | (sum >> 7)) ^ bytes[i];
+    }
+    return sum;
+}
+
+static bool wifiCacheCheck(const WiFiCache &cache)
+{
+    return cache.magic == WIFI_CACHE_MAGIC && cache.version == WIFI_CACHE_VERSION &&
+           cache.channel != 0 && cache.checksum == wifiCacheChecksum(cache);
+}
+
+void initFastWiFi()
+{
+    bootTiming.resetReason = (uint8_t)esp_reset_reason();
+
+    // RTC memory spares the NVS read after a warm reset
+    esp_reset_reason_t reason = esp_reset_reason();
+    if (reason != ESP_RST_POWERON && reason != ESP_RST_BROWNOUT && wifiCacheCheck(rtcWiFiCache))
+    {
+        wifiCache = rtcWiFiCache;
+        wifiCacheValid = true;
+        return;
+    }
+
+    Preferences preferences;
+    preferences.begin(WIFI_NAMESPACE, true);
+    wifiCacheValid = preferences.getBytes("cache", &wifiCache, sizeof(wifiCache)) == sizeof(wifiCache) &&
+                     wifiCacheCheck(wifiCache);
+    preferences.end();
+}
+
+// Runs in the timer task when the fast connect took too long
+static void fastConnectTimedOut()
+{
+    if (fastAttempt)
+    {
+        Serial.println("Fast WiFi connect timed out");
+        WiFi.disconnect(); // The disconnection event starts the full connect
+    }
+}
+
+void beginWiFi()
+{
+    if (WiFi.isConnected())
+    {
+        return;
+    }
+    if (wifiCacheValid)
+    {
+        fastAttempt = true;
+        WiFi.config(IPAddress(wifiCache.ip), IPAddress(wifiCache.gateway), IPAddress(wifiCache.subnet), IPAddress(wifiCache.dns));
+        WiFi.begin(WIFI_SSID, WIFI_PASSWORD, wifiCache.channel, wifiCache.bssid);
+        fastTimeout.once_ms(WIFI_FAST_TIMEOUT_MS, fastConnectTimedOut);
+        return;
+    }
+
+    // Scan the channel and ask DHCP
+    fastAttempt = false;
+    WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE);
+    WiFi.begin(WIFI_SSID, WIFI_PASSWORD, WIFI_CHANNEL);
+}
+
+void wifiConnected()
+{
+    fastTimeout.detach();
+    portENTER_CRITICAL(&bootTimingMux);
+    if (bootTiming.ms[BOOT_WIFI] == 0)
+    {
+        bootTiming.fast = fastAttempt;
+    }
+    if (fastAttempt)
+    {
+        bootTiming.fastConnects++;
+    }
+    else
+    {
+        bootTiming.fullConnects++;
+    }
+    bootTimingChanged = true;
+    portEXIT_CRITICAL(&bootTimingMux);
+    fastAttempt = false;
+
+    WiFiCache cache = {};
+    cache.magic = WIFI_CACHE_MAGIC;
+    cache.version = WIFI_CACHE_VERSION;
+    cache.channel = WiFi.channel();
+    memcpy(cache.bssid, WiFi.BSSID(), sizeof(cache.bssid));
+    cache.ip = WiFi.localIP();
+    cache.gateway = WiFi.gatewayIP();
+    cache.subnet = WiFi.subnetMask();
+    cache.dns = WiFi.dnsIP();
+    cache.checksum = wifiCacheChecksum(cache);
+    rtcWiFiCache = cache;
+
+    // The access point and the lease rarely change, NVS is only written when they do
+    bool changed = !wifiCacheValid || memcmp(&cache, &wifiCache, sizeof(cache)) != 0;
+    wifiCache = cache;
+    wifiCacheValid = true;
+    if (changed)
+    {
+        Preferences preferences;
+        preferences.begin(WIFI_NAMESPACE, false);
+        preferences.putBytes("cache", &cache, sizeof(cache));
+        preferences.end();
+    }
+}
+
+unsigned long wifiDisconnected()
+{
+    if (!fastAttempt)
+    {
+        return WIFI_RETRY_MS;
+    }
+
+    // The cached access point or address is gone, connect the slow way right away
+    fastTimeout.detach();
+    fastAttempt = false;
+    wifiCacheValid = false;
+    return 0;
+}
+
+void noteBootMilestone(BootMilestone milestone)
+{
+    uint32_t nowMs = millis();
+    portENTER_CRITICAL(&bootTimingMux);
+    if (bootTiming.ms[milestone] == 0)
+    {
+        bootTiming.ms[milestone] = nowMs != 0 ? nowMs : 1;
+        bootTimingChanged = true;
+    }
+    portEXIT_CRITICAL(&bootTimingMux);
+}
+
+bool takeBootTiming(BootTiming &timing)
+{
+    portENTER_CRITICAL(&bootTimingMux);
+    bool changed = bootTimingChanged;
+    bootTimingChanged = false;
+    timing = bootTiming;
+    portEXIT_CRITICAL(&bootTimingMux);
+    return changed;
+}
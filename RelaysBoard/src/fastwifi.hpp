@@ -0,0 +1,43 @@
+#ifndef FASTWIFI_HPP
+#define FASTWIFI_HPP
+
+#include <stdint.h>
+
+// WiFi connection without the scan and DHCP of a full connect: the BSSID, channel
+// and IP settings of the last connection are kept in RTC memory and NVS, and the
+// next connection goes straight to that access point with the same address as a
+// static IP. A full connect takes over when the fast one fails.
+#define WIFI_FAST_TIMEOUT_MS 1500 // A fast connect without an IP by then falls back to a full one
+#define WIFI_RETRY_MS 2000        // Delay before connecting again after a disconnection
+
+// Steps of the start-up, in ms since boot
+enum BootMilestone
+{
+    BOOT_WIFI,          // IP address obtained
+    BOOT_MQTT,          // Broker connected
+    BOOT_FIRST_COMMAND, // First light command handled, from either path
+    BOOT_MILESTONES
+};
+
+struct BootTiming
+{
+    uint32_t ms[BOOT_MILESTONES]; // 0 until reached
+    bool fast;                    // The first connection used the cache
+    uint8_t resetReason;          // esp_reset_reason()
+    uint16_t fastConnects;        // Connections since boot, each way
+    uint16_t fullConnects;
+};
+
+void initFastWiFi();
+// Start connecting, returns at once. The WiFi events drive the rest.
+void beginWiFi();
+// From the WiFi events: cache the connection on GOT_IP, and on a disconnection
+// get the delay before beginWiFi() should run again
+void wifiConnected();
+unsigned long wifiDisconnected();
+// Record a milestone the first time it is reached
+void noteBootMilestone(BootMilestone milestone);
+// True once per change of the timing
+bool takeBootTiming(BootTiming &timing);
+
+#endif // FASTWIFI_HPP
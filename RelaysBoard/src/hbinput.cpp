@@ -0,0 +1,158 @@
+#include "hbinput.hpp"
+#include <Arduino.h>
+#include <atomic>
+#include "light.hpp"
+#include "scheduler.hpp"
+#include "config.hpp"
+
+#define HB_EDGE_MASK (HB_EDGE_BUFFER_SIZE - 1)
+#define HB_FIRST_BUCKET_US 32
+
+// Edges are packed as the micros() timestamp with the level in bit 0 (1 = active),
+// so one 32-bit store publishes both
+uint32_t hbEdges[HB_EDGE_BUFFER_SIZE];
+std::atomic<uint32_t> hbEdgeHead(0);  // Written by the ISR only
+std::atomic<uint32_t> hbEdgeTail(0);  // Written by the effect task only
+std::atomic<uint32_t> hbLastEdge(0);  // Latest edge, even when the ring was full
+std::atomic<uint32_t> hbOverruns(0);
+
+uint32_t hbSignalMask = 0; // Bit of the signal in GPIO_IN_REG
+uint32_t hbDebounceUs = DEBOUNCE_TIME * 1000UL;
+
+// Debounce state, effect task only
+bool hbAccepted = false;
+uint32_t hbAcceptedUs = 0;
+uint32_t hbBounces = 0;
+
+static portMUX_TYPE hbLatencyMux = portMUX_INITIALIZER_UNLOCKED;
+HbLatency hbLatency;
+bool hbLatencyReady = false;
+
+static inline uint32_t packEdge(unsigned long timeUs, bool active)
+{
+    return ((uint32_t)timeUs & ~1UL) | (active ? 1 : 0);
+}
+
+void IRAM_ATTR isrHbSignalChange()
+{
+    // The input is active low, read straight from the register to stay in IRAM
+    uint32_t edge = packEdge(micros(), (GPIO_REG_READ(GPIO_IN_REG) & hbSignalMask) == 0);
+    hbLastEdge.store(edge, std::memory_order_relaxed);
+
+    uint32_t head = hbEdgeHead.load(std::memory_order_relaxed);
+    if (head - hbEdgeTail.load(std::memory_order_acquire) < HB_EDGE_BUFFER_SIZE)
+    {
+        hbEdges[head & HB_EDGE_MASK] = edge;
+        hbEdgeHead.store(head + 1, std::memory_order_release);
+    }
+    else
+    {
+        hbOverruns.fetch_add(1, std::memory_order_relaxed);
+    }
+    wakeEffectSchedulerFromISR();
+}
+
+void initHbInput()
+{
+    uint8_t pin = boardConfig.hbSignalPin;
+    hbSignalMask = 1UL << pin;
+    hbDebounceUs = boardConfig.debounceMs * 1000UL;
+    pinMode(pin, INPUT_PULLUP);
+    hbLatency = HbLatency();
+
+    // A signal already active at boot is picked up by the first takeHbEdge()
+    hbLastEdge.store(packEdge(micros(), digitalRead(pin) == LOW));
+    hbAccepted = false;
+    hbAcceptedUs = (uint32_t)micros() - hbDebounceUs;
+
+    attachInterrupt(pin, isrHbSignalChange, CHANGE);
+}
+
+void setHbDebounce(uint16_t debounceMs)
+{
+    hbDebounceUs = debounceMs * 1000UL;
+}
+
+static bool acceptEdge(uint32_t edge, bool &active, unsigned long &edgeUs)
+{
+    hbAccepted = edge & 1;
+    hbAcceptedUs = edge & ~1UL;
+    active = hbAccepted;
+    edgeUs = hbAcceptedUs;
+    return true;
+}
+
+bool takeHbEdge(bool &active, unsigned long &edgeUs, unsigned long &waitUs)
+{
+    waitUs = EFFECT_IDLE;
+
+    // The first edge of a change is taken at once, bounces within the debounce time of it are ignored
+    uint32_t tail = hbEdgeTail.load(std::memory_order_relaxed);
+    uint32_t head = hbEdgeHead.load(std::memory_order_acquire);
+    while (tail != head)
+    {
+        uint32_t edge = hbEdges[tail & HB_EDGE_MASK];
+        hbEdgeTail.store(++tail, std::memory_order_release);
+
+        if ((bool)(edge & 1) == hbAccepted)
+        {
+            continue;
+        }
+        if ((edge & ~1UL) - hbAcceptedUs < hbDebounceUs)
+        {
+            hbBounces++;
+            continue;
+        }
+        return acceptEdge(edge, active, edgeUs);
+    }
+
+    // A level that ended up different once the bouncing stopped, or after an
+    // overrun, is taken when the debounce time has passed
+    uint32_t last = hbLastEdge.load(std::memory_order_relaxed);
+    if ((bool)(last & 1) != hbAccepted)
+    {
+        uint32_t sinceUs = (uint32_t)micros() - hbAcceptedUs;
+        if (sinceUs >= hbDebounceUs)
+        {
+            return acceptEdge(last, active, edgeUs);
+        }
+        waitUs = hbDebounceUs - sinceUs;
+    }
+    return false;
+}
+
+void recordHbLatency(unsigned long edgeUs)
+{
+    uint32_t latencyUs = (uint32_t)micros() - (uint32_t)edgeUs;
+    uint8_t bucket = 0;
+    while (bucket < HB_LATENCY_BUCKETS - 1 && latencyUs >= (uint32_t)HB_FIRST_BUCKET_US << bucket)
+    {
+        bucket++;
+    }
+
+    portENTER_CRITICAL(&hbLatencyMux);
+    hbLatency.samples++;
+    hbLatency.lastUs = latencyUs;
+    if (latencyUs > hbLatency.maxUs)
+    {
+        hbLatency.maxUs = latencyUs;
+    }
+    hbLatency.buckets[bucket]++;
+    hbLatency.bounces = hbBounces;
+    hbLatencyReady = true;
+    portEXIT_CRITICAL(&hbLatencyMux);
+}
+
+bool takeHbLatency(HbLatency &latency)
+{
+    portENTER_CRITICAL(&hbLatencyMux);
+    bool ready = hbLatencyReady;
+    if (ready)
+    {
+        latency = hbLatency;
+        hbLatencyReady = false;
+    }
+    portEXIT_CRITICAL(&hbLatencyMux);
+    latency.overruns = hbOverruns.load(std::memory_order_relaxed);
+    return ready;
+}
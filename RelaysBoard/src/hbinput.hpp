@@ -0,0 +1,35 @@
+#ifndef HBINPUT_HPP
+#define HBINPUT_HPP
+
+#include <stdint.h>
+
+// High beam signal input. The ISR only timestamps edges into a lock-free ring,
+// the effect engine debounces them and measures how long each accepted edge
+// took to reach the relays.
+#define HB_EDGE_BUFFER_SIZE 32 // Edges between two engine runs, power of two
+#define HB_LATENCY_BUCKETS 12  // Bucket i counts latencies below 32 us << i, the last one the rest
+
+// Edge to relay write latency, as published on light/hb/latency
+struct HbLatency
+{
+    uint32_t samples;
+    uint32_t lastUs;
+    uint32_t maxUs;
+    uint32_t buckets[HB_LATENCY_BUCKETS];
+    uint32_t bounces;  // Edges ignored by the debounce
+    uint32_t overruns; // Edges lost to a full ring, the level is still tracked
+};
+
+void initHbInput();
+// Bounces within this time of an accepted edge are ignored
+void setHbDebounce(uint16_t debounceMs);
+// Next debounced change of the signal, in order, effect task only. edgeUs is
+// the micros() of the edge. When the input still bounces, waitUs is how long
+// until its level settles, otherwise EFFECT_IDLE.
+bool takeHbEdge(bool &active, unsigned long &edgeUs, unsigned long &waitUs);
+// Account for the relay write that answered the edge at edgeUs
+void recordHbLatency(unsigned long edgeUs);
+// Latency figures, true when samples were added since the last call
+bool takeHbLatency(HbLatency &latency);
+
+#endif // HBINPUT_HPP
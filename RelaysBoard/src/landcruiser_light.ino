@@ -6,6 +6,14 @@
 #include <WebSerial.h>
 #include "light.hpp"
 #include "mqtt.hpp"
+#include "scheduler.hpp"
+#include "program.hpp"
+#include "wear.hpp"
+#include "timesync.hpp"
+#include "statepub.hpp"
+#include "laststate.hpp"
+#include "espnow.hpp"
+#include "config.hpp"
 
 // Create AsyncWebServer object on port 80
 AsyncWebServer server(80);
@@ -14,10 +22,17 @@ void setup()
 {
   Serial.begin(115200);
 
+  loadConfig(); // Pins and settings, before anything uses them
   init_pins();
+  restoreLastState(); // Lights as they were before the reset, before any networking
+  loadPrograms();
+  startEffectScheduler();
 
   WiFi.onEvent(WiFiEvent);
   AsyncMqttClient *mqttClient = InitMqtt();
+  applyConfig();
+  WiFi.mode(WIFI_STA);
+  initEspNow(); // Commands from the CYD work before the access point answers
   ConnectWiFi_STA();
 
   server.on("/", HTTP_GET, [](AsyncWebServerRequest *request)
@@ -43,5 +58,31 @@ void setup()
 void loop()
 {
   ElegantOTA.loop();
-  updateEffect();
+  serviceStatePublish();
+  publishEffectTiming();
+  publishHbLatency();
+  publishBootTiming();
+  serviceTelemetry();
+
+  if (serviceTimeSync())
+  {
+    publishSyncStatus();
+  }
+
+  // Publish the link counters when a display pairs or leaves
+  static uint8_t linkPeers = 0;
+  EspNowStats link;
+  getEspNowStats(link);
+  if (link.peers != linkPeers)
+  {
+    linkPeers = link.peers;
+    publishLinkStatus();
+  }
+
+  saveLastStateIfDue();
+
+  if (saveRelayWearIfDue())
+  {
+    publishRelayWear();
+  }
 }
@@ -0,0 +1,163 @@
+#include "laststate.hpp"
+#include "light.hpp"
+#include <Arduino.h>
+#include <Preferences.h>
+
+#define LAST_STATE_NAMESPACE "light"
+#define LAST_STATE_MAGIC 0x4C53u // "LS"
+#define LAST_STATE_VERSION 1
+#define LAST_STATE_NO_EFFECT -1
+
+// Same record in RTC memory and in NVS
+struct LastStateRecord
+{
+    uint16_t magic;
+    uint8_t version;
+    uint8_t state;
+    int16_t effectName; // LAST_STATE_NO_EFFECT unless an endless effect plays
+    uint16_t delayMs;
+    uint8_t flags;
+    uint8_t checksum;   // Of the bytes before, RTC memory is garbage after a power cycle
+};
+
+static portMUX_TYPE lastStateMux = portMUX_INITIALIZER_UNLOCKED;
+RTC_NOINIT_ATTR LastStateRecord rtcLastState; // Survives software resets, watchdogs and panics
+LastStateRecord lastState;
+LastStateRecord savedLastState; // As in NVS, equal records are not written again
+bool lastStateDirty = false;
+unsigned long lastStateChangeMs = 0;
+unsigned long lastStateSaveMs = 0;
+bool retainedCommandAllowed = false;
+
+static uint8_t lastStateChecksum(const LastStateRecord &record)
+{
+    const uint8_t *bytes = (const uint8_t *)&record;
+    uint8_t sum = 0xA5;
+    for (size_t i = 0; i < offsetof(LastStateRecord, checksum); i++)
+    {
+        sum = (uint8_t)((sum << 1) | (sum >> 7)) ^ bytes[i];
+    }
+    return sum;
+}
+
+static bool lastStateValid(const LastStateRecord &record)
+{
+    return record.magic == LAST_STATE_MAGIC && record.version == LAST_STATE_VERSION &&
+           record.checksum == lastStateChecksum(record);
+}
+
+// Under lastStateMux: mirror a change in RTC memory at once, NVS later
+static void lastStateChanged()
+{
+    lastState.checksum = lastStateChecksum(lastState);
+    rtcLastState = lastState;
+    lastStateDirty = true;
+    lastStateChangeMs = millis();
+}
+
+void noteLastState(uint8_t state)
+{
+    portENTER_CRITICAL(&lastStateMux);
+    lastState.state = state;
+    lastStateChanged();
+    retainedCommandAllowed = false;
+    portEXIT_CRITICAL(&lastStateMux);
+}
+
+void noteLastEffect(bool running, int effectName, int repetitions, uint16_t delayMs, uint8_t flags)
+{
+    portENTER_CRITICAL(&lastStateMux);
+    if (running)
+    {
+        // Effects start from all off, which is also where a finite one leaves the relays
+        lastState.state = OFF_STATE;
+        lastState.effectName = repetitions < 0 ? effectName : LAST_STATE_NO_EFFECT;
+        lastState.delayMs = delayMs;
+        lastState.flags = flags;
+        lastStateChanged();
+    }
+    else if (lastState.effectName != LAST_STATE_NO_EFFECT)
+    {
+        lastState.effectName = LAST_STATE_NO_EFFECT;
+        lastStateChanged();
+    }
+    portEXIT_CRITICAL(&lastStateMux);
+}
+
+bool restoreLastState()
+{
+    Preferences preferences;
+    preferences.begin(LAST_STATE_NAMESPACE, true);
+    bool saved = preferences.getBytes("record", &savedLastState, sizeof(savedLastState)) == sizeof(savedLastState) &&
+                 lastStateValid(savedLastState);
+    preferences.end();
+
+    // RTC memory is newer than NVS, but only a reset without power loss keeps it
+    esp_reset_reason_t reason = esp_reset_reason();
+    bool warm = reason != ESP_RST_POWERON && reason != ESP_RST_BROWNOUT && lastStateValid(rtcLastState);
+    if (!saved)
+    {
+        savedLastState = {};
+    }
+    LastStateRecord record = warm ? rtcLastState : savedLastState;
+    bool found = warm || saved;
+    if (!found)
+    {
+        record = {LAST_STATE_MAGIC, LAST_STATE_VERSION, OFF_STATE, LAST_STATE_NO_EFFECT, 0, 0, 0};
+        record.checksum = lastStateChecksum(record);
+    }
+
+    portENTER_CRITICAL(&lastStateMux);
+    lastState = record;
+    rtcLastState = record;
+    lastStateDirty = warm && memcmp(&record, &savedLastState, sizeof(record)) != 0;
+    retainedCommandAllowed = !warm;
+    portEXIT_CRITICAL(&lastStateMux);
+
+    if (!found)
+    {
+        return false;
+    }
+    changeState(record.state);
+    if (LAST_STATE_RESTORE_EFFECT && record.effectName != LAST_STATE_NO_EFFECT)
+    {
+        playEffect(record.effectName, -1, record.delayMs, record.flags);
+    }
+    return true;
+}
+
+bool acceptRetainedCommand()
+{
+    portENTER_CRITICAL(&lastStateMux);
+    bool allowed = retainedCommandAllowed;
+    portEXIT_CRITICAL(&lastStateMux);
+    return allowed;
+}
+
+bool saveLastStateIfDue()
+{
+    unsigned long nowMs = millis();
+    portENTER_CRITICAL(&lastStateMux);
+    bool due = lastStateDirty && nowMs - lastStateChangeMs >= LAST_STATE_SETTLE_MS &&
+               nowMs - lastStateSaveMs >= LAST_STATE_MIN_SAVE_INTERVAL_MS;
+    LastStateRecord record = lastState;
+    if (due)
+    {
+        lastStateDirty = false;
+    }
+    portEXIT_CRITICAL(&lastStateMux);
+
+    // Back to what NVS already holds, e.g. a light switched on and off again
+    if (!due || memcmp(&record, &savedLastState, sizeof(record)) == 0)
+    {
+        return false;
+    }
+    lastStateSaveMs = nowMs;
+    savedLastState = record;
+
+    Preferences preferences;
+    preferences.begin(LAST_STATE_NAMESPACE, false);
+    preferences.putBytes("record", &record, sizeof(record));
+    preferences.end();
+    return true;
+}
@@ -0,0 +1,26 @@
+#ifndef LASTSTATE_HPP
+#define LASTSTATE_HPP
+
+#include <stdint.h>
+
+// The relay state commanded last, and the endless effect playing if any, kept in
+// RTC memory for warm resets and in NVS for cold boots. restoreLastState() puts
+// them back right after init_pins(), before WiFi and MQTT are up.
+#define LAST_STATE_SETTLE_MS 2000              // Save once nothing changed for this long...
+#define LAST_STATE_MIN_SAVE_INTERVAL_MS 10000  // ...and never more often than this
+#define LAST_STATE_RESTORE_EFFECT true         // Restart an endless effect after a reset
+
+// Effect task side
+void noteLastState(uint8_t state);
+// An effect started (running) or ended, only endless ones are restored
+void noteLastEffect(bool running, int effectName, int repetitions, uint16_t delayMs, uint8_t flags);
+
+// Apply the stored state, true if there was one. Call once, right after init_pins().
+bool restoreLastState();
+// A retained light/command only wins over the stored state on the first
+// connection after a cold boot, until any command is applied
+bool acceptRetainedCommand();
+// Persist the state when it settled, true after a save. Call from loop().
+bool saveLastStateIfDue();
+
+#endif // LASTSTATE_HPP
@@ -1,145 +1,602 @@
 #include "light.hpp"
 #include "effects.h"
 #include "mqtt.hpp"
+#include "scheduler.hpp"
+#include "program.hpp"
+#include "transform.hpp"
+#include "wear.hpp"
+#include "statepub.hpp"
+#include "laststate.hpp"
+#include "hbinput.hpp"
+#include "rmtout.hpp"
+#include "config.hpp"
 #include <WebSerial.h>
 
-const int relayPins[4] = {PIN_LIGHT1, PIN_LIGHT2, PIN_LIGHT3, PIN_LIGHT4};
-bool stopEffect = false; // Flag to stop all effects
+uint32_t relayGpioMasks[16];
+uint8_t outputState = OFF_STATE; // Last state written to the relays
+bool stopEffect = false; // Flag to stop all effects, effect task only
 
 struct Effect
 {
-    const uint8_t *pattern;
+    const uint8_t *code;
     size_t length;
 };
 
 // Define patterns for each effect
-const uint8_t blinkingLR[] = {0b1000, 0b0100, 0b0010, 0b0001};
-const uint8_t blinkingRL[] = {0b0001, 0b0010, 0b0100, 0b1000};
-const uint8_t wave[] = {0b0001, 0b0010, 0b0100, 0b1000, 0b0100, 0b0010, 0b0001};
-const uint8_t alternating[] = {0b1010, 0b0101};
-const uint8_t blinking[] = {0b1111, 0b0000};
-const uint8_t extint[] = {0b1001, 0b0110};
-const uint8_t cascadeLR[] = {0b1000, 0b1100, 0b1110, 0b1111};
-const uint8_t cascadeRL[] = {0b0001, 0b0011, 0b0111, 0b1111};
-
-unsigned long previousMillis = 0;
-size_t patternIndex = 0;
+constexpr uint8_t blinkingLR[] = {0b1000, 0b0100, 0b0010, 0b0001};
+constexpr uint8_t blinkingRL[] = {0b0001, 0b0010, 0b0100, 0b1000};
+constexpr uint8_t wave[] = {0b0001, 0b0010, 0b0100, 0b1000, 0b0100, 0b0010, 0b0001};
+constexpr uint8_t alternating[] = {0b1010, 0b0101};
+constexpr uint8_t blinking[] = {0b1111, 0b0000};
+constexpr uint8_t extint[] = {0b1001, 0b0110};
+constexpr uint8_t cascadeLR[] = {0b1000, 0b1100, 0b1110, 0b1111};
+constexpr uint8_t cascadeRL[] = {0b0001, 0b0011, 0b0111, 0b1111};
+
+// Built-in effects and all their variants compiled to bytecode at build time
+constexpr auto blinkingLRPrograms = compileVariants(blinkingLR);
+constexpr auto blinkingRLPrograms = compileVariants(blinkingRL);
+constexpr auto wavePrograms = compileVariants(wave);
+constexpr auto alternatingPrograms = compileVariants(alternating);
+constexpr auto blinkingPrograms = compileVariants(blinking);
+constexpr auto extintPrograms = compileVariants(extint);
+constexpr auto cascadeLRPrograms = compileVariants(cascadeLR);
+constexpr auto cascadeRLPrograms = compileVariants(cascadeRL);
+
+struct EffectVariants
+{
+    Effect variant[EFFECT_VARIANTS];
+};
+
+template <size_t N>
+constexpr EffectVariants effectVariants(const PatternVariants<N> &programs)
+{
+    EffectVariants variants = {};
+    for (uint8_t flags = 0; flags < EFFECT_VARIANTS; flags++)
+    {
+        variants.variant[flags] = {programs.variant[flags].code, sizeof(programs.variant[flags].code)};
+    }
+    return variants;
+}
+
+// Frame lookups for uploaded programs, indexed by the invert and mirror flags
+constexpr FrameTransform frameTransforms[(EFFECT_INVERT | EFFECT_MIRROR) + 1] = {
+    compileFrameTransform(0),
+    compileFrameTransform(EFFECT_INVERT),
+    compileFrameTransform(EFFECT_MIRROR),
+    compileFrameTransform(EFFECT_INVERT | EFFECT_MIRROR),
+};
+
+// Effect requested from another task, picked up by updateEffect()
+struct EffectRequest
+{
+    int effectName;
+    int repetitions;
+    unsigned long delayUs;
+    uint8_t flags;
+    unsigned long timeUs; // When the first step is due
+};
+
+static portMUX_TYPE effectMux = portMUX_INITIALIZER_UNLOCKED;
+EffectRequest pendingRequest;
+bool requestPending = false;
+bool stopRequested = false; // Set by stop(), picked up as stopEffect
+uint8_t requestedState = OFF_STATE; // Set by light/command
+uint16_t requestedSeq = 0;          // Its sequence number and send time
+uint32_t requestedSentMs = 0;
+bool stateRequestPending = false;
+bool requestHeld = false; // The effect request waits for the high beam release
+
+// Effects queued on light/queue, played back to back
+EffectRequest playlist[PLAYLIST_SIZE];
+uint8_t playlistCount = 0;
+uint8_t playlistPosition = 0; // Next entry to play
+bool playlistLoop = false;
+
+unsigned long nextStepUs = 0;
+ProgramState program;
+uint8_t runningCode[PROGRAM_MAX_LENGTH]; // Copy of an uploaded program while it plays
+const uint8_t *frameMask = frameTransforms[0].mask; // Output lookup of the running program
 int remainingRepetitions = 0;
 bool effectRunning = false;
-int delayMs = 0;
+unsigned long delayUs = 0;
 int currentEffectName = -1;
+uint64_t rmtShownFrame = 0; // Last frame of the RMT waveform published
 
-unsigned long hbSignalTime = 0;
-unsigned long lastHbSignalTime = 0;
-bool hbSignal = false;
+// Step lateness of the current effect, handed over to the network side when it ends
+EffectTiming timing;
+EffectTiming finishedTiming;
+bool timingReady = false;
+EffectTiming stepTiming; // All steps since the last takeStepTiming(), for the telemetry
+
+bool hbSignal = false; // Debounced high beam signal
 bool hbState = false;
+unsigned long hbReleaseUs = 0; // Edge of a release not yet written to the relays
+bool hbReleasePending = false;
+unsigned long hbSettleUs = EFFECT_IDLE; // Until a bouncing signal settles
 
+static void resumeEffectFromRmt();
 
-// Effects table
-Effect effects[EFFECT_COUNT] = {
-    {blinkingLR, sizeof(blinkingLR)},
-    {blinkingRL, sizeof(blinkingRL)},
-    {wave, sizeof(wave)},
-    {alternating, sizeof(alternating)},
-    {blinking, sizeof(blinking)},
-    {extint, sizeof(extint)},
-    {cascadeLR, sizeof(cascadeLR)},
-    {cascadeRL, sizeof(cascadeRL)},
+// Effects table, one row of variants per effect
+constexpr EffectVariants effects[EFFECT_COUNT] = {
+    effectVariants(blinkingLRPrograms),
+    effectVariants(blinkingRLPrograms),
+    effectVariants(wavePrograms),
+    effectVariants(alternatingPrograms),
+    effectVariants(blinkingPrograms),
+    effectVariants(extintPrograms),
+    effectVariants(cascadeLRPrograms),
+    effectVariants(cascadeRLPrograms),
 };
 
-void ICACHE_RAM_ATTR isrhbSignalChange()
+void init_pins()
 {
-    hbSignalTime = millis();
-    if (hbSignalTime - lastHbSignalTime > DEBOUNCE_TIME)
+    initHbInput();
+    pinMode(boardConfig.hbRelayPin, OUTPUT);
+
+    for (int i = 0; i < 4; i++)
+    {
+        pinMode(boardConfig.relayPins[i], OUTPUT);
+    }
+
+    // A state is written with two register stores whatever the pins are
+    for (uint8_t state = 0; state < 16; state++)
     {
-        if (digitalRead(PIN_HB_SIGNAL) == HIGH)
+        relayGpioMasks[state] = 0;
+        for (uint8_t i = 0; i < RELAY_COUNT; i++)
         {
-            // Stop effect to assure the high beam signal is not interrupted
-            stopEffect = true;
-            hbSignal = false;
+            relayGpioMasks[state] |= (uint32_t)((state >> i) & 1) << boardConfig.relayPins[i];
         }
-        else
+    }
+    initRelayWear();
+    initRmtOutput();
+    changeState(OFF_STATE, true);
+}
+
+void stop()
+{
+    portENTER_CRITICAL(&effectMux);
+    requestPending = false; // A stop cancels an effect that has not started yet
+    playlistCount = 0;      // and the rest of the show
+    playlistPosition = 0;
+    stopRequested = true;
+    portEXIT_CRITICAL(&effectMux);
+    wakeEffectScheduler();
+}
+
+void changeState(uint8_t newState, bool init, bool force)
+{
+    // Relays that switched too recently keep their state until their dwell ends,
+    // an effect played by the RMT gives the pins back first
+    if (!init)
+    {
+        if (rmtActive())
         {
-            hbSignal = true;
+            resumeEffectFromRmt();
         }
-        lastHbSignalTime = hbSignalTime;
+        newState = filterRelayState(newState, force);
+    }
+    outputState = newState;
+
+    // Enable GPIOs
+    GPIO_REG_WRITE(GPIO_OUT_W1TS_REG, relayGpioMasks[newState & 0x0F]);
+
+    // Disable GPIOs
+    GPIO_REG_WRITE(GPIO_OUT_W1TC_REG, relayGpioMasks[~newState & 0x0F]);
+    // Publish the new state, loop() sends it at a limited rate
+    if (init)
+    {
+        return;
     }
+    noteLightState(newState);
 }
 
-void init_pins()
+void setLightState(uint8_t state, uint16_t seq, uint32_t sentMs)
 {
-    pinMode(PIN_HB_SIGNAL, INPUT_PULLUP);
-    pinMode(PIN_RELAY_HB, OUTPUT);
+    portENTER_CRITICAL(&effectMux);
+    requestedState = state;
+    requestedSeq = seq;
+    requestedSentMs = sentMs;
+    stateRequestPending = true;
+    portEXIT_CRITICAL(&effectMux);
+    wakeEffectScheduler();
+}
 
-    attachInterrupt(PIN_HB_SIGNAL, isrhbSignalChange, CHANGE);
+void playEffect(int effectName, int repetitions, int delayMsParam, uint8_t flags)
+{
+    playEffectAt(effectName, repetitions, delayMsParam, flags, micros());
+}
 
-    for (int i = 0; i < 4; i++)
+void playEffectAt(int effectName, int repetitions, int delayMsParam, uint8_t flags, unsigned long startUs)
+{
+    if (delayMsParam < EFFECT_MIN_DELAY_MS)
     {
-        pinMode(relayPins[i], OUTPUT);
+        delayMsParam = EFFECT_MIN_DELAY_MS;
     }
-    changeState(OFF_STATE, true);
+
+    // Hand the effect over to the scheduler task
+    portENTER_CRITICAL(&effectMux);
+    pendingRequest.effectName = effectName;
+    pendingRequest.repetitions = repetitions;
+    pendingRequest.delayUs = (unsigned long)delayMsParam * 1000UL;
+    pendingRequest.flags = flags;
+    pendingRequest.timeUs = startUs;
+    requestPending = true;
+    stopRequested = false;
+    portEXIT_CRITICAL(&effectMux);
+    wakeEffectScheduler();
 }
 
-void stop()
+bool queueEffect(int effectName, int repetitions, int delayMsParam, uint8_t flags)
 {
-    stopEffect = true;
+    if (delayMsParam < EFFECT_MIN_DELAY_MS)
+    {
+        delayMsParam = EFFECT_MIN_DELAY_MS;
+    }
+
+    portENTER_CRITICAL(&effectMux);
+    bool queued = playlistCount < PLAYLIST_SIZE;
+    if (queued)
+    {
+        EffectRequest &entry = playlist[playlistCount++];
+        entry.effectName = effectName;
+        entry.repetitions = repetitions;
+        entry.delayUs = (unsigned long)delayMsParam * 1000UL;
+        entry.flags = flags;
+        entry.timeUs = 0;
+    }
+    portEXIT_CRITICAL(&effectMux);
+
+    // Starts the playlist if nothing is playing
+    wakeEffectScheduler();
+    return queued;
 }
 
-void changeState(uint8_t newState, bool init)
+void clearPlaylist()
 {
+    portENTER_CRITICAL(&effectMux);
+    playlistCount = 0;
+    playlistPosition = 0;
+    portEXIT_CRITICAL(&effectMux);
+}
 
-    // Enable GPIOs
-    GPIO_REG_WRITE(GPIO_OUT_W1TS_REG, ((newState & 0b0001) << PIN_LIGHT1) |
-                                              ((newState & 0b0010) << PIN_LIGHT2 - 1) |
-                                              ((newState & 0b0100) << PIN_LIGHT3 - 2) |
-                                              ((newState & 0b1000) << PIN_LIGHT4 - 3));
+void setPlaylistLoop(bool loop)
+{
+    portENTER_CRITICAL(&effectMux);
+    playlistLoop = loop;
+    portEXIT_CRITICAL(&effectMux);
+}
 
-    // Disable GPIOs
-    GPIO_REG_WRITE(GPIO_OUT_W1TC_REG, ((~newState & 0b0001) << PIN_LIGHT1) |
-                                              ((~newState & 0b0010) << PIN_LIGHT2 - 1) |
-                                              ((~newState & 0b0100) << PIN_LIGHT3 - 2) |
-                                              ((~newState & 0b1000) << PIN_LIGHT4 - 3));
-    // Publish the new state
-    if (init)
+// Next queued effect, wrapping around in loop mode
+static bool takeNextPlaylistEntry(EffectRequest &entry)
+{
+    portENTER_CRITICAL(&effectMux);
+    if (playlistPosition >= playlistCount && playlistLoop)
+    {
+        playlistPosition = 0;
+    }
+    bool available = playlistPosition < playlistCount;
+    if (available)
+    {
+        entry = playlist[playlistPosition++];
+    }
+    else
+    {
+        playlistCount = 0;
+        playlistPosition = 0;
+    }
+    portEXIT_CRITICAL(&effectMux);
+    return available;
+}
+
+void takeStepTiming(EffectTiming &result)
+{
+    portENTER_CRITICAL(&effectMux);
+    result = stepTiming;
+    stepTiming = EffectTiming();
+    portEXIT_CRITICAL(&effectMux);
+}
+
+bool takeEffectTiming(EffectTiming &result)
+{
+    portENTER_CRITICAL(&effectMux);
+    bool ready = timingReady;
+    if (ready)
+    {
+        result = finishedTiming;
+        timingReady = false;
+    }
+    portEXIT_CRITICAL(&effectMux);
+    return ready;
+}
+
+// End the running effect and publish its timing
+static void finishEffect()
+{
+    if (!effectRunning)
     {
         return;
     }
-    publishState(newState);
+    effectRunning = false;
+    noteEffectSummary({false, currentEffectName, 0, (uint16_t)(delayUs / 1000), 0});
+    noteLastEffect(false, currentEffectName, 0, 0, 0);
+
+    portENTER_CRITICAL(&effectMux);
+    finishedTiming = timing;
+    timingReady = true;
+    portEXIT_CRITICAL(&effectMux);
 }
 
-void playEffect(int effectName, int repetitions, int delayMsParam, bool invert)
+// Load the bytecode of a built-in effect variant or of an uploaded program slot
+static bool startProgram(int effectName, uint8_t flags)
 {
-    // Initialiser les variables globales
-    stopEffect = false;
-    changeState(OFF_STATE);
-    patternIndex = -1;
-    remainingRepetitions = repetitions;
-    effectRunning = true;
-    previousMillis = millis();
-    delayMs = delayMsParam;
-    currentEffectName = effectName;
+    flags &= EFFECT_VARIANTS - 1;
+    if (effectName >= 0 && effectName < EFFECT_COUNT)
+    {
+        const Effect &effect = effects[effectName].variant[flags];
+        programStart(program, effect.code, effect.length);
+        frameMask = frameTransforms[0].mask;
+        return true;
+    }
+
+    int slot = effectName - EFFECT_PROGRAM_BASE;
+    if (slot >= 0 && slot < PROGRAM_SLOTS)
+    {
+        size_t length = programLoad(slot, runningCode);
+        programStart(program, runningCode, length);
+        frameMask = frameTransforms[flags & (EFFECT_INVERT | EFFECT_MIRROR)].mask;
+        return length > 0;
+    }
+    return false;
 }
 
-// Execute an effect function with repetition and delay, optionally inverted
-void updateEffect()
+// Hand the running effect to the RMT from its first step, when its frames fit
+// and none of them is shorter than the relay dwell. Sets the deadline of its end.
+static bool startEffectOnRmt()
 {
-    // If the high beam signal is active, turn on the high beam to respect the signal
-    if (hbSignal && !hbState)
+    RmtFrame frames[RMT_MAX_FRAMES];
+    size_t count = 0;
+    ProgramState vm;
+    programStart(vm, program.code, program.length);
+    for (;;)
+    {
+        uint8_t state;
+        uint16_t waitMs;
+        ProgramResult result = programStep(vm, state, waitMs);
+        if (result == PROGRAM_DONE)
+        {
+            break;
+        }
+        if (result != PROGRAM_FRAME || count == RMT_MAX_FRAMES)
+        {
+            return false;
+        }
+        frames[count].mask = frameMask[state];
+        frames[count].durationUs = waitMs != 0 ? (unsigned long)waitMs * 1000UL : delayUs;
+        count++;
+    }
+
+    unsigned long cycleUs = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        cycleUs += frames[i].durationUs;
+    }
+    if (count == 0 || (remainingRepetitions > 0 && cycleUs > RMT_MAX_PLAY_US / remainingRepetitions))
+    {
+        return false;
+    }
+
+    // Level runs of every channel, around the loop, must last the dwell
+    for (uint8_t channel = 0; channel < RELAY_COUNT; channel++)
+    {
+        uint8_t bit = 1 << channel;
+        unsigned long dwellUs = (unsigned long)getMinDwell(channel) * 1000UL;
+        size_t first = 0;
+        while (first < count && !((frames[first].mask ^ frames[(first + count - 1) % count].mask) & bit))
+        {
+            first++;
+        }
+        unsigned long runUs = 0;
+        for (size_t i = 0; first < count && i < count; i++)
+        {
+            size_t f = (first + i) % count;
+            if (i != 0 && ((frames[f].mask ^ frames[(f + count - 1) % count].mask) & bit))
+            {
+                if (runUs < dwellUs)
+                {
+                    return false;
+                }
+                runUs = 0;
+            }
+            runUs += frames[f].durationUs;
+        }
+        if (first < count && runUs < dwellUs)
+        {
+            return false;
+        }
+    }
+
+    unsigned long durationUs = remainingRepetitions > 0 ? cycleUs * remainingRepetitions : 0;
+    if (!rmtPlay(frames, count, outputState, durationUs))
+    {
+        return false;
+    }
+    nextStepUs = micros() + durationUs;
+    rmtShownFrame = UINT64_MAX;
+    return true;
+}
+
+// Publish the frame the RMT shows when it is a new one, like changeState() does
+// for the frames of the engine. Returns the time until the next frame, or until
+// the end of the effect when that comes first.
+static unsigned long followRmtFrames(unsigned long currentUs)
+{
+    uint32_t cycles;
+    uint8_t frame;
+    unsigned long waitUs;
+    uint8_t state = rmtCurrentFrame(cycles, frame, waitUs);
+    uint64_t shownFrame = (uint64_t)cycles * RMT_MAX_FRAMES + frame;
+    if (shownFrame != rmtShownFrame)
+    {
+        rmtShownFrame = shownFrame;
+        noteLightState(state);
+    }
+    if (remainingRepetitions >= 0 && nextStepUs - currentUs < waitUs)
+    {
+        waitUs = nextStepUs - currentUs;
+    }
+    return waitUs;
+}
+
+// Take the pins back from the RMT in the middle of an effect: the program goes
+// on after the frame the waveform shows, when that frame ends
+static void resumeEffectFromRmt()
+{
+    uint32_t cycles;
+    uint8_t frame;
+    unsigned long waitUs;
+    rmtCurrentFrame(cycles, frame, waitUs);
+    rmtStop();
+    if (!effectRunning)
     {
-        changeState(HB_STATE);
-        hbState = true;
         return;
     }
 
-    // If the high beam signal is inactive, turn off the high beam
-    // A short high beam flash will stop any running effect
-    if (!hbSignal && hbState)
+    if (remainingRepetitions > 0)
+    {
+        remainingRepetitions -= cycles;
+    }
+    programStart(program, program.code, program.length);
+    uint8_t state;
+    uint16_t waitMs;
+    for (uint8_t i = 0; i <= frame; i++)
+    {
+        programStep(program, state, waitMs);
+    }
+    nextStepUs = micros() + waitUs;
+}
+
+// Make an effect the running one, its first step is due at startUs
+static bool startEffect(const EffectRequest &request, unsigned long startUs)
+{
+    remainingRepetitions = request.repetitions;
+    delayUs = request.delayUs;
+    currentEffectName = request.effectName;
+    nextStepUs = startUs;
+    timing = EffectTiming();
+    effectRunning = startProgram(currentEffectName, request.flags);
+    if (effectRunning)
+    {
+        noteEffectSummary({true, currentEffectName, remainingRepetitions, (uint16_t)(delayUs / 1000), request.flags});
+        noteLastEffect(true, currentEffectName, remainingRepetitions, (uint16_t)(delayUs / 1000), request.flags);
+    }
+    return effectRunning;
+}
+
+static void recordLateness(unsigned long lateUs)
+{
+    timing.steps++;
+    timing.lastLateUs = lateUs;
+    timing.totalLateUs += lateUs;
+    if (lateUs > timing.maxLateUs)
+    {
+        timing.maxLateUs = lateUs;
+    }
+
+    portENTER_CRITICAL(&effectMux);
+    stepTiming.steps++;
+    stepTiming.lastLateUs = lateUs;
+    stepTiming.totalLateUs += lateUs;
+    if (lateUs > stepTiming.maxLateUs)
+    {
+        stepTiming.maxLateUs = lateUs;
+    }
+    portEXIT_CRITICAL(&effectMux);
+}
+
+// One pass of the engine: take the requests and the high beam edges since the
+// last call, then play the step of the effect or the playlist that is due.
+// Returns the us until the next pass.
+static unsigned long runEffect()
+{
+    // Pick up an effect or a state requested since the last call
+    EffectRequest request;
+    bool started = false;
+    uint8_t state = OFF_STATE;
+    uint16_t seq = 0;
+    uint32_t sentMs = 0;
+    bool stateChanged = false;
+    portENTER_CRITICAL(&effectMux);
+    if (requestPending && hbState)
+    {
+        requestHeld = true; // The high beam owns the relays, started on its release
+    }
+    else if (requestPending)
+    {
+        request = pendingRequest;
+        requestPending = false;
+        started = true;
+    }
+    else
+    {
+        requestHeld = false; // Cancelled by stop()
+    }
+    if (stateRequestPending)
+    {
+        state = requestedState;
+        seq = requestedSeq;
+        sentMs = requestedSentMs;
+        stateRequestPending = false;
+        stateChanged = true;
+    }
+    if (stopRequested)
     {
-        // changeState will be called in the condition below with stopEffect = true
-        //changeState(OFF_STATE);
-        //hbState = false;
         stopEffect = true;
-        //return;
+        stopRequested = false;
+    }
+    portEXIT_CRITICAL(&effectMux);
+
+    if (stateChanged)
+    {
+        changeState(state);
+        noteLastState(state);
+        if (seq != 0)
+        {
+            noteCommandApplied(seq, sentMs);
+        }
+    }
+
+    if (started)
+    {
+        finishEffect();
+        changeState(OFF_STATE);
+        // An effect held back by the high beam starts on its release, not at its old time
+        startEffect(request, requestHeld ? micros() : request.timeUs);
+        requestHeld = false;
+    }
+
+    // High beam edges are applied one by one, so a short flash is never missed
+    bool hbActive;
+    unsigned long edgeUs;
+    while (takeHbEdge(hbActive, edgeUs, hbSettleUs))
+    {
+        hbSignal = hbActive;
+        if (hbActive)
+        {
+            // If the high beam signal is active, turn on the high beam to respect the signal
+            changeState(HB_STATE, false, true);
+            hbState = true;
+            recordHbLatency(edgeUs);
+        }
+        else
+        {
+            // If the high beam signal is inactive, turn off the high beam
+            // A short high beam flash will stop any running effect
+            // changeState will be called in the condition below with stopEffect = true
+            stopEffect = true;
+            hbReleaseUs = edgeUs;
+            hbReleasePending = true;
+            clearPlaylist();
+        }
     }
 
     if (stopEffect)
@@ -148,80 +605,139 @@ void updateEffect()
         // When a effect is stopped, previous state is restored
         if (hbSignal)
         {
-            changeState(HB_STATE);
+            changeState(HB_STATE, false, true);
             hbState = true;
         }
         else
         {
-            changeState(OFF_STATE);
+            // Releasing the high beam bypasses the dwell like engaging it
+            changeState(OFF_STATE, false, hbReleasePending);
+            noteLastState(OFF_STATE);
             hbState = false;
         }
+        if (hbReleasePending)
+        {
+            recordHbLatency(hbReleaseUs);
+            hbReleasePending = false;
+        }
 
-        effectRunning = false;
+        finishEffect();
         stopEffect = false;
-        return;
+        return requestHeld ? 0 : EFFECT_IDLE; // A held effect starts at once
     }
 
-    if (!effectRunning)
+    // The high beam owns the relays until it is released
+    if (hbState)
     {
-        return;
+        return EFFECT_IDLE;
     }
 
-    unsigned long currentMillis = millis();
-
-    // If the current effect is out of bounds, stop the effect
-    if (currentEffectName < 0 || currentEffectName >= EFFECT_COUNT)
+    // An effect on the RMT only needs the engine to publish its frames, and when it ends
+    if (rmtActive())
     {
-        effectRunning = false;
-        changeState(OFF_STATE);
-        return;
+        unsigned long currentUs = micros();
+        if (remainingRepetitions < 0 || (long)(nextStepUs - currentUs) > 0)
+        {
+            return followRmtFrames(currentUs);
+        }
+        finishEffect();
+        if (!takeNextPlaylistEntry(request) || !startEffect(request, nextStepUs))
+        {
+            changeState(OFF_STATE);
+            return EFFECT_IDLE;
+        }
     }
-    // Check if it is the first pattern index
-    const uint8_t *pattern = effects[currentEffectName].pattern;
-    size_t patternLength = effects[currentEffectName].length;
-    uint8_t newState = pattern[patternIndex]; // Retrieve the new state from the pattern
 
-    // Initialize the pattern index if it is the first iteration
-    if (patternIndex == -1)
+    // Start the playlist when nothing else is playing
+    if (!effectRunning && (!takeNextPlaylistEntry(request) || !startEffect(request, micros())))
     {
-        patternIndex = 0;
-        uint8_t newState = pattern[patternIndex]; // Retrieve the new state from the pattern
-        changeState(newState);
-        patternIndex++;
+        return EFFECT_IDLE;
     }
 
-    // Wait for the delay before updating the state again
-    if (currentMillis - previousMillis >= delayMs)
+    // Wait for the deadline of the next step
+    unsigned long currentUs = micros();
+    long lateUs = (long)(currentUs - nextStepUs);
+    if (lateUs < 0)
     {
-        if (remainingRepetitions == 0)
-        {
-            effectRunning = false;
-            changeState(OFF_STATE);
-            return;
-        }
+        return (unsigned long)-lateUs;
+    }
 
-        previousMillis = currentMillis;
+    if (timing.steps == 0 && startEffectOnRmt())
+    {
+        recordLateness((unsigned long)lateUs);
+        return followRmtFrames(currentUs);
+    }
 
-        if (stopEffect)
+    // Run the program up to its next frame, restarting it for each repetition
+    uint8_t newState = OFF_STATE;
+    uint16_t waitMs = 0;
+    ProgramResult result = programStep(program, newState, waitMs);
+    if (result == PROGRAM_DONE)
+    {
+        if (remainingRepetitions > 0)
         {
-            changeState(OFF_STATE);
-            effectRunning = false;
-            return;
+            remainingRepetitions--;
         }
-
-        if (currentEffectName >= 0 && currentEffectName < EFFECT_COUNT)
+        if (remainingRepetitions == 0)
         {
-            changeState(newState);
-
-            patternIndex++;
-            if (patternIndex >= patternLength)
+            // The next playlist entry starts on this same deadline, without a gap
+            finishEffect();
+            if (!takeNextPlaylistEntry(request) || !startEffect(request, nextStepUs))
             {
-                patternIndex = 0;
-                if (remainingRepetitions > 0)
-                {
-                    remainingRepetitions--;
-                }
+                changeState(OFF_STATE);
+                return EFFECT_IDLE;
+            }
+            if (startEffectOnRmt())
+            {
+                recordLateness((unsigned long)lateUs);
+                return followRmtFrames(currentUs);
             }
         }
+        else
+        {
+            programStart(program, program.code, program.length);
+        }
+        result = programStep(program, newState, waitMs);
+    }
+
+    // A faulty program, or one that ends without showing anything, is stopped
+    if (result != PROGRAM_FRAME)
+    {
+        finishEffect();
+        changeState(OFF_STATE);
+        return EFFECT_IDLE;
+    }
+
+    recordLateness((unsigned long)lateUs);
+    changeState(frameMask[newState]);
+
+    unsigned long stepUs = waitMs != 0 ? (unsigned long)waitMs * 1000UL : delayUs;
+
+    // Deadlines advance by whole steps so lateness never accumulates into drift,
+    // unless a whole step was missed, then restart the grid from now
+    nextStepUs += stepUs;
+    if ((long)(currentUs - nextStepUs) >= 0)
+    {
+        nextStepUs = currentUs + stepUs;
+    }
+    return nextStepUs - currentUs;
+}
+
+unsigned long updateEffect()
+{
+    unsigned long waitUs = runEffect();
+
+    // Relays held back by their minimum dwell switch as soon as it ends
+    uint8_t heldState;
+    unsigned long dwellUs = EFFECT_IDLE;
+    if (!rmtActive() && takeDueRelayState(heldState, dwellUs))
+    {
+        changeState(heldState);
+        takeDueRelayState(heldState, dwellUs);
+    }
+    if (hbSettleUs < dwellUs)
+    {
+        dwellUs = hbSettleUs;
     }
+    return dwellUs < waitUs ? dwellUs : waitUs;
 }
@@ -13,13 +13,44 @@
 
 #define OFF_STATE 0 // Binary representation 0000
 #define HB_STATE 15 // Binary representation 1111
-#define DEBOUNCE_TIME 25 // Debounce time in milliseconds
+#define DEBOUNCE_TIME 25 // Default debounce time in milliseconds
+#define EFFECT_MIN_DELAY_MS 1 // Shortest effect step accepted
+#define EFFECT_IDLE ((unsigned long)-1) // updateEffect() has nothing scheduled
+#define PLAYLIST_SIZE 16 // Effects that can be queued on light/queue
+
+// Step timing of an effect, in microseconds
+struct EffectTiming
+{
+    uint32_t steps;         // Number of steps played
+    uint32_t lastLateUs;    // Lateness of the last step against its deadline
+    uint32_t maxLateUs;     // Worst lateness
+    uint64_t totalLateUs;   // Sum of lateness, for the average
+};
+
+// GPIO register bits of each relay state, for the pins of the configuration
+extern uint32_t relayGpioMasks[16];
 
 // Function declarations for light operations
 void init_pins();
 void stop();
-void changeState(uint8_t newState, bool init = false);
-void playEffect(int effectName, int repetitions, int delayMs, bool invert);
-void updateEffect(); 
+// force bypasses the relay dwell filter, for the high beam
+void changeState(uint8_t newState, bool init = false, bool force = false);
+// Set the relays from another task, applied by the effect engine. A non-zero
+// seq is the command number of the CYD, echoed in light/state once applied.
+void setLightState(uint8_t state, uint16_t seq = 0, uint32_t sentMs = 0);
+// flags is a combination of EffectFlags
+void playEffect(int effectName, int repetitions, int delayMs, uint8_t flags);
+// Same, with the first step at the micros() value startUs
+void playEffectAt(int effectName, int repetitions, int delayMs, uint8_t flags, unsigned long startUs);
+// Append an effect to the playlist, false when it is full
+bool queueEffect(int effectName, int repetitions, int delayMs, uint8_t flags);
+void clearPlaylist();
+void setPlaylistLoop(bool loop);
+// Run the effect engine, returns the microseconds until it must run again or EFFECT_IDLE
+unsigned long updateEffect();
+// Timing of the last finished effect, true once per finished effect
+bool takeEffectTiming(EffectTiming &timing);
+// Timing of every step played since the last call, whatever the effect
+void takeStepTiming(EffectTiming &timing);
 
 #endif // LIGHT_HPP
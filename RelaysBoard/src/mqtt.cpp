@@ -4,32 +4,41 @@
 #include <Ticker.h>
 #include <WebSerial.h>
 #include "light.hpp"
-#include <ArduinoJson.h>
-
-// Defining WiFi channel for optimized connection speed
-#define WIFI_CHANNEL 6
+#include "command.hpp"
+#include "wear.hpp"
+#include "timesync.hpp"
+#include "statepub.hpp"
+#include "hbinput.hpp"
+#include "lightwire.h"
+#include "mqttrx.h"
+#include "program.hpp"
+#include "topicrouter.h"
+#include "espnow.hpp"
+#include "laststate.hpp"
+#include "fastwifi.hpp"
+#include "telemetry.h"
+#include "config.hpp"
+
+#define MQTT_RX_DEFAULT_LIMIT 64 // Longest payload of the light topics in text form
 
 Ticker mqttReconnectTimer;
 Ticker wifiReconnectTimer;
 
 AsyncMqttClient mqttClient;
-bool legalMode = false;
-
+MqttRxPool rxPool; // Incoming payloads, assembled and NUL-terminated
+char topicPrefix[TOPIC_PREFIX_SIZE] = ""; // "veh/<id>/" in front of every topic
+bool wireBinary = WIRE_BINARY; // light/state as lightwire.h, text otherwise
+char boardId[13]; // MAC address in hex, tells the boards apart on shared topics
+uint32_t stateBoard = 0; // Its low 4 bytes, in the light/state numbers
+Telemetry telemetry = {TELEMETRY_MS};
+uint32_t mqttReconnects = 0; // Broker sessions lost since boot
+bool mqttSession = false;     // Connected since the last disconnect
+
+// Start connecting and return, the WiFi events take it from there
 void ConnectWiFi_STA()
 {
     Serial.println("Connecting to Wi-Fi...");
-    WiFi.begin(WIFI_SSID, WIFI_PASSWORD, WIFI_CHANNEL);
-    String message = "Connecting to WiFi..."; // Create message with IP
-
-    // Wait for connection
-    while (WiFi.status() != WL_CONNECTED)
-    {
-        Serial.print(".");
-        delay(500);
-    }
-    Serial.println("WiFi connected");
-    Serial.print("IP address: ");
-    Serial.println(WiFi.localIP());
+    beginWiFi();
 }
 
 void ConnectToMqtt()
@@ -49,39 +58,55 @@ void WiFiEvent(WiFiEvent_t event)
         Serial.println("WiFi connected");
         Serial.println("IP address: ");
         Serial.println(WiFi.localIP());
-        // Connection successful, retrieve IP address
+        // Connection successful, remember it for a fast reconnection
+        wifiConnected();
+        noteBootMilestone(BOOT_WIFI);
 
         ConnectToMqtt();
         break;
     case SYSTEM_EVENT_STA_DISCONNECTED:
         Serial.println("WiFi lost connection");
         mqttReconnectTimer.detach(); // ensure we don't reconnect to MQTT while reconnecting to Wi-Fi
-        wifiReconnectTimer.once(2, ConnectWiFi_STA);
+        wifiReconnectTimer.once_ms(wifiDisconnected(), ConnectWiFi_STA);
         break;
     }
 }
 
 void SuscribeMqtt()
 {
-    mqttClient.subscribe(TOPIC_LIGHT_COMMAND, 0); // Subscribe to individual light control
-    mqttClient.subscribe(TOPIC_LIGHT_EFFECT, 0);  // Subscribe to effect control
-    mqttClient.subscribe(TOPIC_LIGHT_STOP, 1);    // Subscribe to stop command
-    mqttClient.subscribe(TOPIC_CONFIG, 0);        // Subscribe to configuration
+    // Every topic of the route table, below the vehicle prefix
+    size_t count;
+    const TopicRoute *routes = getCommandRoutes(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        char topic[TOPIC_PREFIX_SIZE + MQTT_RX_TOPIC_SIZE];
+        mqttClient.subscribe(topicJoin(topic, sizeof(topic), topicPrefix, routes[i].suffix), routes[i].qos);
+    }
     Serial.print("Subscribing at QoS 1");
 }
 
 void OnMqttConnect(bool sessionPresent)
 {
     Serial.println("Connected to MQTT.");
+    mqttSession = true;
     Serial.print("Session present: ");
     Serial.println(sessionPresent);
+    noteBootMilestone(BOOT_MQTT);
     SuscribeMqtt();
-    changeState(OFF_STATE);
+    // The relays keep their state, the broker gets it back
+    resendLightState();
+    publishRelayWear();
 }
 
 void OnMqttDisconnect(AsyncMqttClientDisconnectReason reason)
 {
     Serial.println("Disconnected from MQTT.");
+    // Failed connection attempts also end here, only a lost session counts
+    if (mqttSession)
+    {
+        mqttReconnects++;
+        mqttSession = false;
+    }
 
     if (WiFi.isConnected())
     {
@@ -112,148 +137,277 @@ void OnMqttPublish(uint16_t packetId)
     Serial.println(packetId);
 }
 
-// Function to convert a 4-bit binary string to uint8_t
-uint8_t convertBinaryStringToUint8(const char *payload)
+// Longest payload accepted on a topic, larger messages are dropped before any copy
+static size_t rxLimit(const char *topic)
+{
+    if (strcmp(topic, TOPIC_CONFIG) == 0)
+    {
+        return MQTT_RX_BUFFER_SIZE;
+    }
+    if (strcmp(topic, TOPIC_LIGHT_PROGRAM) == 0)
+    {
+        return 2 * PROGRAM_MAX_LENGTH + 16; // "<slot>,<hex>,save"
+    }
+    return MQTT_RX_DEFAULT_LIMIT;
+}
+
+void OnMqttReceived(char *topic, char *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total)
 {
-    // Check if the string is exactly 4 characters long
-    if (strlen(payload) != 4)
+    // Topics of other vehicles never reach the handlers
+    const char *suffix = topicStripPrefix(topic, topicPrefix);
+    if (suffix == NULL)
     {
-        // Handle error if necessary (returns 0 by default)
-        return 0;
+        return;
     }
 
-    uint8_t result = 0;
+    // The payload may come in fragments and is not terminated, handlers get a complete copy
+    MqttRxSlot *message = mqttRxFeed(rxPool, suffix, payload, len, index, total, rxLimit(suffix));
+    if (message == NULL)
+    {
+        return;
+    }
 
-    // Iterate over each character in the string
-    for (int i = 0; i < 4; ++i)
+    // A retained command is older than the state the board restored, except right after a cold boot
+    if (properties.retain && strcmp(suffix, TOPIC_LIGHT_COMMAND) == 0 && !acceptRetainedCommand())
     {
-        result <<= 1; // Shift `result` one bit to the left
-
-        // Add the corresponding bit (0 or 1)
-        if (payload[i] == '1')
-        {
-            result |= 1;
-        }
-        else if (payload[i] != '0')
-        {
-            // Handle incorrect string (return 0 as an example)
-            return 0;
-        }
+        mqttRxRelease(message);
+        return;
     }
+    deliverLinkMessage(LINK_PATH_MQTT, suffix, message->data, message->total);
+    mqttRxRelease(message);
+}
 
-    return result;
+// Publish on a topic below the vehicle prefix, returns the packet id (0 on failure)
+static uint16_t publishTopic(const char *suffix, uint8_t qos, bool retain, const char *payload, size_t length = 0)
+{
+    char topic[TOPIC_PREFIX_SIZE + MQTT_RX_TOPIC_SIZE];
+    return mqttClient.publish(topicJoin(topic, sizeof(topic), topicPrefix, suffix), qos, retain, payload, length);
 }
 
-void OnMqttReceived(char *topic, char *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total)
+// Use "veh/<id>/" topics from now on, an empty id goes back to the global topics
+void setVehicleId(const char *vehicleId)
 {
-    // Get payload if it exists
-    if (len != 0)
+    topicSetPrefix(topicPrefix, vehicleId);
+    setEspNowVehicle(vehicleId);
+
+    // The reconnection subscribes again under the new prefix
+    if (mqttClient.connected())
     {
-        payload[len] = '\0'; // Null-terminate the string
-        //Serial.println(payload);
+        mqttClient.disconnect();
     }
+}
+
+void setMqttServer(uint32_t host, uint16_t port)
+{
+    mqttClient.setServer(IPAddress(host), port);
 
-    if (strcmp(topic, TOPIC_LIGHT_STOP) == 0)
+    // The reconnection goes to the new broker
+    if (mqttClient.connected())
     {
-        stop();
+        mqttClient.disconnect();
     }
-    else if (strcmp(topic, TOPIC_LIGHT_COMMAND) == 0)
+}
+
+// Publish the current state of the lights to the broker and the paired displays,
+// false if neither took it
+bool publishState(uint8_t state, uint16_t seq, uint32_t sentMs)
+{
+    // Numbered once for both paths, so the displays can drop the second copy. A
+    // random start keeps a reset from repeating the numbers they last saw, the
+    // displays count each board on its own.
+    static uint16_t stateSeq = (uint16_t)esp_random();
+    if (++stateSeq == 0)
     {
-        payload[len] = '\0'; // Null-terminate the string
-        //Serial.println(payload);
-        uint8_t state = convertBinaryStringToUint8(payload);
-        changeState(state);
+        stateSeq = 1;
     }
-    /*else if (strncmp(topic, "light/", 6) == 0 && strstr(topic, "/command") != NULL)
+
+    uint8_t payload[LIGHTWIRE_STATE_SIZE];
+    size_t length = wireBinary ? lightWireEncodeState(payload, sizeof(payload), LIGHTWIRE_STATE, state, {seq, sentMs}, {stateSeq, stateBoard})
+                               : snprintf((char *)payload, sizeof(payload), "%u", (unsigned)state);
+    bool direct = sendEspNow(TOPIC_LIGHT_STATE, (const char *)payload, length);
+    if (!mqttClient.connected())
     {
-        int lightIndex = topic[6] - '0'; // Extract the light number
-        WebSerial.println(lightIndex);
-        if (lightIndex >= 0 && lightIndex < 4)
-        {
-            WebSerial.print((1 << relayPins[lightIndex]));
-            if (strcmp((char *)payload, "1") == 0)
-            {
-                GPIO_REG_WRITE(GPIO_OUT_W1TS_ADDRESS, (1 << relayPins[lightIndex]));
-            }
-            else if (strcmp((char *)payload, "0") == 0)
-            {
-                GPIO_REG_WRITE(GPIO_OUT_W1TC_ADDRESS, (1 << relayPins[lightIndex]));
-            }
-
-            // Disable GPIOs
-        }
-    }*/
-    else if (strcmp(topic, TOPIC_LIGHT_EFFECT) == 0)
+        return direct;
+    }
+    return publishTopic(TOPIC_LIGHT_STATE, 0, true, (const char *)payload, length) != 0;
+}
+
+void setWireBinary(bool binary)
+{
+    wireBinary = binary;
+}
+
+bool publishRetained(const char *topic, const char *payload)
+{
+    return mqttClient.connected() && publishTopic(topic, 0, true, payload) != 0;
+}
+
+// Publish a non retained message if the broker is reachable
+void publishMessage(const char *topic, const char *payload)
+{
+    if (mqttClient.connected())
     {
-        int effect = EFFECT_COUNT;
-        int repetitions = 1;
-        int delayMs = 200;
-        bool invert = false;
-
-        // Parse the payload for effect name, repetitions, delay, and optional invert flag
-        char *effectStr = strtok((char *)payload, ",");
-        char *repetitionsStr = strtok(NULL, ",");
-        char *delayStr = strtok(NULL, ",");
-        char *invertStr = strtok(NULL, ",");
-
-        if (effectStr != NULL)
-        {
-            effect = atoi(effectStr);
-        }
-
-        if (repetitionsStr != NULL)
-        {
-            repetitions = atoi(repetitionsStr);
-        }
-        if (delayStr != NULL)
-        {
-            delayMs = atoi(delayStr);
-        }
-        if (invertStr != NULL && strcmp(invertStr, "invert") == 0)
-        {
-            invert = true;
-        }
-
-        if (repetitions <= 0)
-        {
-            repetitions = -1; // Infinite loop
-        }
-
-        playEffect(effect, repetitions, delayMs, invert);
+        publishTopic(topic, 0, false, payload);
     }
-    else if (strcmp(topic, TOPIC_CONFIG) == 0)
+}
+
+// Publish the offset and the quality of the shared timebase
+void publishSyncStatus()
+{
+    SyncStatus status;
+    getSyncStatus(status);
+
+    char payload[224];
+    snprintf(payload, sizeof(payload),
+             "{\"board\":\"%s\",\"master\":%s,\"synced\":%s,\"offset_us\":%lld,\"rtt_us\":%u,\"error_us\":%u,\"age_ms\":%u,\"late_starts\":%u,\"unsynced_starts\":%u}",
+             boardId, status.master ? "true" : "false", status.synced ? "true" : "false",
+             (long long)status.offsetUs, (unsigned)status.rttUs, (unsigned)status.errorUs,
+             (unsigned)status.ageMs, (unsigned)status.lateStarts,
+             (unsigned)status.unsyncedStarts);
+    publishMessage(TOPIC_SYNC_STATUS, payload);
+}
+
+const char *getBoardId()
+{
+    return boardId;
+}
+
+// Publish the step timing of the last finished effect, in microseconds
+void publishEffectTiming()
+{
+    EffectTiming timing;
+    if (!takeEffectTiming(timing) || !mqttClient.connected())
+    {
+        return;
+    }
+
+    char payload[96];
+    snprintf(payload, sizeof(payload), "{\"steps\":%u,\"late_avg_us\":%u,\"late_max_us\":%u,\"late_last_us\":%u}",
+             (unsigned)timing.steps,
+             (unsigned)(timing.steps ? timing.totalLateUs / timing.steps : 0),
+             (unsigned)timing.maxLateUs,
+             (unsigned)timing.lastLateUs);
+    publishTopic(TOPIC_LIGHT_TIMING, 0, false, payload);
+}
+
+// Publish the relay counters and hour meters, retained for maintenance planning
+void publishRelayWear()
+{
+    if (!mqttClient.connected())
+    {
+        return;
+    }
+
+    RelayWear wear;
+    getRelayWear(wear);
+
+    char payload[256];
+    snprintf(payload, sizeof(payload),
+             "{\"switches\":[%u,%u,%u,%u],\"on_h\":[%.2f,%.2f,%.2f,%.2f],\"dwell_ms\":[%u,%u,%u,%u],\"coalesced\":%u}",
+             (unsigned)wear.switches[0], (unsigned)wear.switches[1], (unsigned)wear.switches[2], (unsigned)wear.switches[3],
+             wear.onMs[0] / 3600000.0, wear.onMs[1] / 3600000.0, wear.onMs[2] / 3600000.0, wear.onMs[3] / 3600000.0,
+             wear.minDwellMs[0], wear.minDwellMs[1], wear.minDwellMs[2], wear.minDwellMs[3],
+             (unsigned)wear.coalesced);
+    publishTopic(TOPIC_LIGHT_WEAR, 0, true, payload);
+}
+
+// Publish the high beam latency histogram after each new sample
+void publishHbLatency()
+{
+    HbLatency latency;
+    if (!takeHbLatency(latency) || !mqttClient.connected())
+    {
+        return;
+    }
+
+    char payload[256];
+    int length = snprintf(payload, sizeof(payload), "{\"samples\":%u,\"last_us\":%u,\"max_us\":%u,\"bounces\":%u,\"overruns\":%u,\"bucket_us\":%u,\"buckets\":[",
+                          (unsigned)latency.samples, (unsigned)latency.lastUs, (unsigned)latency.maxUs,
+                          (unsigned)latency.bounces, (unsigned)latency.overruns, 32U);
+    for (uint8_t i = 0; i < HB_LATENCY_BUCKETS; i++)
     {
-        // Handle configuration
-                // Parse the JSON configuration
-        StaticJsonDocument<200> doc;
-        payload[len] = '\0'; // Null-terminate the string
-        DeserializationError error = deserializeJson(doc, payload);
-
-        if (error)
-        {
-            Serial.print(F("deserializeJson() failed: "));
-            Serial.println(error.f_str());
-            return;
-        }
-
-        // Check and update the legalMode configuration
-        if (doc.containsKey("LEGAL_MODE"))
-        {
-            // Convert value LEGAL_MODE in bool
-            legalMode = (bool)doc["LEGAL_MODE"];
-            digitalWrite(PIN_RELAY_HB, legalMode);
-        }
+        length += snprintf(payload + length, sizeof(payload) - length, i == 0 ? "%u" : ",%u", (unsigned)latency.buckets[i]);
     }
+    snprintf(payload + length, sizeof(payload) - length, "]}");
+    publishTopic(TOPIC_HB_LATENCY, 0, false, payload);
 }
 
-// Publish the current state of a light
-void publishState(uint8_t state)
+// Publish the ESP-NOW link counters, retained
+void publishLinkStatus()
 {
-    mqttClient.publish(TOPIC_LIGHT_STATE, 0, true, String(state).c_str());
+    if (!mqttClient.connected())
+    {
+        return;
+    }
+
+    EspNowStats stats;
+    getEspNowStats(stats);
+
+    char payload[128];
+    snprintf(payload, sizeof(payload), "{\"peers\":%u,\"received\":%u,\"sent\":%u,\"suppressed\":%u,\"rejected\":%u}",
+             (unsigned)stats.peers, (unsigned)stats.received, (unsigned)stats.sent, (unsigned)stats.suppressed,
+             (unsigned)stats.rejected);
+    publishTopic(TOPIC_LINK_STATUS, 0, true, payload);
+}
+
+// Publish the start-up timing once the broker is reachable, retained
+void publishBootTiming()
+{
+    BootTiming timing;
+    if (!mqttClient.connected() || !takeBootTiming(timing))
+    {
+        return;
+    }
+
+    char payload[192];
+    snprintf(payload, sizeof(payload),
+             "{\"wifi_ms\":%u,\"mqtt_ms\":%u,\"first_command_ms\":%u,\"fast\":%s,\"reset_reason\":%u,\"fast_connects\":%u,\"full_connects\":%u}",
+             (unsigned)timing.ms[BOOT_WIFI], (unsigned)timing.ms[BOOT_MQTT], (unsigned)timing.ms[BOOT_FIRST_COMMAND],
+             timing.fast ? "true" : "false", (unsigned)timing.resetReason,
+             (unsigned)timing.fastConnects, (unsigned)timing.fullConnects);
+    publishTopic(TOPIC_BOOT_TIMING, 0, true, payload);
+}
+
+void setTelemetryPeriod(uint32_t periodMs)
+{
+    telemetry.periodMs = periodMs;
+    telemetry.lastMs = millis();
+    telemetry.loops = 0;
+}
+
+void serviceTelemetry()
+{
+    if (!telemetryDue(telemetry, millis()))
+    {
+        return;
+    }
+
+    // The steps of the period whether anyone listens or not, the next one starts clean
+    EffectTiming steps;
+    takeStepTiming(steps);
+    TelemetryExtra extra = {boardId, mqttReconnects, true, steps.steps,
+                            (uint32_t)(steps.steps ? steps.totalLateUs / steps.steps : 0), steps.maxLateUs};
+    static char payload[TELEMETRY_PAYLOAD_SIZE];
+    size_t length = telemetrySample(telemetry, millis(), extra, payload, sizeof(payload));
+    if (length > 0 && mqttClient.connected())
+    {
+        publishTopic(TOPIC_TELEMETRY, 0, false, payload, length);
+    }
 }
 
 AsyncMqttClient *InitMqtt()
 {
+    uint8_t mac[6];
+    WiFi.macAddress(mac);
+    snprintf(boardId, sizeof(boardId), "%02x%02x%02x%02x%02x%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    stateBoard = (uint32_t)mac[2] << 24 | (uint32_t)mac[3] << 16 | (uint32_t)mac[4] << 8 | mac[5];
+    initTimeSync(boardId);
+    initFastWiFi();
+
+    topicSetPrefix(topicPrefix, boardConfig.vehicleId);
+    setEspNowVehicle(boardConfig.vehicleId);
+    wireBinary = boardConfig.wireBinary;
+    telemetry.periodMs = boardConfig.telemetryMs;
 
     mqttClient.onConnect(OnMqttConnect);
     mqttClient.onDisconnect(OnMqttDisconnect);
@@ -264,7 +418,7 @@ AsyncMqttClient *InitMqtt()
     mqttClient.onMessage(OnMqttReceived);
     mqttClient.onPublish(OnMqttPublish);
 
-    mqttClient.setServer(MQTT_HOST, MQTT_PORT);
+    mqttClient.setServer(IPAddress(boardConfig.mqttHost), boardConfig.mqttPort);
 
     return &mqttClient;
 }
\ No newline at end of file
@@ -5,13 +5,29 @@
 #include <WiFi.h>
 
 // MQTT connection constants
-#define MQTT_HOST IPAddress(192, 168, 2, 1) // IP address of the MQTT broker
-#define MQTT_PORT 1883                      // MQTT port
+#define WIFI_CHANNEL 6 // Fixed WiFi channel for optimized connection speed, ESP-NOW uses it too
 #define TOPIC_LIGHT_STATE "light/state"        // Topic for light control
 #define TOPIC_LIGHT_COMMAND "light/command"    // Topic for light command
 #define TOPIC_LIGHT_EFFECT "light/effect"      // Topic for light effect
 #define TOPIC_LIGHT_STOP "light/stop"          // Topic for stopping the effect
 #define TOPIC_CONFIG "config"                  // Topic for configuration
+#define TOPIC_LIGHT_TIMING "light/timing"      // Topic for effect step timing
+#define TOPIC_LIGHT_PROGRAM "light/program"    // Topic for uploading effect programs
+#define TOPIC_LIGHT_QUEUE "light/queue"        // Topic for appending an effect to the playlist
+#define TOPIC_LIGHT_QUEUE_CLEAR "light/queue/clear" // Topic for emptying the playlist
+#define TOPIC_LIGHT_QUEUE_LOOP "light/queue/loop"   // Topic for looping the playlist (STATE_ON / STATE_OFF)
+#define TOPIC_SYNC_REQUEST "light/sync/req"     // Topic for time sync requests to the master board
+#define TOPIC_SYNC_RESPONSE "light/sync/resp"   // Topic for time sync answers of the master board
+#define TOPIC_SYNC_STATUS "light/sync/status"   // Topic for the sync quality of a board
+#define TOPIC_LIGHT_RUNNING "light/running"    // Topic for the running effect summary
+#define TOPIC_HB_LATENCY "light/hb/latency"  // Topic for the high beam edge to relay latency
+#define TOPIC_LIGHT_WEAR "light/wear"          // Topic for relay switch counters and hour meters
+#define TOPIC_BOOT_TIMING "light/boot"  // Topic for the boot to ready timing
+#define TOPIC_LINK_STATUS "light/link"  // Topic for the ESP-NOW link counters
+#define TOPIC_TELEMETRY "telemetry/relays"  // Topic for the health figures of the board
+#define TELEMETRY_MS 60000                  // Telemetry period, 0 disables it
+#define VEHICLE_ID ""                       // Default vehicle, topics are "veh/<id>/..." unless empty
+#define WIRE_BINARY true                    // Default format of light/state, lightwire.h or text
 #define STATE_OFF "0"                       // State representation for off
 #define STATE_ON "1"                        // State representation for on
 
@@ -20,6 +36,23 @@ void ConnectWiFi_STA();
 AsyncMqttClient* InitMqtt();
 void ConnectToMqtt();
 void WiFiEvent(WiFiEvent_t event);
-void publishState(uint8_t state);
+// seq and sentMs echo the last numbered light/command applied
+bool publishState(uint8_t state, uint16_t seq, uint32_t sentMs);
+void setWireBinary(bool binary);
+void setVehicleId(const char *vehicleId);
+// Broker address (IPv4, first octet in the low byte), used from the next connection
+void setMqttServer(uint32_t host, uint16_t port);
+bool publishRetained(const char *topic, const char *payload);
+void publishMessage(const char *topic, const char *payload);
+void publishSyncStatus();
+const char *getBoardId();
+void publishEffectTiming();
+void publishRelayWear();
+void publishHbLatency();
+void publishLinkStatus();
+void publishBootTiming();
+// Once per loop iteration, publishes the telemetry when its period is over
+void serviceTelemetry();
+void setTelemetryPeriod(uint32_t periodMs);
 
 #endif // MQTT_HPP
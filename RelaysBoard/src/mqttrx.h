@@ -0,0 +1,114 @@
+#ifndef MQTTRX_H
+#define MQTTRX_H
+
+// Reassembly of MQTT payloads that AsyncMqttClient delivers in fragments, shared
+// by the RelaysBoard and the CYD (keep both copies identical). The pool is static:
+// a message is copied into a free slot fragment by fragment and handed out once
+// complete, NUL-terminated, never longer than the limit of its topic.
+// Define MQTT_RX_BUFFER_SIZE / MQTT_RX_SLOTS before including to size the pool.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifndef MQTT_RX_BUFFER_SIZE
+#define MQTT_RX_BUFFER_SIZE 512 // Longest payload any topic accepts
+#endif
+#ifndef MQTT_RX_SLOTS
+#define MQTT_RX_SLOTS 2 // Messages being assembled at once
+#endif
+#define MQTT_RX_TOPIC_SIZE 64
+
+struct MqttRxSlot
+{
+    bool busy;
+    char topic[MQTT_RX_TOPIC_SIZE];
+    size_t total;    // Length of the whole payload
+    size_t received; // Bytes copied so far
+    char data[MQTT_RX_BUFFER_SIZE + 1];
+};
+
+struct MqttRxPool
+{
+    MqttRxSlot slots[MQTT_RX_SLOTS];
+    uint32_t oversize;  // Messages over their topic limit, never copied
+    uint32_t dropped;   // Fragments without a slot (pool full, or out of order)
+};
+
+inline MqttRxSlot *mqttRxFind(MqttRxPool &pool, const char *topic)
+{
+    for (uint8_t i = 0; i < MQTT_RX_SLOTS; i++)
+    {
+        if (pool.slots[i].busy && strcmp(pool.slots[i].topic, topic) == 0)
+        {
+            return &pool.slots[i];
+        }
+    }
+    return NULL;
+}
+
+// Add one fragment (the arguments of the onMessage callback). Returns the slot once
+// the message is complete, hand it back with mqttRxRelease() after handling it.
+inline MqttRxSlot *mqttRxFeed(MqttRxPool &pool, const char *topic, const char *payload,
+                              size_t len, size_t index, size_t total, size_t limit)
+{
+    if (limit > MQTT_RX_BUFFER_SIZE)
+    {
+        limit = MQTT_RX_BUFFER_SIZE;
+    }
+
+    MqttRxSlot *slot = mqttRxFind(pool, topic);
+    if (index == 0)
+    {
+        // A new message on the topic replaces one that never completed
+        if (slot != NULL)
+        {
+            slot->busy = false;
+            pool.dropped++;
+        }
+        if (total > limit || strlen(topic) >= MQTT_RX_TOPIC_SIZE)
+        {
+            pool.oversize++;
+            return NULL;
+        }
+        for (uint8_t i = 0; slot == NULL && i < MQTT_RX_SLOTS; i++)
+        {
+            slot = pool.slots[i].busy ? NULL : &pool.slots[i];
+        }
+        if (slot == NULL)
+        {
+            pool.dropped++;
+            return NULL;
+        }
+        slot->busy = true;
+        strcpy(slot->topic, topic);
+        slot->total = total;
+        slot->received = 0;
+    }
+
+    // Fragments must follow each other and stay within the announced length
+    if (slot == NULL || index != slot->received || index + len > slot->total)
+    {
+        if (slot != NULL)
+        {
+            slot->busy = false;
+        }
+        pool.dropped++;
+        return NULL;
+    }
+    memcpy(slot->data + index, payload, len);
+    slot->received += len;
+    if (slot->received < slot->total)
+    {
+        return NULL;
+    }
+    slot->data[slot->total] = '\0';
+    return slot;
+}
+
+inline void mqttRxRelease(MqttRxSlot *slot)
+{
+    slot->busy = false;
+}
+
+#endif // MQTTRX_H
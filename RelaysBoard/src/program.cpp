@@ -0,0 +1,235 @@
+#include "program.hpp"
+#include <Arduino.h>
+#include <Preferences.h>
+
+#define PROGRAM_NAMESPACE "programs"
+
+// Instruction sizes in bytes, indexed by opcode
+static const uint8_t opLength[OP_COUNT] = {
+    1, // OP_END
+    2, // OP_SET
+    2, // OP_XOR
+    2, // OP_SHL
+    2, // OP_SHR
+    2, // OP_ROL
+    2, // OP_ROR
+    3, // OP_WAIT
+    2, // OP_REPEAT
+    1, // OP_NEXT
+    2, // OP_JUMP
+};
+
+static portMUX_TYPE programMux = portMUX_INITIALIZER_UNLOCKED;
+uint8_t programSlots[PROGRAM_SLOTS][PROGRAM_MAX_LENGTH];
+uint8_t programLengths[PROGRAM_SLOTS];
+
+static uint8_t rotateLeft(uint8_t mask, uint8_t count)
+{
+    count &= 3;
+    return ((mask << count) | (mask >> (4 - count))) & PROGRAM_MASK;
+}
+
+void programStart(ProgramState &vm, const uint8_t *code, size_t length)
+{
+    vm.code = code;
+    vm.length = (uint8_t)length;
+    vm.pc = 0;
+    vm.mask = 0;
+    vm.depth = 0;
+}
+
+ProgramResult programStep(ProgramState &vm, uint8_t &mask, uint16_t &waitMs)
+{
+    for (int ops = 0; ops < PROGRAM_MAX_OPS_PER_STEP; ops++)
+    {
+        if (vm.pc >= vm.length)
+        {
+            return PROGRAM_DONE;
+        }
+
+        uint8_t op = vm.code[vm.pc];
+        if (op >= OP_COUNT || vm.pc + opLength[op] > vm.length)
+        {
+            return PROGRAM_FAULT;
+        }
+        uint8_t arg = opLength[op] > 1 ? vm.code[vm.pc + 1] : 0;
+        vm.pc += opLength[op];
+
+        switch (op)
+        {
+        case OP_END:
+            return PROGRAM_DONE;
+        case OP_SET:
+            vm.mask = arg & PROGRAM_MASK;
+            break;
+        case OP_XOR:
+            vm.mask = (vm.mask ^ arg) & PROGRAM_MASK;
+            break;
+        case OP_SHL:
+            vm.mask = (vm.mask << (arg & 7)) & PROGRAM_MASK;
+            break;
+        case OP_SHR:
+            vm.mask = vm.mask >> (arg & 7);
+            break;
+        case OP_ROL:
+            vm.mask = rotateLeft(vm.mask, arg);
+            break;
+        case OP_ROR:
+            vm.mask = rotateLeft(vm.mask, 4 - (arg & 3));
+            break;
+        case OP_WAIT:
+            mask = vm.mask;
+            waitMs = arg | (vm.code[vm.pc - 1] << 8);
+            return PROGRAM_FRAME;
+        case OP_REPEAT:
+            if (vm.depth >= PROGRAM_LOOP_DEPTH || arg == 0)
+            {
+                return PROGRAM_FAULT;
+            }
+            vm.loopStart[vm.depth] = vm.pc;
+            vm.loopCount[vm.depth] = arg;
+            vm.depth++;
+            break;
+        case OP_NEXT:
+            if (vm.depth == 0)
+            {
+                return PROGRAM_FAULT;
+            }
+            if (--vm.loopCount[vm.depth - 1] > 0)
+            {
+                vm.pc = vm.loopStart[vm.depth - 1];
+            }
+            else
+            {
+                vm.depth--;
+            }
+            break;
+        case OP_JUMP:
+            vm.pc = arg;
+            break;
+        }
+    }
+
+    // No frame within the budget, the program would hog the effect task
+    return PROGRAM_FAULT;
+}
+
+bool programValidate(const uint8_t *code, size_t length)
+{
+    if (code == NULL || length == 0 || length > PROGRAM_MAX_LENGTH)
+    {
+        return false;
+    }
+
+    // First pass: decode every instruction and remember where they start
+    uint64_t boundaries = 0;
+    bool hasWait = false;
+    int depth = 0;
+    size_t pc = 0;
+    while (pc < length)
+    {
+        uint8_t op = code[pc];
+        if (op >= OP_COUNT || pc + opLength[op] > length)
+        {
+            return false;
+        }
+        boundaries |= 1ULL << pc;
+
+        uint8_t arg = opLength[op] > 1 ? code[pc + 1] : 0;
+        switch (op)
+        {
+        case OP_SET:
+        case OP_XOR:
+            if (arg > PROGRAM_MASK)
+            {
+                return false;
+            }
+            break;
+        case OP_WAIT:
+            hasWait = true;
+            break;
+        case OP_REPEAT:
+            if (arg == 0 || ++depth > PROGRAM_LOOP_DEPTH)
+            {
+                return false;
+            }
+            break;
+        case OP_NEXT:
+            if (--depth < 0)
+            {
+                return false;
+            }
+            break;
+        }
+        pc += opLength[op];
+    }
+    if (!hasWait || depth != 0)
+    {
+        return false;
+    }
+
+    // Second pass: jumps must land on an instruction
+    for (pc = 0; pc < length; pc += opLength[code[pc]])
+    {
+        if (code[pc] == OP_JUMP && (code[pc + 1] >= length || !(boundaries & (1ULL << code[pc + 1]))))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool programStore(uint8_t slot, const uint8_t *code, size_t length, bool persist)
+{
+    if (slot >= PROGRAM_SLOTS || !programValidate(code, length))
+    {
+        return false;
+    }
+
+    portENTER_CRITICAL(&programMux);
+    memcpy(programSlots[slot], code, length);
+    programLengths[slot] = length;
+    portEXIT_CRITICAL(&programMux);
+
+    if (persist)
+    {
+        Preferences preferences;
+        char key[4] = {'p', (char)('0' + slot), '\0'};
+        preferences.begin(PROGRAM_NAMESPACE, false);
+        preferences.putBytes(key, code, length);
+        preferences.end();
+    }
+    return true;
+}
+
+size_t programLoad(uint8_t slot, uint8_t *buffer)
+{
+    if (slot >= PROGRAM_SLOTS)
+    {
+        return 0;
+    }
+
+    portENTER_CRITICAL(&programMux);
+    size_t length = programLengths[slot];
+    memcpy(buffer, programSlots[slot], length);
+    portEXIT_CRITICAL(&programMux);
+    return length;
+}
+
+// Restore the programs saved in NVS
+void loadPrograms()
+{
+    Preferences preferences;
+    preferences.begin(PROGRAM_NAMESPACE, true);
+    for (uint8_t slot = 0; slot < PROGRAM_SLOTS; slot++)
+    {
+        char key[4] = {'p', (char)('0' + slot), '\0'};
+        uint8_t code[PROGRAM_MAX_LENGTH];
+        if (preferences.isKey(key))
+        {
+            size_t length = preferences.getBytes(key, code, sizeof(code));
+            programStore(slot, code, length, false);
+        }
+    }
+    preferences.end();
+}
@@ -0,0 +1,98 @@
+#ifndef PROGRAM_HPP
+#define PROGRAM_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Effect bytecode, interpreted by updateEffect().
+// A program drives a 4-bit relay mask and shows it with WAIT:
+//   OP_SET m       mask = m
+//   OP_XOR m       mask ^= m
+//   OP_SHL n       mask <<= n (bits shifted out of the 4 relays are lost)
+//   OP_SHR n       mask >>= n
+//   OP_ROL n       rotate the 4 relays left by n
+//   OP_ROR n       rotate the 4 relays right by n
+//   OP_WAIT lo hi  write mask to the relays and hold it lo + 256 * hi ms (0 = effect delay)
+//   OP_REPEAT n    run the instructions up to the matching OP_NEXT n times (1..255)
+//   OP_NEXT        end of a REPEAT body
+//   OP_JUMP a      continue at byte offset a
+//   OP_END         end of one repetition of the effect (also implied after the last byte)
+enum ProgramOpcode
+{
+    OP_END = 0x00,
+    OP_SET = 0x01,
+    OP_XOR = 0x02,
+    OP_SHL = 0x03,
+    OP_SHR = 0x04,
+    OP_ROL = 0x05,
+    OP_ROR = 0x06,
+    OP_WAIT = 0x07,
+    OP_REPEAT = 0x08,
+    OP_NEXT = 0x09,
+    OP_JUMP = 0x0A,
+    OP_COUNT
+};
+
+#define PROGRAM_MAX_LENGTH 64      // Bytes per uploaded program
+#define PROGRAM_SLOTS 4            // Uploadable programs kept in RAM (and NVS when saved)
+#define PROGRAM_LOOP_DEPTH 4       // Nested REPEAT levels
+#define PROGRAM_MAX_OPS_PER_STEP 32 // Bounds the work of one step, a program looping without WAIT faults
+#define PROGRAM_MASK 0b1111
+
+enum ProgramResult
+{
+    PROGRAM_FRAME, // A mask to show for waitMs
+    PROGRAM_DONE,  // OP_END reached, one repetition finished
+    PROGRAM_FAULT  // Bad opcode, bad loop nesting or no WAIT within the step budget
+};
+
+struct ProgramState
+{
+    const uint8_t *code;
+    uint8_t length;
+    uint8_t pc;
+    uint8_t mask;
+    uint8_t depth;
+    uint8_t loopStart[PROGRAM_LOOP_DEPTH];
+    uint8_t loopCount[PROGRAM_LOOP_DEPTH];
+};
+
+// Start a program from its first instruction
+void programStart(ProgramState &vm, const uint8_t *code, size_t length);
+// Run until the next frame or the end of the program
+ProgramResult programStep(ProgramState &vm, uint8_t &mask, uint16_t &waitMs);
+// Check an uploaded program before it can be played
+bool programValidate(const uint8_t *code, size_t length);
+
+// Uploaded program slots
+bool programStore(uint8_t slot, const uint8_t *code, size_t length, bool persist);
+// Copy a slot into buffer, returns its length or 0 if empty
+size_t programLoad(uint8_t slot, uint8_t *buffer);
+void loadPrograms();
+
+// Compile a pattern into "SET p0, WAIT 0, SET p1, WAIT 0, ..., END" at compile time,
+// so built-in effects play through the same interpreter from flash
+template <size_t N>
+struct PatternProgram
+{
+    uint8_t code[N * 5 + 1];
+};
+
+template <size_t N>
+constexpr PatternProgram<N> compilePattern(const uint8_t (&pattern)[N])
+{
+    PatternProgram<N> program = {};
+    size_t pc = 0;
+    for (size_t i = 0; i < N; i++)
+    {
+        program.code[pc++] = OP_SET;
+        program.code[pc++] = pattern[i] & PROGRAM_MASK;
+        program.code[pc++] = OP_WAIT;
+        program.code[pc++] = 0;
+        program.code[pc++] = 0;
+    }
+    program.code[pc] = OP_END;
+    return program;
+}
+
+#endif // PROGRAM_HPP
@@ -0,0 +1,184 @@
+#include "rmtout.hpp"
+#include "waveform.hpp"
+#include "light.hpp"
+#include "wear.hpp"
+#include "config.hpp"
+#include <Arduino.h>
+#include <driver/rmt.h>
+#include <esp_rom_gpio.h>
+#include <esp_timer.h>
+
+#define RMT_CLOCK_DIV (RMT_TICK_US)   // REF_TICK runs at 1 MHz
+#define RMT_MEM_BLOCKS 2              // Channels 0, 2, 4 and 6 get two blocks each
+#define RMT_MAX_ITEMS (RMT_MEM_BLOCKS * 64 - 1) // The driver adds the end marker
+#define RMT_MAX_HALF_TICKS 32767
+
+static uint8_t rmtPins[RELAY_COUNT]; // Pins of the configuration at boot
+static const rmt_channel_t rmtChannels[RELAY_COUNT] = {RMT_CHANNEL_0, RMT_CHANNEL_2, RMT_CHANNEL_4, RMT_CHANNEL_6};
+
+// Playback in progress, effect task only
+bool rmtPlaying = false;
+RmtFrame rmtFrames[RMT_MAX_FRAMES];
+size_t rmtFrameCount = 0;
+uint8_t rmtInitialState = OFF_STATE;
+uint64_t rmtCycleUs = 0;
+uint64_t rmtStartUs = 0;
+uint64_t rmtDurationUs = 0;
+rmt_item32_t rmtItems[RMT_MAX_ITEMS];
+
+void initRmtOutput()
+{
+    memcpy(rmtPins, boardConfig.relayPins, sizeof(rmtPins));
+    for (uint8_t i = 0; i < RELAY_COUNT; i++)
+    {
+        rmt_config_t config = RMT_DEFAULT_CONFIG_TX((gpio_num_t)rmtPins[i], rmtChannels[i]);
+        config.mem_block_num = RMT_MEM_BLOCKS;
+        config.clk_div = RMT_CLOCK_DIV;
+        config.flags = RMT_CHANNEL_FLAGS_AWARE_DFS;
+        config.tx_config.loop_en = true;
+        config.tx_config.idle_output_en = true;
+        rmt_config(&config);
+        rmt_driver_install(rmtChannels[i], 0, 0);
+
+        // rmt_config() routed the pin to the RMT, the GPIO registers keep it until an effect is offloaded
+        esp_rom_gpio_connect_out_signal(rmtPins[i], SIG_GPIO_OUT_IDX, false, false);
+    }
+}
+
+// Run-length encode one channel of the frames into items, both halves of an
+// item at the same level. Returns the item count, 0 if it does not fit.
+static size_t buildChannelItems(uint8_t bit)
+{
+    size_t count = 0;
+    size_t frame = 0;
+    while (frame < rmtFrameCount)
+    {
+        bool level = rmtFrames[frame].mask & bit;
+        uint32_t ticks = 0;
+        while (frame < rmtFrameCount && (bool)(rmtFrames[frame].mask & bit) == level)
+        {
+            ticks += rmtFrames[frame++].durationUs / RMT_TICK_US;
+        }
+
+        while (ticks > 0)
+        {
+            if (count == RMT_MAX_ITEMS || ticks < 2)
+            {
+                return 0;
+            }
+            // A zero duration ends the waveform, so both halves always get some
+            uint32_t itemTicks = ticks > 2 * RMT_MAX_HALF_TICKS ? 2 * RMT_MAX_HALF_TICKS : ticks;
+            if (ticks - itemTicks == 1)
+            {
+                itemTicks--;
+            }
+            rmtItems[count].level0 = level;
+            rmtItems[count].duration0 = itemTicks - itemTicks / 2;
+            rmtItems[count].level1 = level;
+            rmtItems[count].duration1 = itemTicks / 2;
+            count++;
+            ticks -= itemTicks;
+        }
+    }
+    return count;
+}
+
+bool rmtPlay(const RmtFrame *frames, size_t count, uint8_t currentState, unsigned long durationUs)
+{
+    if (rmtPlaying)
+    {
+        currentState = rmtStop();
+    }
+    if (count == 0 || count > RMT_MAX_FRAMES)
+    {
+        return false;
+    }
+
+    rmtCycleUs = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (frames[i].durationUs % RMT_TICK_US != 0)
+        {
+            return false;
+        }
+        rmtFrames[i] = frames[i];
+        rmtCycleUs += frames[i].durationUs;
+    }
+    rmtFrameCount = count;
+
+    // Every channel must fit before any of them starts
+    for (uint8_t i = 0; i < RELAY_COUNT; i++)
+    {
+        if (buildChannelItems(1 << i) == 0)
+        {
+            return false;
+        }
+    }
+
+    // Idle at the current level while the pin moves over to the RMT, then start
+    rmtInitialState = currentState;
+    rmtStartUs = esp_timer_get_time();
+    for (uint8_t i = 0; i < RELAY_COUNT; i++)
+    {
+        size_t items = buildChannelItems(1 << i);
+        rmt_set_idle_level(rmtChannels[i], true, (currentState >> i) & 1 ? RMT_IDLE_LEVEL_HIGH : RMT_IDLE_LEVEL_LOW);
+        rmt_set_tx_loop_mode(rmtChannels[i], true);
+        rmt_set_gpio(rmtChannels[i], RMT_MODE_TX, (gpio_num_t)rmtPins[i], false);
+        rmt_write_items(rmtChannels[i], rmtItems, items, false);
+    }
+    rmtDurationUs = durationUs;
+    rmtPlaying = true;
+    return true;
+}
+
+bool rmtActive()
+{
+    return rmtPlaying;
+}
+
+// Past its planned end the waveform may have wrapped for a few microseconds, not enough to move a relay
+static uint64_t rmtElapsedUs()
+{
+    uint64_t elapsedUs = esp_timer_get_time() - rmtStartUs;
+    if (rmtDurationUs != 0 && elapsedUs >= rmtDurationUs)
+    {
+        elapsedUs = rmtDurationUs - 1;
+    }
+    return elapsedUs;
+}
+
+uint8_t rmtCurrentFrame(uint32_t &cycles, uint8_t &frame, unsigned long &nextFrameUs)
+{
+    WaveformPosition position;
+    waveformPosition(rmtFrames, rmtFrameCount, rmtCycleUs, rmtElapsedUs(), position);
+    cycles = (uint32_t)position.cycles;
+    frame = (uint8_t)position.frame;
+    nextFrameUs = (unsigned long)(position.frameStartUs + rmtFrames[position.frame].durationUs - position.offsetUs);
+    return rmtFrames[position.frame].mask;
+}
+
+uint8_t rmtStop()
+{
+    if (!rmtPlaying)
+    {
+        return OFF_STATE;
+    }
+    uint64_t elapsedUs = rmtElapsedUs();
+    for (uint8_t i = 0; i < RELAY_COUNT; i++)
+    {
+        rmt_tx_stop(rmtChannels[i]);
+    }
+    rmtPlaying = false;
+
+    // Where playback stopped, the wear counters get its transitions
+    uint8_t state = accountWaveform(rmtFrames, rmtFrameCount, rmtCycleUs, rmtInitialState, (unsigned long)rmtStartUs, elapsedUs);
+
+    // The GPIO registers take over at the same levels
+    GPIO_REG_WRITE(GPIO_OUT_W1TS_REG, relayGpioMasks[state & 0x0F]);
+    GPIO_REG_WRITE(GPIO_OUT_W1TC_REG, relayGpioMasks[~state & 0x0F]);
+    for (uint8_t i = 0; i < RELAY_COUNT; i++)
+    {
+        esp_rom_gpio_connect_out_signal(rmtPins[i], SIG_GPIO_OUT_IDX, false, false);
+    }
+    return state;
+}
@@ -0,0 +1,34 @@
+#ifndef RMTOUT_HPP
+#define RMTOUT_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+// RMT output backend: an effect whose frames fit is compiled into one looping
+// waveform per relay channel and played by the peripheral. The effect task only
+// wakes up at its frames to publish them, and at its end. Any changeState()
+// takes the pins back first.
+#define RMT_MAX_FRAMES 32        // Frames of one repetition that can be offloaded
+#define RMT_TICK_US 100          // REF_TICK / 100, steady across CPU frequency changes
+#define RMT_MAX_PLAY_US 1200000000UL // Longer finite effects stay on the CPU (deadlines are 32-bit)
+
+struct RmtFrame
+{
+    uint8_t mask;
+    unsigned long durationUs;
+};
+
+void initRmtOutput();
+// Loop the frames on the relay pins from now, currentState being what the relays
+// show. durationUs is when the engine will stop it (0 = until stopped), for the
+// accounting. False if the waveform does not fit, the engine then plays it.
+bool rmtPlay(const RmtFrame *frames, size_t count, uint8_t currentState, unsigned long durationUs);
+bool rmtActive();
+// Frame the waveform shows now: its mask, the repetitions played before it, its
+// index in the frames and the microseconds until the next one
+uint8_t rmtCurrentFrame(uint32_t &cycles, uint8_t &frame, unsigned long &nextFrameUs);
+// Stop playback, leave the relays as they are and hand the pins back to the
+// GPIO registers. Returns the relay state, its transitions go to the wear counters.
+uint8_t rmtStop();
+
+#endif // RMTOUT_HPP
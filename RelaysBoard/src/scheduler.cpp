@@ -0,0 +1,70 @@
+#include "scheduler.hpp"
+#include "light.hpp"
+#include <Arduino.h>
+#include <esp_timer.h>
+
+static TaskHandle_t effectTask = NULL;
+static esp_timer_handle_t stepTimer = NULL;
+
+// Runs in the esp_timer task at the step deadline
+static void onStepTimer(void *arg)
+{
+    xTaskNotifyGive(effectTask);
+}
+
+static void effectTaskMain(void *arg)
+{
+    for (;;)
+    {
+        unsigned long waitUs = updateEffect();
+        if (waitUs == 0)
+        {
+            continue;
+        }
+
+        esp_timer_stop(stepTimer); // Not running is fine
+        if (waitUs != EFFECT_IDLE)
+        {
+            esp_timer_start_once(stepTimer, waitUs);
+        }
+
+        // Sleep until the deadline or until a command or the high beam input wakes us
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+}
+
+void startEffectScheduler()
+{
+    const esp_timer_create_args_t timerArgs = {
+        .callback = onStepTimer,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "effectStep",
+    };
+    esp_timer_create(&timerArgs, &stepTimer);
+
+    xTaskCreatePinnedToCore(effectTaskMain, "effect", EFFECT_TASK_STACK, NULL,
+                            EFFECT_TASK_PRIORITY, &effectTask, EFFECT_TASK_CORE);
+}
+
+void wakeEffectScheduler()
+{
+    if (effectTask != NULL)
+    {
+        xTaskNotifyGive(effectTask);
+    }
+}
+
+void IRAM_ATTR wakeEffectSchedulerFromISR()
+{
+    if (effectTask == NULL)
+    {
+        return;
+    }
+    BaseType_t higherPriorityTaskWoken = pdFALSE;
+    vTaskNotifyGiveFromISR(effectTask, &higherPriorityTaskWoken);
+    if (higherPriorityTaskWoken)
+    {
+        portYIELD_FROM_ISR();
+    }
+}
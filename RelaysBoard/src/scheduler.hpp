@@ -0,0 +1,15 @@
+#ifndef SCHEDULER_HPP
+#define SCHEDULER_HPP
+
+// The effect engine runs in its own task on the APP core, away from WiFi and lwIP
+// on the PRO core, and sleeps until an esp_timer fires at the next step deadline.
+#define EFFECT_TASK_CORE 1
+#define EFFECT_TASK_PRIORITY 20
+#define EFFECT_TASK_STACK 4096
+
+void startEffectScheduler();
+// Make the effect task run updateEffect() now, e.g. after a command
+void wakeEffectScheduler();
+void wakeEffectSchedulerFromISR();
+
+#endif // SCHEDULER_HPP
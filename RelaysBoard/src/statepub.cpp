@@ -0,0 +1,159 @@
+#include "statepub.hpp"
+#include <Arduino.h>
+#include "light.hpp"
+#include "mqtt.hpp"
+
+#define STATE_NONE 0xFF // Never a relay frame, forces the next publish
+
+portMUX_TYPE statePublishMux = portMUX_INITIALIZER_UNLOCKED;
+
+uint8_t latestState = OFF_STATE; // Latest frame written to the relays
+uint8_t stateToPublish = OFF_STATE;
+bool stateToPublishPending = false;
+uint16_t appliedSeq = 0; // Last numbered command applied, echoed with light/state
+uint32_t appliedSentMs = 0;
+uint8_t lastPublishedState = STATE_NONE;
+unsigned long lastStatePublishUs = 0;
+unsigned long statePublishIntervalUs = STATE_PUBLISH_DEFAULT_MS * 1000UL;
+
+EffectSummary pendingSummary = {false, -1, 0, 0, 0};
+bool summaryPending = false;
+
+StatePublishStats publishStats = {0, 0, 0, 0};
+
+void noteLightState(uint8_t state)
+{
+    portENTER_CRITICAL(&statePublishMux);
+    if (stateToPublishPending && stateToPublish != state)
+    {
+        publishStats.coalesced++;
+    }
+    latestState = state;
+    stateToPublish = state;
+    stateToPublishPending = true;
+    portEXIT_CRITICAL(&statePublishMux);
+}
+
+void noteEffectSummary(const EffectSummary &summary)
+{
+    portENTER_CRITICAL(&statePublishMux);
+    pendingSummary = summary;
+    summaryPending = true;
+    portEXIT_CRITICAL(&statePublishMux);
+}
+
+void noteCommandApplied(uint16_t seq, uint32_t sentMs)
+{
+    portENTER_CRITICAL(&statePublishMux);
+    appliedSeq = seq;
+    appliedSentMs = sentMs;
+    // Even when the state did not change, and without waiting for the interval
+    stateToPublish = latestState;
+    stateToPublishPending = true;
+    lastPublishedState = STATE_NONE;
+    portEXIT_CRITICAL(&statePublishMux);
+}
+
+void setStatePublishInterval(uint16_t intervalMs)
+{
+    portENTER_CRITICAL(&statePublishMux);
+    statePublishIntervalUs = (unsigned long)intervalMs * 1000UL;
+    portEXIT_CRITICAL(&statePublishMux);
+}
+
+void resendLightState()
+{
+    portENTER_CRITICAL(&statePublishMux);
+    stateToPublish = latestState;
+    stateToPublishPending = true;
+    lastPublishedState = STATE_NONE;
+    summaryPending = true;
+    portEXIT_CRITICAL(&statePublishMux);
+}
+
+void getStatePublishStats(StatePublishStats &stats)
+{
+    portENTER_CRITICAL(&statePublishMux);
+    stats = publishStats;
+    portEXIT_CRITICAL(&statePublishMux);
+}
+
+// The latest frame if it differs from light/state and the interval has passed
+static bool takeDueState(uint8_t &state, uint16_t &seq, uint32_t &sentMs, unsigned long &waitUs)
+{
+    unsigned long now = micros();
+    bool due = false;
+    waitUs = EFFECT_IDLE;
+
+    portENTER_CRITICAL(&statePublishMux);
+    if (stateToPublishPending && stateToPublish == lastPublishedState)
+    {
+        stateToPublishPending = false;
+        publishStats.unchanged++;
+    }
+    else if (stateToPublishPending)
+    {
+        unsigned long elapsedUs = now - lastStatePublishUs;
+        if (lastPublishedState == STATE_NONE || elapsedUs >= statePublishIntervalUs)
+        {
+            state = stateToPublish;
+            seq = appliedSeq;
+            sentMs = appliedSentMs;
+            stateToPublishPending = false;
+            lastPublishedState = state;
+            lastStatePublishUs = now;
+            publishStats.published++;
+            due = true;
+        }
+        else
+        {
+            waitUs = statePublishIntervalUs - elapsedUs;
+        }
+    }
+    portEXIT_CRITICAL(&statePublishMux);
+    return due;
+}
+
+static void statePublishFailed()
+{
+    portENTER_CRITICAL(&statePublishMux);
+    publishStats.published--;
+    publishStats.dropped++;
+    lastPublishedState = STATE_NONE;
+    portEXIT_CRITICAL(&statePublishMux);
+}
+
+unsigned long serviceStatePublish()
+{
+    uint8_t state;
+    uint16_t seq;
+    uint32_t sentMs;
+    unsigned long waitUs;
+    if (takeDueState(state, seq, sentMs, waitUs) && !publishState(state, seq, sentMs))
+    {
+        statePublishFailed();
+    }
+
+    if (!summaryPending)
+    {
+        return waitUs;
+    }
+
+    EffectSummary summary;
+    StatePublishStats stats;
+    portENTER_CRITICAL(&statePublishMux);
+    summary = pendingSummary;
+    summaryPending = false;
+    stats = publishStats;
+    portEXIT_CRITICAL(&statePublishMux);
+
+    char payload[192];
+    snprintf(payload, sizeof(payload),
+             "{\"running\":%s,\"effect\":%d,\"repetitions\":%d,\"delay_ms\":%u,\"flags\":%u,"
+             "\"published\":%u,\"unchanged\":%u,\"coalesced\":%u,\"dropped\":%u}",
+             summary.running ? "true" : "false", summary.effectName, summary.repetitions,
+             (unsigned)summary.delayMs, (unsigned)summary.flags,
+             (unsigned)stats.published, (unsigned)stats.unchanged, (unsigned)stats.coalesced, (unsigned)stats.dropped);
+    publishRetained(TOPIC_LIGHT_RUNNING, payload);
+    return waitUs;
+}
@@ -0,0 +1,44 @@
+#ifndef STATEPUB_HPP
+#define STATEPUB_HPP
+
+#include <stdint.h>
+
+// light/state publishing, decoupled from the relay outputs. changeState() only
+// notes the new frame, loop() publishes the latest one at most every
+// STATE_PUBLISH_DEFAULT_MS and skips frames equal to the last one published.
+#define STATE_PUBLISH_DEFAULT_MS 100 // Shortest time between two light/state publishes
+
+// Counters since boot, sent with the light/running summary
+struct StatePublishStats
+{
+    uint32_t published; // light/state messages handed to the client
+    uint32_t unchanged; // Frames skipped because light/state already had them
+    uint32_t coalesced; // Frames replaced by a newer one before their turn
+    uint32_t dropped;   // Publishes the client refused (not connected, queue full)
+};
+
+// What light/running reports, so observers don't have to follow every step
+struct EffectSummary
+{
+    bool running;
+    int effectName;
+    int repetitions;
+    uint16_t delayMs;
+    uint8_t flags;
+};
+
+// Effect task side
+void noteLightState(uint8_t state);
+void noteEffectSummary(const EffectSummary &summary);
+// A numbered light/command was applied, light/state echoes it right away
+void noteCommandApplied(uint16_t seq, uint32_t sentMs);
+
+void setStatePublishInterval(uint16_t intervalMs);
+// Publish the current state and summary again, after a (re)connection
+void resendLightState();
+void getStatePublishStats(StatePublishStats &stats);
+// Publish what is due, returns the microseconds until the held back state is
+// (EFFECT_IDLE if nothing waits). Call from loop().
+unsigned long serviceStatePublish();
+
+#endif // STATEPUB_HPP
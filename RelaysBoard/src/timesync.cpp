@@ -0,0 +1,195 @@
+#include "timesync.hpp"
+#include "mqtt.hpp"
+#include <Arduino.h>
+#include "config.hpp"
+#ifdef ESP32
+#include <esp_timer.h>
+#endif
+
+
+struct SyncSample
+{
+    int64_t offsetUs;
+    uint32_t rttUs;
+    uint64_t timeUs; // Local time of the exchange
+};
+
+static portMUX_TYPE syncMux = portMUX_INITIALIZER_UNLOCKED;
+char syncBoardId[16];
+bool syncMaster = false;
+SyncSample syncSamples[SYNC_SAMPLES];
+uint8_t syncSampleCount = 0;
+uint8_t syncSampleNext = 0;
+SyncSample syncBest; // Lowest round trip among syncSamples
+uint64_t syncRequestUs = 0; // t1 of the request awaiting an answer
+unsigned long lastSyncRequestMs = 0;
+uint32_t syncLateStarts = 0;
+uint32_t syncUnsyncedStarts = 0;
+bool syncChanged = false;
+
+void initTimeSync(const char *boardId)
+{
+    strncpy(syncBoardId, boardId, sizeof(syncBoardId) - 1);
+    syncBoardId[sizeof(syncBoardId) - 1] = '\0';
+
+    syncMaster = boardConfig.syncMaster;
+}
+
+void setSyncMaster(bool master)
+{
+    if (master == syncMaster)
+    {
+        return;
+    }
+    portENTER_CRITICAL(&syncMux);
+    syncMaster = master;
+    syncSampleCount = 0;
+    syncChanged = true;
+    portEXIT_CRITICAL(&syncMux);
+}
+
+uint64_t localClockUs()
+{
+#ifdef ESP32
+    return esp_timer_get_time();
+#else
+    return micros(); // 64 bits on the host
+#endif
+}
+
+uint64_t sharedClockUs()
+{
+    portENTER_CRITICAL(&syncMux);
+    int64_t offsetUs = syncMaster || syncSampleCount == 0 ? 0 : syncBest.offsetUs;
+    portEXIT_CRITICAL(&syncMux);
+    return localClockUs() + offsetUs;
+}
+
+bool sharedToLocalMicros(uint64_t startMs, unsigned long &localUs)
+{
+    unsigned long nowUs = micros();
+    int64_t leadUs = (int64_t)(startMs * 1000ULL - sharedClockUs());
+    localUs = nowUs;
+
+    // Without an exchange the shared time is the own uptime, startMs means nothing
+    portENTER_CRITICAL(&syncMux);
+    bool synced = syncMaster || syncSampleCount > 0;
+    bool usable = synced && leadUs >= 0 && leadUs <= (int64_t)SYNC_MAX_LEAD_MS * 1000;
+    if (!synced)
+    {
+        syncUnsyncedStarts++;
+    }
+    else if (!usable)
+    {
+        syncLateStarts++;
+    }
+    syncChanged |= !usable;
+    portEXIT_CRITICAL(&syncMux);
+    if (!usable)
+    {
+        return false;
+    }
+    localUs = nowUs + (unsigned long)leadUs;
+    return true;
+}
+
+// Master: answer "<board id>,<t1>" with "<board id>,<t1>,<t2>"
+void handleSyncRequest(char *payload)
+{
+    uint64_t t2 = localClockUs();
+    if (!syncMaster)
+    {
+        return;
+    }
+
+    char *idStr = strtok(payload, ",");
+    char *t1Str = strtok(NULL, ",");
+    if (idStr == NULL || t1Str == NULL)
+    {
+        return;
+    }
+
+    char response[64];
+    snprintf(response, sizeof(response), "%s,%s,%llu", idStr, t1Str, (unsigned long long)t2);
+    publishMessage(TOPIC_SYNC_RESPONSE, response);
+}
+
+void handleSyncResponse(char *payload)
+{
+    uint64_t t4 = localClockUs();
+    char *idStr = strtok(payload, ",");
+    char *t1Str = strtok(NULL, ",");
+    char *t2Str = strtok(NULL, ",");
+    if (syncMaster || idStr == NULL || t1Str == NULL || t2Str == NULL || strcmp(idStr, syncBoardId) != 0)
+    {
+        return;
+    }
+
+    // Only the answer to the last request counts, late answers would skew the offset
+    uint64_t t1 = strtoull(t1Str, NULL, 10);
+    uint64_t t2 = strtoull(t2Str, NULL, 10);
+    if (t1 != syncRequestUs || t4 < t1)
+    {
+        return;
+    }
+
+    SyncSample sample;
+    sample.rttUs = (uint32_t)(t4 - t1);
+    sample.offsetUs = (int64_t)t2 - (int64_t)(t1 + (t4 - t1) / 2);
+    sample.timeUs = t4;
+
+    portENTER_CRITICAL(&syncMux);
+    syncSamples[syncSampleNext] = sample;
+    syncSampleNext = (syncSampleNext + 1) % SYNC_SAMPLES;
+    if (syncSampleCount < SYNC_SAMPLES)
+    {
+        syncSampleCount++;
+    }
+    syncBest = syncSamples[0];
+    for (uint8_t i = 1; i < syncSampleCount; i++)
+    {
+        if (syncSamples[i].rttUs < syncBest.rttUs)
+        {
+            syncBest = syncSamples[i];
+        }
+    }
+    syncRequestUs = 0;
+    syncChanged = true;
+    portEXIT_CRITICAL(&syncMux);
+}
+
+bool serviceTimeSync()
+{
+    unsigned long nowMs = millis();
+    unsigned long intervalMs = syncSampleCount < SYNC_SAMPLES ? SYNC_FAST_INTERVAL_MS : SYNC_INTERVAL_MS;
+    if (!syncMaster && nowMs - lastSyncRequestMs >= intervalMs)
+    {
+        lastSyncRequestMs = nowMs;
+        syncRequestUs = localClockUs();
+
+        char request[48];
+        snprintf(request, sizeof(request), "%s,%llu", syncBoardId, (unsigned long long)syncRequestUs);
+        publishMessage(TOPIC_SYNC_REQUEST, request);
+    }
+
+    portENTER_CRITICAL(&syncMux);
+    bool changed = syncChanged;
+    syncChanged = false;
+    portEXIT_CRITICAL(&syncMux);
+    return changed;
+}
+
+void getSyncStatus(SyncStatus &status)
+{
+    uint64_t nowUs = localClockUs();
+    portENTER_CRITICAL(&syncMux);
+    status.master = syncMaster;
+    status.synced = syncMaster || syncSampleCount > 0;
+    status.offsetUs = syncMaster || syncSampleCount == 0 ? 0 : syncBest.offsetUs;
+    status.rttUs = syncMaster ? 0 : syncBest.rttUs;
+    status.errorUs = status.rttUs / 2;
+    status.ageMs = syncMaster || syncSampleCount == 0 ? 0 : (uint32_t)((nowUs - syncBest.timeUs) / 1000);
+    status.lateStarts = syncLateStarts;
+    status.unsyncedStarts = syncUnsyncedStarts;
+    portEXIT_CRITICAL(&syncMux);
+}
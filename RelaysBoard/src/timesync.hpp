@@ -0,0 +1,41 @@
+#ifndef TIMESYNC_HPP
+#define TIMESYNC_HPP
+
+#include <stdint.h>
+
+// Shared timebase between relay boards. One board is the master (SYNC_MASTER in
+// config), the others exchange light/sync/req and light/sync/resp with it and
+// estimate their offset from the exchange with the lowest round trip.
+#define SYNC_INTERVAL_MS 10000     // Request period once synchronised
+#define SYNC_FAST_INTERVAL_MS 1000 // Request period until SYNC_SAMPLES answers are in
+#define SYNC_SAMPLES 8             // Exchanges considered for the offset
+#define SYNC_MAX_LEAD_MS 2000      // Start times further ahead are ignored, the CYD leads by 150 ms
+
+struct SyncStatus
+{
+    bool master;
+    bool synced;
+    int64_t offsetUs;    // Shared time minus local time
+    uint32_t rttUs;      // Round trip of the exchange the offset comes from
+    uint32_t errorUs;    // Worst case error of the offset, half the round trip
+    uint32_t ageMs;      // Time since that exchange
+    uint32_t lateStarts; // Effects whose start time had passed or was too far ahead
+    uint32_t unsyncedStarts; // Effects with a start time before the first exchange
+};
+
+void initTimeSync(const char *boardId);
+void setSyncMaster(bool master);
+uint64_t localClockUs();
+uint64_t sharedClockUs();
+// micros() value at which the shared time startMs happens. False if the board
+// has no shared time yet, or startMs has passed or is more than SYNC_MAX_LEAD_MS
+// ahead: localUs is then "now".
+bool sharedToLocalMicros(uint64_t startMs, unsigned long &localUs);
+
+void handleSyncRequest(char *payload);
+void handleSyncResponse(char *payload);
+// Send requests when due, true when the status changed. Call from loop().
+bool serviceTimeSync();
+void getSyncStatus(SyncStatus &status);
+
+#endif // TIMESYNC_HPP
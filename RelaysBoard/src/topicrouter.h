@@ -0,0 +1,129 @@
+#ifndef TOPICROUTER_H
+#define TOPICROUTER_H
+
+// Topic dispatch shared by the RelaysBoard and the CYD (keep both copies identical).
+// The topics a firmware handles are a constexpr table; compileTopicRouter() looks
+// for a hash seed under which they all land in different slots, at build time,
+// so a lookup is one hash and one strcmp however many topics there are.
+// Topics are matched without the vehicle prefix ("veh/<id>/"), see topicStripPrefix().
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define TOPIC_PREFIX_SIZE 40 // "veh/<id>/" and its terminator
+
+struct TopicRoute
+{
+    const char *suffix; // Topic below the vehicle prefix, e.g. "light/command"
+    uint8_t id;         // Handler of the topic
+    uint8_t qos;        // Subscription QoS
+};
+
+// FNV-1a, seeded
+constexpr uint32_t topicHash(const char *topic, uint32_t seed)
+{
+    uint32_t hash = 2166136261u ^ seed;
+    for (; *topic != '\0'; topic++)
+    {
+        hash = (hash ^ (uint8_t)*topic) * 16777619u;
+    }
+    return hash;
+}
+
+constexpr size_t topicTableSize(size_t routes)
+{
+    size_t size = 1;
+    while (size < 2 * routes)
+    {
+        size <<= 1;
+    }
+    return size;
+}
+
+template <size_t N>
+struct TopicRouter
+{
+    static constexpr size_t SIZE = topicTableSize(N);
+    uint32_t seed;
+    int8_t slots[SIZE]; // Index in the route table, -1 when empty
+};
+
+// Perfect hash of the route suffixes. The seed stays 0 if none separates them,
+// check it with a static_assert where the table is compiled.
+template <size_t N>
+constexpr TopicRouter<N> compileTopicRouter(const TopicRoute (&routes)[N])
+{
+    TopicRouter<N> router = {};
+    for (uint32_t seed = 1; seed < 100000; seed++)
+    {
+        for (size_t i = 0; i < TopicRouter<N>::SIZE; i++)
+        {
+            router.slots[i] = -1;
+        }
+        bool collision = false;
+        for (size_t i = 0; i < N && !collision; i++)
+        {
+            size_t slot = topicHash(routes[i].suffix, seed) & (TopicRouter<N>::SIZE - 1);
+            collision = router.slots[slot] >= 0;
+            router.slots[slot] = (int8_t)i;
+        }
+        if (!collision)
+        {
+            router.seed = seed;
+            return router;
+        }
+    }
+    return router;
+}
+
+// Handler id of a topic suffix, -1 if it is not in the table
+template <size_t N>
+inline int topicLookup(const TopicRouter<N> &router, const TopicRoute (&routes)[N], const char *suffix)
+{
+    int8_t index = router.slots[topicHash(suffix, router.seed) & (TopicRouter<N>::SIZE - 1)];
+    return index >= 0 && strcmp(routes[index].suffix, suffix) == 0 ? routes[index].id : -1;
+}
+
+// A vehicle id fits the prefix and is one topic level, without wildcards.
+// The empty id (the global topics) is valid.
+inline bool topicVehicleIdValid(const char *vehicleId)
+{
+    return vehicleId != NULL && strlen(vehicleId) <= TOPIC_PREFIX_SIZE - 6 && strpbrk(vehicleId, "/+#") == NULL;
+}
+
+// "veh/<id>/" for a vehicle id, empty (the global topics) when the id is empty or invalid
+inline void topicSetPrefix(char *prefix, const char *vehicleId)
+{
+    if (!topicVehicleIdValid(vehicleId) || vehicleId[0] == '\0')
+    {
+        prefix[0] = '\0';
+        return;
+    }
+    strcpy(prefix, "veh/");
+    strcat(prefix, vehicleId);
+    strcat(prefix, "/");
+}
+
+// The topic below the prefix, NULL when the topic belongs to another vehicle
+inline const char *topicStripPrefix(const char *topic, const char *prefix)
+{
+    size_t length = strlen(prefix);
+    return strncmp(topic, prefix, length) == 0 ? topic + length : NULL;
+}
+
+// Prefix and suffix into buffer, returns buffer (truncated if too small)
+inline const char *topicJoin(char *buffer, size_t size, const char *prefix, const char *suffix)
+{
+    size_t length = strlen(prefix);
+    if (length >= size)
+    {
+        length = size - 1;
+    }
+    memcpy(buffer, prefix, length);
+    strncpy(buffer + length, suffix, size - length - 1);
+    buffer[size - 1] = '\0';
+    return buffer;
+}
+
+#endif // TOPICROUTER_H
@@ -0,0 +1,60 @@
+#ifndef TRANSFORM_HPP
+#define TRANSFORM_HPP
+
+#include "effects.h"
+#include "program.hpp"
+
+// Compile-time variants of the built-in patterns, one program per EffectFlags
+// combination. playEffect() selects the variant once, steps never test the flags.
+
+constexpr uint8_t mirrorMask(uint8_t mask)
+{
+    return ((mask & 0b0001) << 3) | ((mask & 0b0010) << 1) | ((mask & 0b0100) >> 1) | ((mask & 0b1000) >> 3);
+}
+
+constexpr uint8_t transformMask(uint8_t mask, uint8_t flags)
+{
+    return ((flags & EFFECT_MIRROR ? mirrorMask(mask) : mask) ^ (flags & EFFECT_INVERT ? PROGRAM_MASK : 0)) & PROGRAM_MASK;
+}
+
+template <size_t N>
+struct PatternVariants
+{
+    PatternProgram<N> variant[EFFECT_VARIANTS];
+};
+
+template <size_t N>
+constexpr PatternVariants<N> compileVariants(const uint8_t (&pattern)[N])
+{
+    PatternVariants<N> variants = {};
+    for (uint8_t flags = 0; flags < EFFECT_VARIANTS; flags++)
+    {
+        uint8_t transformed[N] = {};
+        for (size_t i = 0; i < N; i++)
+        {
+            size_t index = flags & EFFECT_REVERSE ? N - 1 - i : i;
+            transformed[i] = transformMask(pattern[index], flags);
+        }
+        variants.variant[flags] = compilePattern(transformed);
+    }
+    return variants;
+}
+
+// Uploaded programs cannot be rewritten at compile time, their frames go through
+// this lookup instead (reverse does not apply to them)
+struct FrameTransform
+{
+    uint8_t mask[PROGRAM_MASK + 1];
+};
+
+constexpr FrameTransform compileFrameTransform(uint8_t flags)
+{
+    FrameTransform table = {};
+    for (uint8_t mask = 0; mask <= PROGRAM_MASK; mask++)
+    {
+        table.mask[mask] = transformMask(mask, flags);
+    }
+    return table;
+}
+
+#endif // TRANSFORM_HPP
@@ -0,0 +1,95 @@
+#include "waveform.hpp"
+#include "wear.hpp"
+
+void waveformPosition(const RmtFrame *frames, size_t count, uint64_t cycleUs, uint64_t elapsedUs, WaveformPosition &position)
+{
+    position.cycles = elapsedUs / cycleUs;
+    position.offsetUs = elapsedUs % cycleUs;
+    position.frame = 0;
+    position.frameStartUs = 0;
+    while (position.frame + 1 < count && position.frameStartUs + frames[position.frame].durationUs <= position.offsetUs)
+    {
+        position.frameStartUs += frames[position.frame++].durationUs;
+    }
+}
+
+uint8_t accountWaveform(const RmtFrame *frames, size_t count, uint64_t cycleUs, uint8_t initialState,
+                        unsigned long startUs, uint64_t elapsedUs)
+{
+    WaveformPosition position;
+    waveformPosition(frames, count, cycleUs, elapsedUs, position);
+    size_t frame = position.frame;
+    uint8_t state = frames[frame].mask;
+
+    RelayPlayback playback;
+    playback.startUs = startUs;
+    playback.state = state;
+    for (uint8_t i = 0; i < RELAY_COUNT; i++)
+    {
+        uint8_t bit = 1 << i;
+
+        // Transitions and on-time of one repetition, including the wrap
+        uint32_t cycleSwitches = 0;
+        uint64_t cycleOnUs = 0;
+        for (size_t f = 0; f < count; f++)
+        {
+            bool on = frames[f].mask & bit;
+            if (on != (bool)(frames[(f + 1) % count].mask & bit))
+            {
+                cycleSwitches++;
+            }
+            if (on)
+            {
+                cycleOnUs += frames[f].durationUs;
+            }
+        }
+
+        uint32_t switches = ((initialState ^ frames[0].mask) & bit) ? 1 : 0;
+        uint64_t onUs = position.cycles * cycleOnUs;
+        for (size_t f = 0; f < frame; f++)
+        {
+            if ((frames[f].mask ^ frames[f + 1].mask) & bit)
+            {
+                switches++;
+            }
+            if (frames[f].mask & bit)
+            {
+                onUs += frames[f].durationUs;
+            }
+        }
+        playback.switches[i] = switches + (uint32_t)(position.cycles * cycleSwitches);
+
+        // How long the relay has held its final level, walking back through the frames
+        uint64_t heldUs = position.offsetUs - position.frameStartUs;
+        size_t f = frame;
+        for (size_t steps = 0; steps < count * 2; steps++)
+        {
+            if (f == 0 && position.cycles == 0)
+            {
+                break;
+            }
+            size_t previous = f == 0 ? count - 1 : f - 1;
+            if ((frames[previous].mask ^ state) & bit)
+            {
+                break;
+            }
+            heldUs += frames[previous].durationUs;
+            f = previous;
+        }
+        if (heldUs > elapsedUs)
+        {
+            heldUs = elapsedUs;
+        }
+
+        // On-time of the level in progress is counted by the wear accounting from now on
+        if (state & bit)
+        {
+            onUs += position.offsetUs - position.frameStartUs;
+            onUs -= heldUs;
+        }
+        playback.onUs[i] = onUs;
+        playback.heldUs[i] = (unsigned long)heldUs;
+    }
+    accountRelayPlayback(playback);
+    return state;
+}
@@ -0,0 +1,25 @@
+#ifndef WAVEFORM_HPP
+#define WAVEFORM_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include "rmtout.hpp"
+
+// Where a looping waveform of relay frames is after some time, and the relay
+// wear it caused. Hardware free, the RMT backend and its stand-in in the
+// simulator share it.
+struct WaveformPosition
+{
+    uint64_t cycles;       // Whole repetitions played
+    size_t frame;          // Frame showing in the current one
+    uint64_t frameStartUs; // Its start, from the start of the repetition
+    uint64_t offsetUs;     // Time into the repetition
+};
+
+void waveformPosition(const RmtFrame *frames, size_t count, uint64_t cycleUs, uint64_t elapsedUs, WaveformPosition &position);
+// Hand the transitions of a playback stopped after elapsedUs to the wear
+// accounting. Returns the relay state it stopped on.
+uint8_t accountWaveform(const RmtFrame *frames, size_t count, uint64_t cycleUs, uint8_t initialState,
+                        unsigned long startUs, uint64_t elapsedUs);
+
+#endif // WAVEFORM_HPP
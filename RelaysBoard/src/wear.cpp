@@ -0,0 +1,256 @@
+#include "wear.hpp"
+#include "light.hpp"
+#include <Arduino.h>
+#include <Preferences.h>
+
+#define WEAR_NAMESPACE "wear"
+#define WEAR_VERSION 1
+
+// Record kept in NVS, written as one blob so an update is all or nothing
+struct WearRecord
+{
+    uint8_t version;
+    uint32_t switches[RELAY_COUNT];
+    uint64_t onMs[RELAY_COUNT];
+    uint16_t minDwellMs[RELAY_COUNT];
+};
+
+static portMUX_TYPE wearMux = portMUX_INITIALIZER_UNLOCKED;
+WearRecord wearRecord;
+uint8_t relayState = OFF_STATE;   // State on the relays
+uint8_t pendingMask = 0;          // Channels held back by their dwell
+uint8_t pendingState = OFF_STATE; // State the held channels were asked for
+unsigned long lastChangeUs[RELAY_COUNT];
+unsigned long onSinceUs[RELAY_COUNT];
+uint32_t coalescedTransitions = 0;
+
+uint32_t switchesSinceSave = 0;
+bool dirty = false;
+unsigned long lastSaveMs = 0;
+unsigned long lastFoldMs = 0;
+
+void initRelayWear()
+{
+    Preferences preferences;
+    preferences.begin(WEAR_NAMESPACE, true);
+    bool loaded = preferences.isKey("record") &&
+                  preferences.getBytes("record", &wearRecord, sizeof(wearRecord)) == sizeof(wearRecord) &&
+                  wearRecord.version == WEAR_VERSION;
+    preferences.end();
+
+    if (!loaded)
+    {
+        memset(&wearRecord, 0, sizeof(wearRecord));
+        wearRecord.version = WEAR_VERSION;
+        for (int i = 0; i < RELAY_COUNT; i++)
+        {
+            wearRecord.minDwellMs[i] = WEAR_DEFAULT_DWELL_MS;
+        }
+    }
+
+    // Relays are free to switch right after boot
+    unsigned long nowUs = micros();
+    for (int i = 0; i < RELAY_COUNT; i++)
+    {
+        lastChangeUs[i] = nowUs - (unsigned long)wearRecord.minDwellMs[i] * 1000UL;
+    }
+}
+
+uint8_t filterRelayState(uint8_t requested, bool force)
+{
+    unsigned long nowUs = micros();
+    uint8_t allowed = requested;
+
+    portENTER_CRITICAL(&wearMux);
+    for (int i = 0; i < RELAY_COUNT; i++)
+    {
+        uint8_t bit = 1 << i;
+
+        // A held transition that is requested back to the current state never happens
+        if ((pendingMask & bit) && !((requested ^ relayState) & bit))
+        {
+            coalescedTransitions++;
+        }
+
+        if (!force && ((requested ^ relayState) & bit) &&
+            nowUs - lastChangeUs[i] < (unsigned long)wearRecord.minDwellMs[i] * 1000UL)
+        {
+            allowed = (allowed & ~bit) | (relayState & bit);
+        }
+    }
+    pendingMask = requested ^ allowed;
+    pendingState = requested;
+
+    uint8_t changed = allowed ^ relayState;
+    for (int i = 0; i < RELAY_COUNT; i++)
+    {
+        uint8_t bit = 1 << i;
+        if (!(changed & bit))
+        {
+            continue;
+        }
+        wearRecord.switches[i]++;
+        switchesSinceSave++;
+        lastChangeUs[i] = nowUs;
+        if (allowed & bit)
+        {
+            onSinceUs[i] = nowUs;
+        }
+        else
+        {
+            wearRecord.onMs[i] += (nowUs - onSinceUs[i]) / 1000UL;
+        }
+    }
+    relayState = allowed;
+    if (changed)
+    {
+        dirty = true;
+    }
+    portEXIT_CRITICAL(&wearMux);
+
+    return allowed;
+}
+
+bool takeDueRelayState(uint8_t &state, unsigned long &waitUs)
+{
+    unsigned long nowUs = micros();
+    waitUs = EFFECT_IDLE;
+
+    portENTER_CRITICAL(&wearMux);
+    for (int i = 0; i < RELAY_COUNT; i++)
+    {
+        if (!(pendingMask & (1 << i)))
+        {
+            continue;
+        }
+        unsigned long dwellUs = (unsigned long)wearRecord.minDwellMs[i] * 1000UL;
+        unsigned long elapsedUs = nowUs - lastChangeUs[i];
+        unsigned long remainingUs = elapsedUs < dwellUs ? dwellUs - elapsedUs : 0;
+        if (remainingUs < waitUs)
+        {
+            waitUs = remainingUs;
+        }
+    }
+    state = pendingState;
+    portEXIT_CRITICAL(&wearMux);
+
+    return waitUs == 0;
+}
+
+void setMinDwell(uint8_t channel, uint16_t dwellMs)
+{
+    if (channel >= RELAY_COUNT)
+    {
+        return;
+    }
+    portENTER_CRITICAL(&wearMux);
+    wearRecord.minDwellMs[channel] = dwellMs;
+    dirty = true;
+    switchesSinceSave = WEAR_SAVE_SWITCHES; // Save the new setting at the next opportunity
+    portEXIT_CRITICAL(&wearMux);
+}
+
+uint16_t getMinDwell(uint8_t channel)
+{
+    portENTER_CRITICAL(&wearMux);
+    uint16_t dwellMs = channel < RELAY_COUNT ? wearRecord.minDwellMs[channel] : 0;
+    portEXIT_CRITICAL(&wearMux);
+    return dwellMs;
+}
+
+void accountRelayPlayback(const RelayPlayback &playback)
+{
+    unsigned long nowUs = micros();
+    portENTER_CRITICAL(&wearMux);
+    for (int i = 0; i < RELAY_COUNT; i++)
+    {
+        uint8_t bit = 1 << i;
+
+        // Close the on period that was running when playback started
+        if (relayState & bit)
+        {
+            wearRecord.onMs[i] += (playback.startUs - onSinceUs[i]) / 1000UL;
+        }
+        wearRecord.onMs[i] += playback.onUs[i] / 1000ULL;
+        wearRecord.switches[i] += playback.switches[i];
+        switchesSinceSave += playback.switches[i];
+
+        if (playback.switches[i] != 0)
+        {
+            lastChangeUs[i] = nowUs - playback.heldUs[i];
+        }
+        if (playback.state & bit)
+        {
+            onSinceUs[i] = nowUs - playback.heldUs[i];
+        }
+    }
+    relayState = playback.state;
+    pendingMask = 0;
+    dirty = true;
+    portEXIT_CRITICAL(&wearMux);
+}
+
+// Move the on-time of energised relays into the hour meters, so long
+// on periods are neither lost on a reset nor overflow micros()
+static void foldOnTime()
+{
+    unsigned long nowUs = micros();
+    portENTER_CRITICAL(&wearMux);
+    for (int i = 0; i < RELAY_COUNT; i++)
+    {
+        if (relayState & (1 << i))
+        {
+            unsigned long elapsedMs = (nowUs - onSinceUs[i]) / 1000UL;
+            wearRecord.onMs[i] += elapsedMs;
+            onSinceUs[i] += elapsedMs * 1000UL;
+            dirty = dirty || elapsedMs > 0;
+        }
+    }
+    portEXIT_CRITICAL(&wearMux);
+}
+
+void getRelayWear(RelayWear &wear)
+{
+    foldOnTime();
+    portENTER_CRITICAL(&wearMux);
+    memcpy(wear.switches, wearRecord.switches, sizeof(wear.switches));
+    memcpy(wear.onMs, wearRecord.onMs, sizeof(wear.onMs));
+    memcpy(wear.minDwellMs, wearRecord.minDwellMs, sizeof(wear.minDwellMs));
+    wear.coalesced = coalescedTransitions;
+    portEXIT_CRITICAL(&wearMux);
+}
+
+bool saveRelayWearIfDue()
+{
+    unsigned long nowMs = millis();
+    if (nowMs - lastFoldMs >= WEAR_FOLD_INTERVAL_MS)
+    {
+        lastFoldMs = nowMs;
+        foldOnTime();
+    }
+
+    // Writes are batched: many switches or a long quiet period, but never back to back
+    portENTER_CRITICAL(&wearMux);
+    bool due = dirty && nowMs - lastSaveMs >= WEAR_MIN_SAVE_INTERVAL_MS &&
+               (switchesSinceSave >= WEAR_SAVE_SWITCHES || nowMs - lastSaveMs >= WEAR_SAVE_INTERVAL_MS);
+    WearRecord record;
+    if (due)
+    {
+        record = wearRecord;
+        switchesSinceSave = 0;
+        dirty = false;
+    }
+    portEXIT_CRITICAL(&wearMux);
+
+    if (!due)
+    {
+        return false;
+    }
+    lastSaveMs = nowMs;
+
+    Preferences preferences;
+    preferences.begin(WEAR_NAMESPACE, false);
+    preferences.putBytes("record", &record, sizeof(record));
+    preferences.end();
+    return true;
+}
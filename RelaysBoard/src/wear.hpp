@@ -0,0 +1,47 @@
+#ifndef WEAR_HPP
+#define WEAR_HPP
+
+#include <stdint.h>
+
+#define RELAY_COUNT 4
+#define WEAR_DEFAULT_DWELL_MS 100            // Shortest time a relay holds a state
+#define WEAR_SAVE_SWITCHES 500               // Save the counters after this many switches...
+#define WEAR_SAVE_INTERVAL_MS (15 * 60000UL) // ...or this long after a change
+#define WEAR_MIN_SAVE_INTERVAL_MS 60000UL    // Never write NVS more often than this
+#define WEAR_FOLD_INTERVAL_MS 10000UL        // Fold running on-times into the hour meters
+
+// Per-channel relay counters, as published on light/wear
+struct RelayWear
+{
+    uint32_t switches[RELAY_COUNT];  // Contact transitions since the board was new
+    uint64_t onMs[RELAY_COUNT];      // Time spent energised
+    uint16_t minDwellMs[RELAY_COUNT];
+    uint32_t coalesced;              // Transitions dropped by the dwell filter since boot
+};
+
+// Transitions the RMT backend made without filterRelayState()
+struct RelayPlayback
+{
+    unsigned long startUs;              // micros() when playback started
+    uint32_t switches[RELAY_COUNT];
+    uint64_t onUs[RELAY_COUNT];         // Energised time, without the level still held
+    unsigned long heldUs[RELAY_COUNT];  // How long each relay has shown its final level
+    uint8_t state;                      // Relay state when playback stopped
+};
+
+void initRelayWear();
+// Apply the dwell filter to a requested relay state and account for the
+// transitions it lets through, returns the state to write. Effect task only.
+uint8_t filterRelayState(uint8_t requested, bool force);
+// A state held back by the dwell filter, true when it is due now,
+// otherwise waitUs is how long until it is (EFFECT_IDLE if nothing waits)
+bool takeDueRelayState(uint8_t &state, unsigned long &waitUs);
+void setMinDwell(uint8_t channel, uint16_t dwellMs);
+uint16_t getMinDwell(uint8_t channel);
+// Take over the relay state after an RMT playback and count its transitions. Effect task only.
+void accountRelayPlayback(const RelayPlayback &playback);
+void getRelayWear(RelayWear &wear);
+// Persist the counters when enough changed, true after a save. Call from loop().
+bool saveRelayWearIfDue();
+
+#endif // WEAR_HPP